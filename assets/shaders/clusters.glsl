@@ -0,0 +1,33 @@
+// The view space light cluster grid, mirrors ShaderTypes.h. Needs frame.glsl.
+
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+#define MAX_LIGHTS_PER_CLUSTER 256
+
+uint clusterIndex(in uvec3 cluster) {
+    return (cluster.z * CLUSTER_GRID_Y + cluster.y) * CLUSTER_GRID_X + cluster.x;
+}
+
+// Depth is the positive distance along the view direction
+uint depthSlice(float viewDepth) {
+    const float slice = log(max(viewDepth, frame.zNear) / frame.zNear) / log(frame.zFar / frame.zNear) * CLUSTER_GRID_Z;
+    return min(uint(slice), uint(CLUSTER_GRID_Z - 1));
+}
+
+float sliceDepth(uint slice) {
+    return frame.zNear * pow(frame.zFar / frame.zNear, float(slice) / CLUSTER_GRID_Z);
+}
+
+// Distance at which the attenuated light drops below the cutoff
+float lightRadius(in vec3 lightColor) {
+    const float intensity = max(lightColor.r, max(lightColor.g, lightColor.b));
+    // solve constant + linear * d + quadratic * d^2 = intensity / cutoff
+    const float c = frame.falloffConstant - intensity / frame.lightCutoff;
+    if (c >= 0.0f) return 0.0f;
+    if (frame.falloffQuadratic <= 0.0f) return -c / max(frame.falloffLinear, 1e-6f);
+    const float a = frame.falloffQuadratic;
+    const float b = frame.falloffLinear;
+    return (-b + sqrt(b * b - 4.0f * a * c)) / (2.0f * a);
+}
@@ -0,0 +1,12 @@
+#version 460
+
+// Written by the forward subpass of the same render pass, read at this very pixel
+layout(input_attachment_index = 0, binding = 0) uniform subpassInput colorInput;
+layout(input_attachment_index = 1, binding = 1) uniform subpassInput bloomInput;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    // What the post pass adds up by blending its two draws
+    outColor = subpassLoad(colorInput) + subpassLoad(bloomInput);
+}
@@ -1,13 +1,15 @@
 #version 460
 
+#include "structs.glsl"
+#include "frame.glsl"
+#include "vertex.glsl"
+
 layout(location = 0) in vec3 vPosition;
 
-layout (push_constant) uniform Lol {
-    mat4 camera;
-    mat4 mvp;
-} lol;
+invariant gl_Position;
 
 void main() {
-    vec4 worldPos = lol.mvp * vec4(vPosition, 1.0f);
-    gl_Position = lol.camera * worldPos;
+    const InstanceData instance = instances[gl_InstanceIndex];
+    vec4 worldPos = instance.model * vec4(decodePosition(vPosition, instance), 1.0f);
+    gl_Position = frame.viewProjection * worldPos;
 }
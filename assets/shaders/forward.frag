@@ -1,54 +1,59 @@
 #version 460
+#extension GL_EXT_nonuniform_qualifier : require
 
 #include "structs.glsl"
 #include "utils.glsl"
+#include "frame.glsl"
+#include "clusters.glsl"
 
 layout(location = 0) in vec3 fragPos;
 layout(location = 1) in vec2 uv;
 layout(location = 2) in mat3 TBN;
+layout(location = 5) flat in uint textureIndices;
 
-layout(set = 0, binding = 0) uniform sampler2D diffuseTex;
-layout(set = 0, binding = 1) uniform sampler2D normalTex;
+layout(set = 1, binding = 0) uniform sampler2D textures[];
 
-
-layout(set = 1, binding = 2) uniform LightBuffer {
-    LightData lightData[2000];
-    uint lightCount;
-    float falloffConstant;
-    float falloffLinear;
-    float falloffQuadratic;
+layout(std430, set = 2, binding = 0) readonly buffer ClusterCountBuffer {
+    uint clusterLightCounts[];
 };
 
-layout(set = 1, binding = 3) uniform MaterialBuffer {
-    Material materials[1];
+layout(std430, set = 2, binding = 1) readonly buffer ClusterIndexBuffer {
+    uint clusterLightIndices[];
 };
 
-layout (push_constant) uniform Lol {
-    mat4 camera;
-    mat4 mvp;
-    vec3 camPos;
-} lol;
+layout(std430, set = 3, binding = 0) readonly buffer LightBuffer {
+    LightData lightData[];
+};
 
 
 layout(location = 0) out vec4 outColor;
 layout(location = 1) out vec4 outBloom;
 
 void main() {
-    vec3 normal = texture(normalTex, uv).xyz * 2.0f - 1.0f;
+    // A multi draw mixes instances, so the index is not uniform
+    const uint diffuseIdx = textureIndices & 0xffffu;
+    const uint normalIdx = textureIndices >> 16;
+    vec3 normal = texture(textures[nonuniformEXT(normalIdx)], uv).xyz * 2.0f - 1.0f;
     normal = normalize(TBN * normal);
-    vec3 albedo = texture(diffuseTex, uv).xyz;
+    vec3 albedo = texture(textures[nonuniformEXT(diffuseIdx)], uv).xyz;
 
     vec3 totalLight = vec3(0);
 
-    for(uint lightIdx = 0; lightIdx < 50; lightIdx++) {
+    // Only the lights whose range overlaps the cluster of this fragment
+    const float viewDepth = -(frame.view * vec4(fragPos, 1.0f)).z;
+    const uvec2 tile = min(uvec2(gl_FragCoord.xy / frame.screenSize * vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y)), uvec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+    const uint cluster = clusterIndex(uvec3(tile, depthSlice(viewDepth)));
+    const uint nrLights = clusterLightCounts[cluster];
+    for(uint i = 0; i < nrLights; i++) {
+        const uint lightIdx = clusterLightIndices[cluster * MAX_LIGHTS_PER_CLUSTER + i];
         const vec3 lightPos = lightData[lightIdx].lightPos.xyz;
         const vec3 lightColor = lightData[lightIdx].lightColor.xyz;
         const vec3 toLight = normalize(lightPos - fragPos);
         const float lightDist = distance(fragPos, lightPos);
-        const float attenuation = 1.0f / (falloffConstant + falloffLinear * lightDist + falloffQuadratic * lightDist * lightDist);
+        const float attenuation = 1.0f / (frame.falloffConstant + frame.falloffLinear * lightDist + frame.falloffQuadratic * lightDist * lightDist);
 
         const float diffuse = max(0.0f, dot(toLight, normal));
-        const vec3 E = normalize(lol.camPos - fragPos);
+        const vec3 E = normalize(frame.camPos.xyz - fragPos);
         const vec3 R = reflect(-toLight, normal);
         const float specular = pow(max(0.0f, dot(R, E)), 25);
 
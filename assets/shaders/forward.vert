@@ -1,30 +1,34 @@
 #version 460
 
+#include "structs.glsl"
+#include "frame.glsl"
+#include "vertex.glsl"
+
 layout(location = 0) in vec3 vPosition;
 layout(location = 1) in vec2 vUv;
-layout(location = 2) in vec3 vNormal;
-layout(location = 3) in vec3 vTangent;
+layout(location = 2) in vec2 vNormal;
+layout(location = 3) in vec2 vTangent;
 
 layout(location = 0) out vec3 fragPos;
 layout(location = 1) out vec2 uv;
 layout(location = 2) out mat3 TBN;
+layout(location = 5) flat out uint textureIndices;
 
-layout (push_constant) uniform Lol {
-    mat4 camera;
-    mat4 mvp;
-    vec3 camPos;
-} lol;
+invariant gl_Position;
 
 void main() {
+    const InstanceData instance = instances[gl_InstanceIndex];
+    const mat4 model = instance.model;
 
-    vec4 worldPos = lol.mvp * vec4(vPosition, 1.0f);
-    gl_Position = lol.camera * worldPos;
+    vec4 worldPos = model * vec4(decodePosition(vPosition, instance), 1.0f);
+    gl_Position = frame.viewProjection * worldPos;
 
     uv = vUv;
+    textureIndices = instance.textureIndices;
     fragPos = worldPos.xyz;
 
-    vec3 N = normalize((lol.mvp * vec4(vNormal, 0.0f)).xyz);
-    vec3 T = normalize((lol.mvp * vec4(vTangent, 0.0f)).xyz);
+    vec3 N = normalize((model * vec4(octDecode(vNormal), 0.0f)).xyz);
+    vec3 T = normalize((model * vec4(octDecode(vTangent), 0.0f)).xyz);
     vec3 B = cross(T, N);
     TBN = mat3(T, B, N);
 }
@@ -0,0 +1,36 @@
+// The frame ring descriptor set, mirrors ShaderTypes.h
+
+struct InstanceData {
+    mat4 model;
+    vec4 bbMin;
+    vec4 bbMax;
+    uint indexCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint textureIndices;
+    uint firstMeshlet;
+    uint meshletCount;
+    uint wideIndices;
+    uint padding;
+};
+
+layout(std140, set = 0, binding = 0) uniform FrameUniforms {
+    mat4 viewProjection;
+    vec4 camPos;
+    uint lightCount;
+    float falloffConstant;
+    float falloffLinear;
+    float falloffQuadratic;
+    mat4 view;
+    vec2 tanHalfFov;
+    vec2 screenSize;
+    float zNear;
+    float zFar;
+    float lightCutoff;
+    float padding;
+    vec2 renderScale;
+} frame;
+
+layout(std430, set = 0, binding = 1) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
@@ -2,10 +2,54 @@
 
 layout(binding = 0) uniform sampler2D texInput;
 
+layout (push_constant) uniform PushConstant {
+    // Part of the input that was rendered to this frame
+    vec2 renderScale;
+};
+
 layout(location = 0) in vec2 uv;
 
 layout(location = 0) out vec4 outColor;
 
+// Catmull-Rom upsampling from 9 bilinear taps instead of 16 point taps. Every tap is clamped
+// to the rendered region, so nothing outside of it bleeds in at the edges.
+vec4 sampleCatmullRom(in vec2 coord) {
+    const vec2 texSize = vec2(textureSize(texInput, 0));
+    const vec2 uvMin = 0.5f / texSize;
+    const vec2 uvMax = renderScale - 0.5f / texSize;
+
+    const vec2 samplePos = coord * texSize;
+    const vec2 texPos1 = floor(samplePos - 0.5f) + 0.5f;
+    const vec2 f = samplePos - texPos1;
+
+    const vec2 w0 = f * (-0.5f + f * (1.0f - 0.5f * f));
+    const vec2 w1 = 1.0f + f * f * (-2.5f + 1.5f * f);
+    const vec2 w2 = f * (0.5f + f * (2.0f - 1.5f * f));
+    const vec2 w3 = f * f * (-0.5f + 0.5f * f);
+
+    // The middle two weights are folded into a single bilinear tap
+    const vec2 w12 = w1 + w2;
+    const vec2 tc0 = clamp((texPos1 - 1.0f) / texSize, uvMin, uvMax);
+    const vec2 tc12 = clamp((texPos1 + w2 / w12) / texSize, uvMin, uvMax);
+    const vec2 tc3 = clamp((texPos1 + 2.0f) / texSize, uvMin, uvMax);
+
+    vec4 result = vec4(0.0f);
+    result += texture(texInput, vec2(tc0.x, tc0.y)) * w0.x * w0.y;
+    result += texture(texInput, vec2(tc12.x, tc0.y)) * w12.x * w0.y;
+    result += texture(texInput, vec2(tc3.x, tc0.y)) * w3.x * w0.y;
+
+    result += texture(texInput, vec2(tc0.x, tc12.y)) * w0.x * w12.y;
+    result += texture(texInput, vec2(tc12.x, tc12.y)) * w12.x * w12.y;
+    result += texture(texInput, vec2(tc3.x, tc12.y)) * w3.x * w12.y;
+
+    result += texture(texInput, vec2(tc0.x, tc3.y)) * w0.x * w3.y;
+    result += texture(texInput, vec2(tc12.x, tc3.y)) * w12.x * w3.y;
+    result += texture(texInput, vec2(tc3.x, tc3.y)) * w3.x * w3.y;
+
+    // The negative lobes can overshoot below zero around sharp edges
+    return max(result, vec4(0.0f));
+}
+
 void main() {
-    outColor = texture(texInput, uv);
+    outColor = sampleCatmullRom(uv * renderScale);
 }
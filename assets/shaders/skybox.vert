@@ -6,10 +6,14 @@ layout(location = 0) out vec3 uv;
 
 layout (push_constant) uniform Lol {
     mat4 camera;
+    // Of the cube, its positions are packed like any other mesh
+    vec4 bbMin;
+    vec4 bbMax;
 } push;
 
 void main() {
-    uv = vPosition;
-    vec4 position = push.camera * vec4(vPosition, 0.0f);
+    const vec3 direction = mix(push.bbMin.xyz, push.bbMax.xyz, vPosition);
+    uv = direction;
+    vec4 position = push.camera * vec4(direction, 0.0f);
     gl_Position = position.xyww;
 }
\ No newline at end of file
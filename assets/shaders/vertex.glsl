@@ -0,0 +1,15 @@
+// Decodes the packed vertex layouts of the geometry arena, mirrors Primitives.h
+
+// Positions are fractions of the bounding box of the mesh. The depth and forward passes have to
+// produce the exact same position for the equal depth test, so both go through this.
+vec3 decodePosition(vec3 position, InstanceData instance) {
+    return mix(instance.bbMin.xyz, instance.bbMax.xyz, position);
+}
+
+vec3 octDecode(vec2 e) {
+    vec3 v = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+    const float t = max(-v.z, 0.0f);
+    v.x += v.x >= 0.0f ? -t : t;
+    v.y += v.y >= 0.0f ? -t : t;
+    return normalize(v);
+}
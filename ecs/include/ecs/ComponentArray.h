@@ -57,6 +57,12 @@ public:
 
     T* GetRawPointer() { return m_componentArray.data(); }
 
+    // Position of the entity's component in the raw array, only stable until the next removal.
+    size_t GetIndex(Entity entity) {
+        assert(m_entityToIndexMap.find(entity) != m_entityToIndexMap.end() && "Component does not exist for this entity");
+        return m_entityToIndexMap[entity];
+    }
+
     bool HasEntity(Entity entity) {
         return m_entityToIndexMap.find(entity) != m_entityToIndexMap.end();
     }
@@ -58,6 +58,11 @@ public:
         return GetComponentArray<T>()->GetRawPointer();
     }
 
+    template<typename T>
+    size_t GetComponentIndex(Entity entity) {
+        return GetComponentArray<T>()->GetIndex(entity);
+    }
+
     template<typename T>
     bool HasComponent(Entity entity) {
         return GetComponentArray<T>()->HasEntity(entity);
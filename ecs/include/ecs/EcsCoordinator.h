@@ -64,6 +64,11 @@ public:
         return m_componentManager->GetComponentArrayData<T>();
     }
 
+    template<typename T>
+    size_t GetComponentIndex(Entity entity) {
+        return m_componentManager->GetComponentIndex<T>(entity);
+    }
+
     template<typename T>
     bool HasComponent(Entity entity) {
         return m_componentManager->HasComponent<T>(entity);
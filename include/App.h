@@ -14,7 +14,24 @@
 #include "EvCamera.h"
 #include "EvOverlay.h"
 
+struct AppOptions {
+    // Render into offscreen images without a window, then exit with timing statistics
+    bool headless = false;
+    uint32_t benchmarkFrames = 1000;
+    int width = 1280;
+    int height = 768;
+    // BloomPass::Mode
+    int bloomMode = 0;
+};
+
 class App {
+    static constexpr uint32_t FRAMES_IN_FLIGHT = 2;
+    // Excluded from the benchmark statistics, they include pipeline warmup and the first uploads
+    static constexpr uint32_t BENCHMARK_WARMUP_FRAMES = 10;
+
+    // Declared first so it is taken before anything else is created
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    AppOptions options;
     EvWindow window;
     EvDevice device;
     EvInputHelper inputHelper;
@@ -28,12 +45,15 @@ class App {
     Entity floor;
     std::vector<Entity> lights;
     EvMesh* cubeMesh;
+    // CPU time of every frame in seconds, only kept in headless mode
+    std::vector<double> frameTimes;
 
     void createECSSystems();
     void createWorld();
     Entity addInstance(EvMesh* mesh, rp3::BodyType bodyType, glm::vec3 scale, glm::vec3 position, glm::vec2 textureScale, TextureSet* textureSet = nullptr);
+    void printBenchmarkResults() const;
 
 public:
-    App();
+    explicit App(const AppOptions& options = {});
     void Run();
 };
@@ -12,7 +12,11 @@ struct PhysicsComponent {
 };
 
 struct TextureSet : NoCopy {
-    std::vector<VkDescriptorSet> descriptorSets;
+    // Used to sort draws, unique per render system
+    uint32_t id = 0;
+    // Slots in the texture table
+    uint32_t diffuseIndex = 0;
+    uint32_t normalIndex = 0;
 };
 
 struct Material
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "core.h"
+
+// Scoped CPU zones recorded into a ring buffer per thread. Recording only touches the
+// buffer of the calling thread and publishes with a single atomic store, so zones are
+// cheap enough to leave in. The rings can be exported as a chrome://tracing / Perfetto
+// trace, and the zones of the last frame on the main thread are kept as a summary.
+class EvCpuProfiler : NoCopy {
+public:
+    static constexpr uint32_t RING_CAPACITY = 1 << 16;
+
+    struct Event {
+        // Has to be a string literal, only the pointer is stored
+        const char* name;
+        uint64_t startNs;
+        uint64_t endNs;
+        uint32_t depth;
+    };
+
+    struct SummaryEntry {
+        const char* name;
+        uint32_t depth;
+        float ms;
+    };
+
+private:
+    struct ThreadBuffer {
+        uint32_t threadId;
+        std::unique_ptr<Event[]> events;
+        // Total number of events ever written, the producer is the only writer
+        std::atomic<uint64_t> head{0};
+        // Zones currently open on the thread
+        uint32_t depth = 0;
+    };
+
+    std::chrono::steady_clock::time_point epoch;
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> threadBuffers;
+
+    uint64_t frameStartNs = 0;
+    std::vector<SummaryEntry> frameSummary;
+    float frameMs = 0.0f;
+
+    EvCpuProfiler();
+    ThreadBuffer& getThreadBuffer();
+
+public:
+    static EvCpuProfiler& get();
+
+    inline uint64_t now() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+    }
+
+    // Returns the start time of the zone, to be passed to endZone on the same thread.
+    uint64_t beginZone();
+    void endZone(const char* name, uint64_t startNs);
+
+    // Called on the main thread once per frame, summarizes the zones it recorded since the previous call.
+    void beginFrame();
+    inline const std::vector<SummaryEntry>& getFrameSummary() const { return frameSummary; }
+    inline float getFrameMs() const { return frameMs; }
+
+    // Writes the events still in the rings of all threads in the chrome trace event format.
+    // Safe to call while other threads record, events being overwritten at that moment may be skipped.
+    bool exportChromeTrace(const std::string& filename);
+};
+
+class EvCpuZone : NoCopy {
+    const char* name;
+    uint64_t startNs;
+
+public:
+    explicit EvCpuZone(const char* name) : name(name), startNs(EvCpuProfiler::get().beginZone()) {}
+    ~EvCpuZone() { EvCpuProfiler::get().endZone(name, startNs); }
+};
+
+#define EV_CPU_ZONE_CONCAT_IMPL(a, b) a##b
+#define EV_CPU_ZONE_CONCAT(a, b) EV_CPU_ZONE_CONCAT_IMPL(a, b)
+// Times the rest of the enclosing scope under the given string literal
+#define EV_CPU_ZONE(name) EvCpuZone EV_CPU_ZONE_CONCAT(cpuZone, __LINE__)(name)
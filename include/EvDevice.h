@@ -2,6 +2,7 @@
 
 #include "core.h"
 #include "EvWindow.h"
+#include "EvPipelineBuilder.h"
 
 class EvDevice;
 
@@ -12,6 +13,12 @@ struct EvDeviceInfo {
     uint32_t textureDescriptorSetCount = 0;
 };
 
+// Value of a timeline semaphore that a submission waits for or signals
+struct EvTimelinePoint {
+    VkSemaphore semaphore;
+    uint64_t value;
+};
+
 struct EvFrameBufferAttachment {
     VkImage image;
     VmaAllocation imageMemory;
@@ -30,6 +37,9 @@ struct EvFrameBuffer : NoCopy {
 };
 
 class EvDevice : NoCopy {
+public:
+    static constexpr const char* PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+
 private:
     bool isDeviceSuitable(VkPhysicalDevice physicalDevice) const;
     void finalizeInfo();
@@ -40,6 +50,8 @@ private:
     void createAllocator();
     void createCommandPool();
     void createDescriptorPool();
+    void createPipelineCache();
+    void savePipelineCache() const;
 
 public:
     EvDeviceInfo info;
@@ -56,10 +68,18 @@ public:
     VkDevice vkDevice;
     VmaAllocator vmaAllocator;
     VkCommandPool vkCommandPool;
+    // For the command buffers submitted to computeQueue
+    VkCommandPool vkComputeCommandPool;
     VkDescriptorPool vkDescriptorPool;
+    // Pass to every pipeline creation, persisted to PIPELINE_CACHE_FILE between runs
+    VkPipelineCache vkPipelineCache;
+    std::unique_ptr<EvPipelineBuilder> pipelineBuilder;
 
     VkQueue computeQueue;
     VkQueue graphicsQueue;
+    // Second queue of the graphics family for the post pass, so the next frame does not queue up
+    // behind it while it waits on async compute. The same as graphicsQueue when there is only one.
+    VkQueue postQueue;
     VkQueue presentQueue;
 
     EvDevice(EvDeviceInfo info, EvWindow &window);
@@ -73,11 +93,15 @@ public:
     void createAttachment(VkFormat format, VkImageUsageFlagBits usage, VkSampleCountFlagBits samples, uint32_t width, uint32_t height, EvFrameBufferAttachment* attachment);
     SwapchainSupportDetails getSwapchainSupportDetails() const;
     VkShaderModule createShaderModule(const char* filepath) const;
+    VkSemaphore createTimelineSemaphore() const;
+    // Resources moving between these families need an ownership transfer
+    inline bool hasSeparateComputeFamily() const { return queueFamilyIndices.compute.value() != queueFamilyIndices.graphics.value(); }
     void createHostBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer* buffer, VmaAllocation* bufferMemory);
     void createDeviceBuffer(VkDeviceSize size, void* data, VkBufferUsageFlags usage, VkBuffer* buffer, VmaAllocation* bufferMemory);
+    void createDeviceBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer* buffer, VmaAllocation* bufferMemory);
     VkCommandBuffer beginSingleTimeCommands();
     void endSingleTimeCommands(VkCommandBuffer commandBuffer);
-    void copyBuffer(VkBuffer dstBuffer, VkBuffer srcBuffer, VkDeviceSize size);
+    void copyBuffer(VkBuffer dstBuffer, VkBuffer srcBuffer, VkDeviceSize size, VkDeviceSize dstOffset = 0);
     void copyBufferToImage(VkImage dst, VkBuffer src, VkBufferImageCopy copyInfo);
     void transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels,
                                uint32_t arrayLayers);
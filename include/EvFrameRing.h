@@ -0,0 +1,64 @@
+#pragma once
+
+#include "core.h"
+#include "EvDevice.h"
+
+// One persistently mapped host buffer, split in a partition per frame in flight.
+// Everything that changes every frame is bump allocated from the partition of the
+// current frame and reaches the shaders through a single descriptor set with dynamic
+// offsets. A partition is reused as soon as the fence of its frame has been waited on.
+class EvFrameRing : NoCopy {
+public:
+    struct Binding {
+        VkDescriptorType type;
+        VkShaderStageFlags stageFlags;
+        // The size of the window a shader sees, every allocation for the binding has to fit in it.
+        VkDeviceSize range;
+    };
+
+private:
+    EvDevice& device;
+    std::vector<Binding> bindings;
+
+    VkBuffer buffer;
+    VmaAllocation bufferMemory;
+    uint8_t* mappedMemory;
+    VkDeviceSize alignment;
+    VkDeviceSize partitionSize;
+    uint32_t nrPartitions;
+
+    VkDeviceSize partitionStart = 0;
+    VkDeviceSize head = 0;
+    std::vector<uint32_t> dynamicOffsets;
+
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorSet descriptorSet;
+
+    void createBuffer();
+    void createDescriptorSetLayout();
+    void createDescriptorSet();
+
+    void* allocateBytes(uint32_t binding, VkDeviceSize size);
+
+public:
+    EvFrameRing(EvDevice& device, VkDeviceSize partitionSize, uint32_t nrPartitions, std::vector<Binding> bindings);
+    ~EvFrameRing();
+
+    inline VkDescriptorSetLayout getDescriptorSetLayout() const { return descriptorSetLayout; }
+    inline VkDeviceSize getBytesUsed() const { return head - partitionStart; }
+
+    // Starts writing into the partition of the given frame, everything allocated from it before is released.
+    void beginFrame(uint32_t frameIdx);
+    // Makes the writes of this frame visible to the device.
+    void flush();
+
+    // Reserves count elements for the given binding, the next bind of the set points the binding at them.
+    template<typename T>
+    T* allocate(uint32_t binding, uint32_t count = 1) {
+        assert(binding < bindings.size());
+        assert(count * sizeof(T) <= bindings[binding].range && "allocation does not fit in the binding range");
+        return static_cast<T*>(allocateBytes(binding, count * sizeof(T)));
+    }
+
+    void bind(VkCommandBuffer cmdBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set) const;
+};
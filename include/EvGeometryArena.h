@@ -0,0 +1,79 @@
+#pragma once
+
+#include "core.h"
+#include "EvDevice.h"
+#include "Primitives.h"
+#include "ShaderTypes.h"
+
+// First fit allocator over [0, capacity). Freed ranges are merged with their
+// neighbours so the free list stays as short as possible.
+class EvRangeAllocator {
+    uint32_t capacity;
+    // offset -> size
+    std::map<uint32_t, uint32_t> freeRanges;
+
+public:
+    explicit EvRangeAllocator(uint32_t capacity);
+
+    std::optional<uint32_t> allocate(uint32_t size);
+    void free(uint32_t offset, uint32_t size);
+};
+
+// One device local vertex buffer and one index buffer shared by every mesh. A mesh
+// only owns a range in both, so all geometry is drawn with a single binding.
+// Meshes whose vertices can be addressed with 16 bits take their indices from a second index
+// buffer of that type instead, which halves their index fetches. Draws are batched per type.
+// The meshlets of every mesh share a storage buffer the same way, for the meshlet culling.
+// The positions are a stream of their own at the same vertex offsets as the other attributes,
+// passes that only need the position fetch 8 bytes per vertex instead of the whole vertex.
+class EvGeometryArena : NoCopy {
+    EvDevice& device;
+    VkBuffer vertexBuffer;
+    VmaAllocation vertexMemory;
+    VkBuffer positionBuffer;
+    VmaAllocation positionMemory;
+    VkBuffer indexBuffer;
+    VmaAllocation indexMemory;
+    VkBuffer shortIndexBuffer;
+    VmaAllocation shortIndexMemory;
+    VkBuffer meshletBuffer;
+    VmaAllocation meshletMemory;
+    EvRangeAllocator vertexRanges;
+    EvRangeAllocator indexRanges;
+    EvRangeAllocator shortIndexRanges;
+    EvRangeAllocator meshletRanges;
+
+    void upload(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+
+public:
+    struct Range {
+        int32_t vertexOffset;
+        uint32_t vertexCount;
+        // In the index buffer of the index type
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        VkIndexType indexType;
+        uint32_t firstMeshlet;
+        uint32_t meshletCount;
+    };
+
+    EvGeometryArena(EvDevice& device, uint32_t maxVertices, uint32_t maxIndices, uint32_t maxMeshlets);
+    ~EvGeometryArena();
+
+    // 16 bit when every vertex of the mesh can be addressed with it
+    static VkIndexType getIndexType(uint32_t vertexCount);
+    // Indices stay relative to the first vertex, draws add the vertexOffset of the range. They come
+    // in the index type of the vertex count already. Every stream is copied once, into staging.
+    Range allocate(std::span<const PackedPosition> positions, std::span<const PackedVertex> vertices, std::span<const uint8_t> indices,
+                   std::span<const Meshlet> meshlets);
+    void free(const Range& range);
+
+    // Both streams, as the bindings of PackedVertex::getBindingDescriptions
+    void bind(VkCommandBuffer commandBuffer) const;
+    // Only the position stream, for pipelines with the position only vertex input
+    void bindPositions(VkCommandBuffer commandBuffer) const;
+    // The index buffer is bound apart from the vertices, draws switch it whenever the type changes
+    void bindIndices(VkCommandBuffer commandBuffer, VkIndexType indexType) const;
+    inline VkBuffer getMeshletBuffer() const { return meshletBuffer; }
+    void drawIndirect(VkCommandBuffer commandBuffer, VkBuffer indirectBuffer, uint32_t firstDraw, uint32_t drawCount) const;
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "core.h"
+#include "EvDevice.h"
+
+// Brackets sections of a frame with timestamp queries. Every frame in flight owns its
+// own range of the query pool, and a range is only read back once the fence of its
+// frame has been waited on, so fetching the results never stalls. Zones are tagged with
+// the queue they run on. Timestamps only compare within a queue, so every queue gets a
+// span of its own and the starts of its zones are relative to that span.
+class EvGpuProfiler : NoCopy {
+public:
+    static constexpr uint32_t MAX_ZONES = 32;
+    static constexpr uint32_t HISTORY_SIZE = 128;
+
+    enum class Queue { Graphics, Compute, Post };
+    static constexpr uint32_t QUEUE_COUNT = 3;
+
+    struct Zone {
+        std::string name;
+        Queue queue = Queue::Graphics;
+        // When it began in the last sample, relative to the first zone of its queue in the frame
+        float startMs = 0.0f;
+        // Ring of the last HISTORY_SIZE samples in milliseconds, head is the oldest
+        std::array<float, HISTORY_SIZE> history{};
+        uint32_t head = 0;
+        uint32_t samples = 0;
+        float averageMs = 0.0f;
+        float lastMs = 0.0f;
+
+        void push(float ms);
+    };
+
+private:
+    EvDevice& device;
+    uint32_t nrFrames;
+    bool supported;
+    // nanoseconds per tick
+    float timestampPeriod;
+    uint64_t timestampMask;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+
+    struct RecordedZone {
+        uint32_t zone;
+        // Where it ran in this frame, the pyramid zones change queues with async compute
+        Queue queue;
+    };
+
+    std::vector<Zone> zones;
+    // Zone of every begin/end query pair written by each frame in flight, in recording order
+    std::vector<std::vector<RecordedZone>> frameZones;
+    uint32_t currentFrame = 0;
+    bool zoneOpen = false;
+    // Per queue, from its first begin to its last end within the frame. Zero when the queue had no zones.
+    std::array<Zone, QUEUE_COUNT> queueZones;
+
+    void createQueryPool();
+    uint32_t findZone(const char* name, Queue queue);
+    void readResults(uint32_t frameIdx);
+
+public:
+    EvGpuProfiler(EvDevice& device, uint32_t nrFrames);
+    ~EvGpuProfiler();
+
+    inline bool isSupported() const { return supported; }
+    inline const std::vector<Zone>& getZones() const { return zones; }
+    inline const Zone& getQueueZone(Queue queue) const { return queueZones[static_cast<uint32_t>(queue)]; }
+    // The queues cannot be compared, the busiest one bounds the frame
+    float getBusiestQueueMs() const;
+
+    // Collects the results of the previous use of this frame and resets its queries.
+    // Has to be recorded before any zone, outside of a render pass.
+    void beginFrame(VkCommandBuffer cmdBuffer, uint32_t frameIdx);
+    void beginZone(VkCommandBuffer cmdBuffer, const char* name, Queue queue = Queue::Graphics);
+    void endZone(VkCommandBuffer cmdBuffer);
+};
@@ -2,7 +2,9 @@
 
 #include "core.h"
 #include "EvDevice.h"
+#include "EvGeometryArena.h"
 #include "Primitives.h"
+#include "ShaderTypes.h"
 
 namespace std {
     template<>
@@ -16,25 +18,56 @@ namespace std {
     };
 }
 
+// A processed mesh in the layout the arena takes. Loaded from the cache the streams point into
+// the mapping of the cache file, which stays mapped until this is destroyed. Imported they point
+// into the vectors below.
+struct EvMeshData : NoCopy {
+    BoundingBox box;
+    // index ranges relative to the start of the mesh
+    std::vector<MeshLod> lods;
+    std::span<const PackedPosition> positions;
+    std::span<const PackedVertex> vertices;
+    // In the index type of the vertex count
+    std::span<const uint8_t> indices;
+    std::span<const Meshlet> meshlets;
+
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+    std::vector<PackedPosition> ownedPositions;
+    std::vector<PackedVertex> ownedVertices;
+    std::vector<uint8_t> ownedIndices;
+    std::vector<Meshlet> ownedMeshlets;
+
+    EvMeshData() = default;
+    ~EvMeshData();
+};
+
 class EvMesh : NoCopy {
 private:
-    EvDevice& device;
-    VkBuffer vkVertexBuffer;
-    VmaAllocation vkVertexMemory;
-    uint32_t vertexCount;
-    VkBuffer vkIndexBuffer;
-    VmaAllocation vkIndexMemory;
-    uint32_t indicesCount;
-
-    void createVertexBuffer(const std::vector<Vertex>& vertices);
-    void createIndexBuffer(const std::vector<uint32_t>& indices);
+    EvGeometryArena& arena;
+    EvGeometryArena::Range range;
+    // index ranges relative to the start of the mesh in the arena
+    std::vector<MeshLod> lods;
 
 public:
+    // Used to sort draws, unique per render system
+    uint32_t id = 0;
     BoundingBox boundingBox;
-    static void loadMesh(const std::string &filename, std::vector<Vertex> *vertices, std::vector<uint32_t> *indices, BoundingBox *box, std::string* diffuseTextureFile = nullptr, std::string* normalTextureFile = nullptr);
-    EvMesh(EvDevice &device, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, BoundingBox bb);
+    // Processed imports are kept here, keyed by the path of their source
+    static constexpr const char* MESH_CACHE_DIR = "mesh_cache";
+    // Reads the processed mesh from the cache when it is still up to date with the file, imports and caches it otherwise
+    static void loadMesh(const std::string &filename, EvMeshData* data, std::string* diffuseTextureFile = nullptr, std::string* normalTextureFile = nullptr);
+    EvMesh(EvGeometryArena &arena, const EvMeshData& data);
     ~EvMesh();
 
-    void bind(VkCommandBuffer commandBuffer);
+    inline uint32_t getFirstIndex() const { return range.firstIndex; }
+    inline int32_t getVertexOffset() const { return range.vertexOffset; }
+    inline VkIndexType getIndexType() const { return range.indexType; }
+    inline uint32_t getFirstMeshlet() const { return range.firstMeshlet; }
+    inline uint32_t getLodCount() const { return static_cast<uint32_t>(lods.size()); }
+    inline const MeshLod& getLod(uint32_t lod) const { return lods[lod]; }
+
+    void bind(VkCommandBuffer commandBuffer) const;
     void draw(VkCommandBuffer commandBuffer, uint32_t instanceCount = 1) const;
+    void drawLod(VkCommandBuffer commandBuffer, uint32_t lod, uint32_t instanceCount = 1, uint32_t firstInstance = 0) const;
 };
\ No newline at end of file
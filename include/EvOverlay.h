@@ -3,6 +3,8 @@
 #include "core.h"
 #include "EvDevice.h"
 #include "EvSwapchain.h"
+#include "EvGpuProfiler.h"
+#include "EvCpuProfiler.h"
 
 struct UIInfo {
     float fps = 0;
@@ -12,13 +14,45 @@ struct UIInfo {
 
     float linear = 1.0f;
     float quadratic = 1.0f;
+    // Radiance at which a light stops affecting a cluster
+    float lightCutoff = 0.05f;
+    uint32_t lightBytesUploaded = 0;
 
     bool bloomEnabled = true;
+    // BloomPass::Mode
+    int bloomMode = 0;
+    // Runs the pyramid on the compute queue, the gaussian modes always stay on the graphics queue
+    bool asyncCompute = true;
+
+    bool occlusionCulling = true;
+    uint32_t drawnInstances = 0;
+    uint32_t totalInstances = 0;
+    // Culls the meshlets of the visible instances against the frustum and by their normal cones
+    bool meshletCulling = true;
+    uint32_t drawnMeshlets = 0;
+    uint32_t totalMeshlets = 0;
+    // descriptor set and vertex/index buffer binds recorded last frame
+    uint32_t depthPassBinds = 0;
+    uint32_t forwardPassBinds = 0;
+
+    bool lodEnabled = true;
+    // Largest simplification error allowed on screen, in pixels
+    float lodPixelError = 1.0f;
+
+    // Scales the resolution to keep the GPU frame time at the target, otherwise renderScale is used as is
+    static constexpr float MIN_RENDER_SCALE = 0.5f;
+    bool dynamicResolution = false;
+    float targetGpuMs = 8.0f;
+    float renderScale = 1.0f;
+
+    // Depth, forward and composition as the subpasses of one render pass, only while bloom is off
+    bool mergedPasses = false;
 };
 
 class EvOverlay {
 private:
     EvDevice& device;
+    const EvGpuProfiler& gpuProfiler;
     VkDescriptorPool imguiPool;
     UIInfo uiInfo;
 
@@ -26,7 +60,7 @@ private:
     void initImGui(VkRenderPass renderPass, uint32_t nrImages);
 
 public:
-    EvOverlay(EvDevice &device, VkRenderPass renderPass, uint32_t nrImages);
+    EvOverlay(EvDevice &device, VkRenderPass renderPass, uint32_t nrImages, const EvGpuProfiler& gpuProfiler);
     ~EvOverlay();
 
     void NewFrame();
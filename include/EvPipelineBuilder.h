@@ -0,0 +1,31 @@
+#pragma once
+
+#include "core.h"
+
+// A pipeline that may still be compiling, get() blocks until it is done and rethrows
+// whatever the build threw.
+using EvPipelineHandle = std::shared_future<VkPipeline>;
+
+// Compiles pipelines on a pool of worker threads. Passes submit their pipelines from their
+// constructors and only wait on them when they first bind, so all pipelines of the renderer
+// compile at the same time while the main thread keeps creating resources.
+class EvPipelineBuilder : NoCopy {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::deque<std::packaged_task<VkPipeline()>> jobs;
+    bool stopping = false;
+
+    void workerLoop();
+
+public:
+    // Zero picks one worker per hardware thread
+    explicit EvPipelineBuilder(uint32_t nrWorkers = 0);
+    // Finishes the jobs still queued before joining
+    ~EvPipelineBuilder();
+
+    // The job runs on a worker, everything it touches must stay alive until the handle is ready.
+    // Vulkan allows creating pipelines and shader modules on several threads at once, the
+    // device pipeline cache synchronizes itself.
+    EvPipelineHandle submit(std::function<VkPipeline()> job);
+};
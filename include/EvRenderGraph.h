@@ -0,0 +1,134 @@
+#pragma once
+
+#include "core.h"
+#include "EvDevice.h"
+
+// The passes of a frame declared with the images they read and write. Compiling it derives
+// everything in between: the passes nothing consumes are culled, the barriers before and after
+// each pass are worked out from the usages, and images whose lifetimes do not overlap share memory.
+// The images only live within a frame, every frame starts by discarding their contents.
+class EvRenderGraph : NoCopy {
+public:
+    using ResourceId = uint32_t;
+    using SubmissionId = uint32_t;
+
+    enum class Usage {
+        ColorAttachment,
+        DepthAttachment,
+        // Depth tested without being written, in the read only depth layout
+        DepthTest,
+        // Sampled by the shaders of the pass, depth images stay in the read only depth layout
+        Sampled,
+        // Read and written by the shaders of the pass in general, also through samplers
+        Storage,
+        TransferSrc,
+        TransferDst,
+    };
+
+    struct ImageDesc {
+        const char* name;
+        VkFormat format;
+        // Of the extent the graph is compiled for
+        uint32_t sizeDivisor = 1;
+        // On top of what the declared uses need, for the usages a pass goes through on its own
+        VkImageUsageFlags usage = 0;
+        // Never leaves the tile memory of the render pass that uses it, which also takes it from undefined.
+        // Backed by lazily allocated memory where the device has it, and never shares an allocation.
+        bool transient = false;
+    };
+
+    struct Use {
+        ResourceId resource;
+        Usage usage;
+        // A pass that transitions the image itself leaves it in this usage
+        Usage finalUsage;
+        bool write;
+    };
+
+    struct Pass {
+        const char* name;
+        SubmissionId submission;
+        // Where the shaders of the pass access the Sampled and Storage images
+        VkPipelineStageFlags shaderStages;
+        std::function<void(VkCommandBuffer)> record;
+        // Passes that write outside of the graph, into the swapchain for one, are never culled
+        bool sideEffects = false;
+        std::vector<Use> uses;
+
+        Pass& read(ResourceId resource, Usage usage);
+        Pass& write(ResourceId resource, Usage usage, std::optional<Usage> finalUsage = std::nullopt);
+    };
+
+private:
+    struct Submission {
+        VkQueue queue;
+        uint32_t queueFamily;
+    };
+
+    struct Resource {
+        const char* name;
+        uint32_t image;
+    };
+
+    struct Image {
+        ImageDesc desc;
+        EvFrameBufferAttachment attachment;
+        // Index into the allocations, images with disjoint lifetimes share one
+        uint32_t allocation;
+    };
+
+    struct Barriers {
+        std::vector<VkImageMemoryBarrier> images;
+        VkPipelineStageFlags srcStages = 0;
+        VkPipelineStageFlags dstStages = 0;
+
+        void add(const VkImageMemoryBarrier& barrier, VkPipelineStageFlags src, VkPipelineStageFlags dst);
+        void record(VkCommandBuffer commandBuffer) const;
+    };
+
+    struct CompiledPass {
+        uint32_t pass;
+        Barriers before;
+        // Releases to another queue family, after the last use on this queue
+        Barriers after;
+    };
+
+    EvDevice& device;
+    std::vector<Submission> submissions;
+    std::vector<Resource> resources;
+    std::vector<Image> images;
+    // Stable references, passes are filled in after they are added
+    std::deque<Pass> passes;
+
+    // Live passes in execution order
+    std::vector<CompiledPass> compiledPasses;
+    std::vector<VmaAllocation> allocations;
+
+    std::vector<bool> cullPasses() const;
+    void createImages(const std::vector<bool>& live, VkExtent2D extent);
+    void deriveBarriers();
+    void destroyImages();
+
+public:
+    explicit EvRenderGraph(EvDevice& device);
+    ~EvRenderGraph();
+
+    // Drops all declarations and the images of the last compile, the device has to be idle
+    void reset();
+    // Submissions on different queues have to be ordered with semaphores by the caller, in the order they were added.
+    SubmissionId addSubmission(VkQueue queue, uint32_t queueFamily);
+    ResourceId createImage(const ImageDesc& desc);
+    // A new name for the contents of an existing image once a pass wrote them, so that the passes
+    // reading the new contents can be told apart from the ones reading the old.
+    ResourceId createVersion(ResourceId resource, const char* name);
+    // Passes run in the order they are added, the submissions they name may not go back.
+    Pass& addPass(const char* name, SubmissionId submission, VkPipelineStageFlags shaderStages, std::function<void(VkCommandBuffer)> record);
+    void compile(VkExtent2D extent);
+
+    // Only valid for the images of live passes, until the next reset
+    const EvFrameBufferAttachment& getImage(ResourceId resource) const;
+    bool isLive(ResourceId resource) const;
+    bool hasPasses(SubmissionId submission) const;
+    // The live passes of the submission with their barriers, in the order they were added
+    void record(SubmissionId submission, VkCommandBuffer commandBuffer) const;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "core.h"
+#include "EvDevice.h"
+
+// Mirrors a host array into a storage buffer, with one copy of the buffer per frame in
+// flight. Elements are only uploaded when they changed since the copy of the current
+// frame was last written, and the buffer grows when the array outgrows it.
+class EvStorageMirror : NoCopy {
+    EvDevice& device;
+    VkDeviceSize elementSize;
+    uint32_t capacity;
+    uint32_t nrCopies;
+    VkShaderStageFlags stageFlags;
+
+    VkBuffer buffer;
+    VmaAllocation bufferMemory;
+    uint8_t* mappedMemory;
+    VkDeviceSize copyStride;
+    uint32_t dynamicOffset = 0;
+
+    // Per copy, indices written since the copy was last synced
+    std::vector<std::vector<uint32_t>> dirtyIndices;
+    std::vector<bool> allDirty;
+
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorSet descriptorSet;
+
+    void createBuffer();
+    void destroyBuffer();
+    void createDescriptorSetLayout();
+    void createDescriptorSet();
+    void writeDescriptorSet();
+    void grow(uint32_t minCapacity);
+
+public:
+    EvStorageMirror(EvDevice& device, VkDeviceSize elementSize, uint32_t initialCapacity, uint32_t nrCopies, VkShaderStageFlags stageFlags);
+    ~EvStorageMirror();
+
+    inline VkDescriptorSetLayout getDescriptorSetLayout() const { return descriptorSetLayout; }
+    inline uint32_t getCapacity() const { return capacity; }
+
+    void markDirty(uint32_t index);
+    void markDirty(uint32_t first, uint32_t count);
+    void markAllDirty();
+
+    // Brings the copy of the given frame up to date with the first count elements of data,
+    // returns the number of bytes written. Growing waits for the device to go idle.
+    VkDeviceSize sync(uint32_t copyIdx, const void* data, uint32_t count);
+
+    // Binds the copy that was synced last.
+    void bind(VkCommandBuffer cmdBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set) const;
+};
@@ -1,20 +1,25 @@
 #pragma once
 
 #include "EvDevice.h"
+#include "EvCpuProfiler.h"
 
 class EvSwapchain {
 private:
     EvDevice& device;
-    const int MAX_FRAMES_IN_FLIGHT = 3;
+    // Number of frames the CPU may record ahead of the GPU, independent of the number of images
+    uint32_t framesInFlight;
     uint currentFrame = 0;
     std::vector<VkSemaphore> imageAvailableSemaphores;
     std::vector<VkSemaphore> renderFinishedSemaphores;
     std::vector<VkFence> inFlightFences;
     std::vector<VkFence> imagesInFlight;
     std::shared_ptr<EvSwapchain> oldSwapchain;
+    // Only used in headless mode, where the images are ours instead of the presentation engine's
+    std::vector<VmaAllocation> offscreenMemory;
 
     void init();
     void createSwapchain();
+    void createOffscreenImages();
     void createImageViews();
     void createSyncObjects();
 
@@ -28,11 +33,20 @@ public:
     std::vector<VkImageView> vkImageViews;
     VkSurfaceFormatKHR surfaceFormat;
     VkExtent2D extent;
+    // Layout the final pass leaves the images in
+    VkImageLayout presentLayout;
 
-    EvSwapchain(EvDevice& device);
+    EvSwapchain(EvDevice& device, uint32_t framesInFlight);
+    // Keeps the number of frames in flight of the previous swapchain
     EvSwapchain(EvDevice& device, std::shared_ptr<EvSwapchain> previous);
     ~EvSwapchain();
 
+    inline uint32_t getFramesInFlight() const { return framesInFlight; }
+    // Only valid between acquiring and presenting an image
+    inline uint32_t getCurrentFrame() const { return currentFrame; }
+
     VkResult acquireNextSwapchainImage(uint32_t* imageIndex);
-    VkResult presentCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    // Submits the last command buffer of the frame to the post queue once the inputs it samples are
+    // ready at wait, signals the fence of the frame and the timeline at signal, then presents.
+    VkResult presentCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, EvTimelinePoint wait, EvTimelinePoint signal);
 };
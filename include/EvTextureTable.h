@@ -0,0 +1,36 @@
+#pragma once
+
+#include "core.h"
+#include "EvDevice.h"
+#include "EvTexture.h"
+
+// One big array of sampled textures that every material indexes into. A texture is
+// written into the array once when it is registered, after that it is reachable by
+// its index from any draw without binding anything else.
+class EvTextureTable : NoCopy {
+    EvDevice& device;
+    uint32_t maxTextures;
+
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorSet descriptorSet;
+
+    std::unordered_map<const EvTexture*, uint32_t> indices;
+
+    void createDescriptorPool();
+    void createDescriptorSetLayout();
+    void createDescriptorSet();
+
+public:
+    EvTextureTable(EvDevice& device, uint32_t maxTextures);
+    ~EvTextureTable();
+
+    inline VkDescriptorSetLayout getDescriptorSetLayout() const { return descriptorSetLayout; }
+    inline uint32_t getTextureCount() const { return static_cast<uint32_t>(indices.size()); }
+
+    // Returns the slot of the texture in the array, registering the same texture twice yields the same slot.
+    // The texture has to outlive the table.
+    uint32_t registerTexture(const EvTexture& texture);
+
+    void bind(VkCommandBuffer cmdBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set) const;
+};
@@ -11,8 +11,10 @@ public:
     std::string name;
     GLFWwindow* glfwWindow;
     bool wasResized = false;
+    // No GLFW and no surface, the device renders into offscreen images of this size instead
+    bool headless;
 
-    EvWindow(int w, int h, std::string name);
+    EvWindow(int w, int h, std::string name, bool headless = false);
     ~EvWindow();
 
     void createWindowSurface(VkInstance instance, VkSurfaceKHR* surface) const;
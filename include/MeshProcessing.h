@@ -0,0 +1,40 @@
+#pragma once
+
+#include "core.h"
+#include "Primitives.h"
+#include "ShaderTypes.h"
+
+// Import time processing of triangle meshes. Everything in here works on
+// plain vertex and index arrays and runs before anything is uploaded.
+
+// Simplifies the triangles in indices[0, lods[0].indexCount) with quadric error
+// edge collapses and appends every level of detail to the same index buffer.
+// Collapses only ever move a vertex onto one of its neighbours, so all levels
+// share the original vertex buffer. Vertices on borders and attribute seams are
+// never moved. lods[0] has to describe the full resolution mesh on entry.
+void generateLods(const std::vector<Vertex>& vertices, std::vector<uint32_t>* indices, std::vector<MeshLod>* lods, uint32_t maxLods = 5);
+
+// Packs the vertices into the layouts of the geometry arena, positions as fractions of bounds.
+// The shaders decode positions with the same bounds, so they have to be the ones of the mesh.
+void packVertices(const std::vector<Vertex>& vertices, const BoundingBox& bounds,
+                  std::vector<PackedPosition>* positions, std::vector<PackedVertex>* packed);
+
+// Size of the post transform cache the optimizations below and the reported ACMR assume
+constexpr uint32_t VERTEX_CACHE_SIZE = 16;
+
+// Reorders the triangles of every level for post transform cache reuse with Tipsify
+// (Sander, Nehab and Barczak 2007). Only the order within a level changes.
+void optimizeVertexCache(std::vector<uint32_t>* indices, const std::vector<MeshLod>& lods, uint32_t vertexCount);
+
+// Renumbers the vertices in the order the triangles first use them, so vertex fetches walk
+// the buffer front to back. Vertices no level uses are dropped.
+void optimizeVertexFetch(std::vector<Vertex>* vertices, std::vector<uint32_t>* indices);
+
+// Average cache miss ratio: vertices transformed per triangle with a FIFO cache of cacheSize
+float computeAcmr(const uint32_t* indices, uint32_t indexCount, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Splits every level into meshlets of consecutive triangles, in the order the cache optimization left
+// them, and fills in the meshlet range of each level. A meshlet is closed once the next triangle would
+// take it over MESHLET_MAX_VERTICES or MESHLET_MAX_TRIANGLES.
+void buildMeshlets(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+                   std::vector<MeshLod>* lods, std::vector<Meshlet>* meshlets);
@@ -11,6 +11,8 @@ class PhysicsSystem : public System
 {
     rp3::PhysicsCommon physicsCommon;
     rp3::PhysicsWorld* world;
+    // Entities whose position listeners saw a new position in the last update
+    std::vector<Entity> movedEntities;
 public:
     PhysicsSystem();
     ~PhysicsSystem();
@@ -25,6 +27,7 @@ public:
     void linkModelComponent(Entity entity);
     void addIntersectionBoxBody(Entity entity, BoundingBox box);
     void addPositionListener(Entity, glm::vec3* dst);
+    inline const std::vector<Entity>& getMovedEntities() const { return movedEntities; }
     void setMass(Entity entity, float mass);
     void applyForce(Entity entity, glm::vec3 force);
     void setAngularVelocity(Entity entity, glm::vec3 eulerAngles);
@@ -16,6 +16,8 @@ struct BoundingBox {
         };
     }
 
+    inline glm::vec3 getCenter() const { return 0.5f * (vmin + vmax); }
+
     BoundingBox operator* (const glm::vec3& s) const {
         return BoundingBox {
             .vmin = vmin * s,
@@ -24,6 +26,16 @@ struct BoundingBox {
     }
 };
 
+struct MeshLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    // Object space distance the simplified surface may be off from the original
+    float error;
+    // Relative to the first meshlet of the mesh
+    uint32_t firstMeshlet = 0;
+    uint32_t meshletCount = 0;
+};
+
 struct Vertex {
     glm::vec3 position;
     glm::vec2 uv;
@@ -33,15 +45,38 @@ struct Vertex {
     bool operator ==(const Vertex& o) const {
         return position == o.position && uv == o.uv && normal == o.normal;
     }
+};
+
+// What the geometry arena stores, Vertex is only the import format. The positions are 16 bit
+// fractions of the bounding box of their mesh in a stream of their own, the other attributes are
+// packed next to them: half precision uvs and octahedral normals and tangents. vertex.glsl decodes them
+// with the bounds of the instance. 20 bytes per vertex where Vertex has 44.
+struct PackedPosition {
+    // unorm, w is padding
+    glm::u16vec4 position;
+};
+
+struct PackedVertex {
+    // half2
+    uint32_t uv;
+    // octahedral snorm2x16
+    uint32_t normal;
+    uint32_t tangent;
 
+    // Binding 0 holds the positions, binding 1 the rest
     static std::vector<VkVertexInputBindingDescription> getBindingDescriptions() {
-        std::vector<VkVertexInputBindingDescription> bindingDescriptions(1);
-        bindingDescriptions[0] = VkVertexInputBindingDescription {
-                .binding = 0,
-                .stride = sizeof(Vertex),
-                .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+        return {
+            VkVertexInputBindingDescription {
+                    .binding = 0,
+                    .stride = sizeof(PackedPosition),
+                    .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+            },
+            VkVertexInputBindingDescription {
+                    .binding = 1,
+                    .stride = sizeof(PackedVertex),
+                    .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+            },
         };
-        return bindingDescriptions;
     }
 
     static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions() {
@@ -49,27 +84,36 @@ struct Vertex {
             VkVertexInputAttributeDescription {
                     .location = 0,
                     .binding = 0,
-                    .format = VK_FORMAT_R32G32B32_SFLOAT,
-                    .offset = offsetof(Vertex, position),
+                    .format = VK_FORMAT_R16G16B16A16_UNORM,
+                    .offset = offsetof(PackedPosition, position),
             },
             VkVertexInputAttributeDescription {
                     .location = 1,
-                    .binding = 0,
-                    .format = VK_FORMAT_R32G32_SFLOAT,
-                    .offset = offsetof(Vertex, uv),
+                    .binding = 1,
+                    .format = VK_FORMAT_R16G16_SFLOAT,
+                    .offset = offsetof(PackedVertex, uv),
             },
             VkVertexInputAttributeDescription {
                     .location = 2,
-                    .binding = 0,
-                    .format = VK_FORMAT_R32G32B32_SFLOAT,
-                    .offset = offsetof(Vertex, normal),
+                    .binding = 1,
+                    .format = VK_FORMAT_R16G16_SNORM,
+                    .offset = offsetof(PackedVertex, normal),
             },
             VkVertexInputAttributeDescription {
                     .location = 3,
-                    .binding = 0,
-                    .format = VK_FORMAT_R32G32B32_SFLOAT,
-                    .offset = offsetof(Vertex, tangent),
+                    .binding = 1,
+                    .format = VK_FORMAT_R16G16_SNORM,
+                    .offset = offsetof(PackedVertex, tangent),
             },
         };
     }
-};
\ No newline at end of file
+
+    // Only the positions, for the passes that bind nothing but the position stream
+    static std::vector<VkVertexInputBindingDescription> getPositionBindingDescriptions() {
+        return { getBindingDescriptions()[0] };
+    }
+
+    static std::vector<VkVertexInputAttributeDescription> getPositionAttributeDescriptions() {
+        return { getAttributeDescriptions()[0] };
+    }
+};
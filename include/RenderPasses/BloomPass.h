@@ -2,50 +2,118 @@
 
 #include "../core.h"
 #include "../EvDevice.h"
+#include "../EvGpuProfiler.h"
 
 class BloomPass {
+public:
+    enum class Mode {
+        // Downsamples to 1/64 and adds the levels back up, wide at little bandwidth
+        Pyramid = 0,
+        // Separable 31 tap gaussian at half resolution
+        Gaussian = 1,
+        // The same gaussian with the line and its apron loaded into shared memory once
+        GaussianTiled = 2,
+        // The same gaussian with neighbouring taps merged into bilinear fetches
+        GaussianLinear = 3,
+    };
+
+    // From 1/2 down to 1/64 of the input
+    static constexpr uint32_t PYRAMID_LEVELS = 6;
+    // Taps on either side of the center of the gaussian, and the bilinear fetches they merge into
+    static constexpr uint32_t BLUR_RADIUS = 15;
+    static constexpr uint32_t BLUR_MERGED_TAPS = (BLUR_RADIUS + 1) / 2;
+
+    using GaussianImages = std::array<EvFrameBufferAttachment, 2>;
+
+private:
     EvDevice& device;
-    std::vector<EvFrameBufferAttachment> bloomAttachments;
+    EvFrameBufferAttachment bloomAttachment;
 
+    // ping pong pair of the gaussian at half resolution, [0] is the blit target, [1] only lives in general.
+    // Owned by the render graph, which only has them when one of the gaussians runs.
     struct Buffer {
         int32_t width, height;
-        std::vector<VkImage> tmpImages;
-        std::vector<VmaAllocation> tmpImageMemory;
-        std::vector<VkImageView> tmpImageViews;
+        std::optional<GaussianImages> tmpImages;
+    } framebuffer;
+
+    // Lives in general, every level is both written and sampled by compute
+    struct Pyramid {
+        uint32_t width, height, levels;
+        VkImage image;
+        VmaAllocation imageMemory;
+        std::array<VkImageView, PYRAMID_LEVELS> mipViews;
 
         void destroy(EvDevice& device) {
-            for(int i=0; i<tmpImages.size(); i++) {
-                vmaDestroyImage(device.vmaAllocator, tmpImages[i], tmpImageMemory[i]);
-                vkDestroyImageView(device.vkDevice, tmpImageViews[i], nullptr);
-            }
+            for(uint32_t level=0; level<levels; level++) vkDestroyImageView(device.vkDevice, mipViews[level], nullptr);
+            vmaDestroyImage(device.vmaAllocator, image, imageMemory);
         }
-    } framebuffer;
+    } pyramid;
 
     struct Push {
         glm::ivec4 d;
     };
 
+    struct PyramidPush {
+        glm::ivec4 sizes; // outputWidth, outputHeight, inputWidth, inputHeight
+        glm::vec2 weights; // of the output contents and of the filtered input
+    };
+
     VkShaderModule compShader;
 
     VkPipelineLayout pipelineLayout;
-    VkPipeline pipeline;
+    EvPipelineHandle pipeline;
     VkDescriptorSetLayout descriptorSetLayout;
-    std::vector<VkDescriptorSet> horzDescriptorSets;
-    std::vector<VkDescriptorSet> vertDescriptorSets;
+    VkDescriptorSet horzDescriptorSet;
+    VkDescriptorSet vertDescriptorSet;
+
+    // Share the layouts of the gaussian above
+    VkShaderModule tiledShader;
+    EvPipelineHandle tiledPipeline;
+    // Share the layouts of the pyramid below, the input is sampled
+    VkShaderModule linearShader;
+    EvPipelineHandle linearPipeline;
+    VkDescriptorSet linearHorzDescriptorSet;
+    VkDescriptorSet linearVertDescriptorSet;
 
-    void createFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages, const std::vector<EvFrameBufferAttachment>& inputs);
+    VkShaderModule downShader;
+    VkShaderModule upShader;
+    // Bilinear and clamped, used by the pyramid and the merged gaussian
+    VkSampler linearSampler;
+    VkDescriptorSetLayout pyramidSetLayout;
+    VkPipelineLayout pyramidPipelineLayout;
+    EvPipelineHandle downPipeline;
+    EvPipelineHandle upPipeline;
+    // [i] reads level i - 1, or the input for the first, and writes level i
+    std::array<VkDescriptorSet, PYRAMID_LEVELS> downDescriptorSets;
+    // [i] reads level i + 1 and adds it to level i
+    std::array<VkDescriptorSet, PYRAMID_LEVELS - 1> upDescriptorSets;
+    // reads level 0 and writes the input
+    VkDescriptorSet finalDescriptorSet;
+
+    void createFramebuffer(uint32_t width, uint32_t height, std::optional<GaussianImages> tmpImages);
+    void createPyramid(uint32_t width, uint32_t height);
     void createDescriptorSetLayout();
     void createPipelineLayout();
     void createPipeline();
-    void allocateDescriptorSets(uint32_t nrImages);
-    void createDescriptorSets(uint32_t nrImages, const std::vector<EvFrameBufferAttachment> &inputs);
+    void createLinearSampler();
+    void createBlurVariantPipelines();
+    void createPyramidPipelines();
+    void allocateDescriptorSets();
+    void createDescriptorSets();
+    void createPyramidDescriptorSets();
+
+    void runGaussian(VkCommandBuffer cmdBuffer, VkExtent2D renderExtent, Mode mode, EvGpuProfiler& profiler) const;
+    void runPyramid(VkCommandBuffer cmdBuffer, VkExtent2D renderExtent, EvGpuProfiler& profiler, EvGpuProfiler::Queue queue) const;
 
 public:
-    BloomPass(EvDevice& device, uint32_t width, uint32_t height, uint32_t nrImages, const std::vector<EvFrameBufferAttachment>& inputs);
+    BloomPass(EvDevice& device, uint32_t width, uint32_t height, const EvFrameBufferAttachment& input, std::optional<GaussianImages> tmpImages);
     ~BloomPass();
 
-    inline Buffer& getFramebuffer() { return framebuffer; }
-
-    void recreateFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages, const std::vector<EvFrameBufferAttachment>& inputs);
-    void run(VkCommandBuffer cmdBuffer, uint32_t imageIdx) const;
-};
\ No newline at end of file
+    void recreateFramebuffer(uint32_t width, uint32_t height, const EvFrameBufferAttachment& input, std::optional<GaussianImages> tmpImages);
+    // Replaces the input with its blur. Opens its own profiler zones, one per pyramid level or per gaussian step.
+    // The render graph transitions the images around it: the pyramid takes and leaves the input in general,
+    // the gaussians take it as a blit source and leave it as a blit destination. Only the pyramid can run
+    // on the compute queue, the gaussians blit.
+    void run(VkCommandBuffer cmdBuffer, VkExtent2D renderExtent, Mode mode, EvGpuProfiler& profiler,
+             EvGpuProfiler::Queue queue = EvGpuProfiler::Queue::Graphics) const;
+};
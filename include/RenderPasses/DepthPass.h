@@ -9,31 +9,36 @@ class DepthPass : NoCopy
 {
     EvDevice& device;
 
+    // The depth attachment itself belongs to the render graph
     struct Buffer : public EvFrameBuffer {
-        std::vector<EvFrameBufferAttachment> depths;
-
-        virtual void destroy(EvDevice& device) override {
-            for(auto& depth : depths) depth.destroy(device);
-            EvFrameBuffer::destroy(device);
-        }
     } framebuffer;
 
     VkShaderModule vertShader;
-    VkPipeline pipeline;
+    EvPipelineHandle pipeline;
+    // The same state for the depth subpass of the merged pass
+    EvPipelineHandle mergedPipeline;
     VkPipelineLayout pipelineLayout;
 
-    void createFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages);
-    void createPipelineLayout();
+    void createFramebuffer(uint32_t width, uint32_t height, const EvFrameBufferAttachment& depthAttachment);
+    void createPipelineLayout(VkDescriptorSetLayout frameSetLayout);
     void createPipeline();
+    VkPipeline buildPipeline(VkRenderPass renderPass, uint32_t subpass) const;
 
 public:
-    DepthPass(EvDevice& device, uint32_t width, uint32_t height, uint32_t nrImages);
+    DepthPass(EvDevice& device, uint32_t width, uint32_t height, const EvFrameBufferAttachment& depthAttachment, VkDescriptorSetLayout frameSetLayout);
     ~DepthPass();
 
-    inline Buffer& getFramebuffer() { return framebuffer; }
     inline VkPipelineLayout getPipelineLayout() const { return pipelineLayout; }
+    inline void bindMergedPipeline(VkCommandBuffer cmdBuffer) const {
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mergedPipeline.get());
+    }
+
+    // The render pass has to outlive the build, the pipeline stays usable with every compatible one
+    void createMergedPipeline(VkRenderPass renderPass, uint32_t subpass);
 
-    void recreateFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages);
-    void startPass(VkCommandBuffer cmdBuffer, uint32_t imageIdx) const;
+    void recreateFramebuffer(uint32_t width, uint32_t height, const EvFrameBufferAttachment& depthAttachment);
+    // Draws into the top left renderExtent of the attachments. The clear still covers all of
+    // them, so the depth outside of it reads as the far plane and never occludes in the pyramid.
+    void startPass(VkCommandBuffer cmdBuffer, VkExtent2D renderExtent) const;
     void endPass(VkCommandBuffer cmdBuffer) const;
 };
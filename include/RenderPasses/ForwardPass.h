@@ -6,96 +6,84 @@
 #include "../ShaderTypes.h"
 #include "../Primitives.h"
 #include "../Components.h"
-#include "../UBOBuffer.h"
 
 class ForwardPass : NoCopy
 {
     EvDevice& device;
 
+    // The attachments themselves belong to the render graph
     struct Buffer : public EvFrameBuffer {
-        std::vector<EvFrameBufferAttachment> colors;
-        std::vector<EvFrameBufferAttachment> blooms;
-
-        virtual void destroy(EvDevice& device) override {
-            for(auto& color : colors) color.destroy(device);
-            for(auto& bloom : blooms) bloom.destroy(device);
-            EvFrameBuffer::destroy(device);
-        }
     } framebuffer;
 
-    static const uint MAX_LIGHTS = 2000;
-    struct LightBuffer {
-        LightComponent lightData[MAX_LIGHTS];
-        uint lightCount;
-        float falloffConstant;
-        float falloffLinear;
-        float falloffQuadratic;
-    };
-
-
     VkShaderModule vertShader;
     VkShaderModule fragShader;
-    VkDescriptorSetLayout texturesDescriptorSetLayout;
-    VkDescriptorSetLayout lightBufferDescriptorSetLayout;
-    VkPipeline pipeline;
+    EvPipelineHandle pipeline;
+    // The same state for the forward subpass of the merged pass
+    EvPipelineHandle mergedPipeline;
     VkPipelineLayout pipelineLayout;
-    std::unique_ptr<UBOBuffer<LightBuffer>> lightUBO;
 
     struct Skybox {
         struct {
             glm::mat4 camera;
+            glm::vec4 bbMin;
+            glm::vec4 bbMax;
         } push;
         VkShaderModule vertShader;
         VkShaderModule fragShader;
         VkDescriptorSetLayout descriptorSetLayout;
-        VkPipeline pipeline;
+        EvPipelineHandle pipeline;
+        EvPipelineHandle mergedPipeline;
         VkPipelineLayout pipelineLayout;
 
         inline void destroy(EvDevice& device) {
+            vkDestroyPipeline(device.vkDevice, pipeline.get(), nullptr);
+            if (mergedPipeline.valid()) vkDestroyPipeline(device.vkDevice, mergedPipeline.get(), nullptr);
             vkDestroyShaderModule(device.vkDevice, vertShader, nullptr);
             vkDestroyShaderModule(device.vkDevice, fragShader, nullptr);
             vkDestroyDescriptorSetLayout(device.vkDevice, descriptorSetLayout, nullptr);
             vkDestroyPipelineLayout(device.vkDevice, pipelineLayout, nullptr);
-            vkDestroyPipeline(device.vkDevice, pipeline, nullptr);
         }
     } skybox;
 
-    void createFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages,
-                           const std::vector<EvFrameBufferAttachment>& depthAttachments);
-    void createTexturesDescriptorSetLayout();
-    void createLightBufferDescriptorSetLayout();
-    void createPipelineLayout();
+    void createFramebuffer(uint32_t width, uint32_t height, const EvFrameBufferAttachment& colorAttachment,
+                           const EvFrameBufferAttachment& bloomAttachment, const EvFrameBufferAttachment& depthAttachment);
+    void createPipelineLayout(VkDescriptorSetLayout frameSetLayout, VkDescriptorSetLayout textureTableLayout,
+                              VkDescriptorSetLayout clusterSetLayout, VkDescriptorSetLayout lightSetLayout);
     void createPipeline();
-    void createLightBuffers(uint32_t nrImages);
+    VkPipeline buildPipeline(VkRenderPass renderPass, uint32_t subpass) const;
 
     void createSkyboxDescriptorSetLayout();
     void createSkyboxPipelineLayout();
     void createSkyboxPipeline();
+    VkPipeline buildSkyboxPipeline(VkRenderPass renderPass, uint32_t subpass) const;
 
 public:
-    ForwardPass(EvDevice& device, uint32_t width, uint32_t height, uint32_t nrImages, const std::vector<EvFrameBufferAttachment>& depthAttachments);
+    ForwardPass(EvDevice& device, uint32_t width, uint32_t height, const EvFrameBufferAttachment& colorAttachment,
+                const EvFrameBufferAttachment& bloomAttachment, const EvFrameBufferAttachment& depthAttachment,
+                VkDescriptorSetLayout frameSetLayout, VkDescriptorSetLayout textureTableLayout,
+                VkDescriptorSetLayout clusterSetLayout, VkDescriptorSetLayout lightSetLayout);
     ~ForwardPass();
 
-    inline Buffer& getFramebuffer() { return framebuffer; }
-    inline VkDescriptorSetLayout getDescriptorSetLayout() const { return texturesDescriptorSetLayout; }
     inline VkPipelineLayout getPipelineLayout() const { return pipelineLayout; }
     inline Skybox& getSkybox() { return skybox; }
 
-    inline void setLightProperties(uint32_t imageIdx, float constant, float linear, float quadratic) {
-        auto& buffer = *lightUBO->getPtr(imageIdx);
-        buffer.falloffConstant = constant;
-        buffer.falloffLinear = linear;
-        buffer.falloffQuadratic = quadratic;
-    }
-
-    inline void bindSkyboxPipeline(VkCommandBuffer cmdBuffer, const EvCamera& camera) {
+    inline void bindSkyboxPipeline(VkCommandBuffer cmdBuffer, const EvCamera& camera, const BoundingBox& cubeBounds, bool merged = false) {
         skybox.push.camera = camera.getVPMatrix(device.window.getAspectRatio());
+        skybox.push.bbMin = glm::vec4(cubeBounds.vmin, 1.0f);
+        skybox.push.bbMax = glm::vec4(cubeBounds.vmax, 1.0f);
         vkCmdPushConstants(cmdBuffer, skybox.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(skybox.push), &skybox.push);
-        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, skybox.pipeline);
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, merged ? skybox.mergedPipeline.get() : skybox.pipeline.get());
     }
+    inline void bindMergedPipeline(VkCommandBuffer cmdBuffer) const {
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mergedPipeline.get());
+    }
+
+    // The render pass has to outlive the builds, the pipelines stay usable with every compatible one
+    void createMergedPipelines(VkRenderPass renderPass, uint32_t subpass);
 
-    void updateLights(LightComponent* lightData, uint32_t nrLights, uint32_t imageIdx);
-    void recreateFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages, const std::vector<EvFrameBufferAttachment>& depthAttachments);
-    void startPass(VkCommandBuffer cmdBuffer, uint32_t imageIdx) const;
+    void recreateFramebuffer(uint32_t width, uint32_t height, const EvFrameBufferAttachment& colorAttachment,
+                             const EvFrameBufferAttachment& bloomAttachment, const EvFrameBufferAttachment& depthAttachment);
+    // Draws into the top left renderExtent of the attachments, the rest is cleared to black
+    void startPass(VkCommandBuffer cmdBuffer, VkExtent2D renderExtent) const;
     void endPass(VkCommandBuffer cmdBuffer) const;
 };
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "../core.h"
+#include "../EvDevice.h"
+#include "../ShaderTypes.h"
+#include "../EvFrameRing.h"
+
+// Builds a max-depth mip pyramid from the depth prepass and uses it to
+// occlusion test every instance before the forward pass. The test writes
+// the indirect draw commands the forward pass consumes, occluded instances
+// simply get an instanceCount of zero.
+class HiZPass : NoCopy
+{
+    EvDevice& device;
+
+    // Shared by all frames in flight, it is rebuilt from scratch every frame
+    struct Pyramid {
+        uint32_t depthWidth, depthHeight;
+        uint32_t width, height, mipLevels;
+        VkImage image;
+        VmaAllocation imageMemory;
+        // full mip chain, used by the culling shader
+        VkImageView view;
+        // one view per level
+        std::vector<VkImageView> mipViews;
+
+        void destroy(EvDevice& device) {
+            for(auto& mipView : mipViews) vkDestroyImageView(device.vkDevice, mipView, nullptr);
+            vkDestroyImageView(device.vkDevice, view, nullptr);
+            vmaDestroyImage(device.vmaAllocator, image, imageMemory);
+            mipViews.clear();
+        }
+    } pyramid;
+
+    struct CullBuffers {
+        // Only read by the GPU within the frame, so one is enough
+        VkBuffer indirectBuffer;
+        VmaAllocation indirectMemory;
+        // Read back by the host, one per frame in flight
+        std::vector<VkBuffer> statsBuffers;
+        std::vector<VmaAllocation> statsMemory;
+        std::vector<uint32_t*> mappedStats;
+    } cullBuffers;
+
+    struct BuildPush {
+        glm::ivec4 sizes; // inputWidth, inputHeight, outputWidth, outputHeight
+    };
+
+    struct CullPush {
+        glm::uvec4 params; // pyramidWidth, pyramidHeight, instanceCount, enabled
+    };
+
+    EvFrameBufferAttachment depthAttachment;
+
+    VkSampler pointSampler;
+    VkDescriptorPool descriptorPool;
+
+    VkShaderModule buildShader;
+    VkDescriptorSetLayout buildDescriptorSetLayout;
+    VkPipelineLayout buildPipelineLayout;
+    EvPipelineHandle buildPipeline;
+    // one per level
+    std::vector<VkDescriptorSet> buildDescriptorSets;
+
+    VkShaderModule cullShader;
+    VkDescriptorSetLayout cullDescriptorSetLayout;
+    VkPipelineLayout cullPipelineLayout;
+    EvPipelineHandle cullPipeline;
+    // one per frame in flight
+    std::vector<VkDescriptorSet> cullDescriptorSets;
+
+    void createPyramid(uint32_t width, uint32_t height);
+    void createCullBuffers(uint32_t nrFrames);
+    void createSampler();
+    void createDescriptorSetLayouts();
+    void createPipelineLayouts(VkDescriptorSetLayout frameSetLayout);
+    void createPipelines();
+    void createDescriptorPool(uint32_t nrFrames);
+    void allocateDescriptorSets(uint32_t nrFrames);
+    void createDescriptorSets(uint32_t nrFrames);
+
+public:
+    static const uint32_t MAX_INSTANCES = MAX_ENTITIES;
+    static const uint32_t MAX_LEVELS = 16;
+
+    HiZPass(EvDevice& device, uint32_t width, uint32_t height, uint32_t nrFrames, const EvFrameBufferAttachment& depthAttachment, VkDescriptorSetLayout frameSetLayout);
+    ~HiZPass();
+
+    inline VkBuffer getIndirectBuffer() const { return cullBuffers.indirectBuffer; }
+    // Number of instances that passed the test the last time this frame in flight was rendered.
+    inline uint32_t getVisibleCount(uint32_t frameIdx) const { return *cullBuffers.mappedStats[frameIdx]; }
+    inline void resetVisibleCount(uint32_t frameIdx) { *cullBuffers.mappedStats[frameIdx] = 0; }
+
+    void recreateFramebuffer(uint32_t width, uint32_t height, uint32_t nrFrames, const EvFrameBufferAttachment& depthAttachment);
+    // Reads the instances of this frame from the frame ring, in the order they will be drawn.
+    // With culling enabled the depth buffer has to be sampleable, the render graph sees to that.
+    void run(VkCommandBuffer cmdBuffer, uint32_t frameIdx, const EvFrameRing& frameRing, uint32_t instanceCount, bool cullingEnabled) const;
+};
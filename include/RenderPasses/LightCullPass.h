@@ -0,0 +1,46 @@
+#pragma once
+
+#include "../core.h"
+#include "../EvDevice.h"
+#include "../ShaderTypes.h"
+#include "../EvFrameRing.h"
+#include "../EvStorageMirror.h"
+
+// Bins the lights of the frame into a view space cluster grid. Every cluster gets
+// the list of lights whose range overlaps it, so the forward pass only shades a
+// fragment with the lights of its own cluster.
+class LightCullPass : NoCopy
+{
+    EvDevice& device;
+
+    // Rebuilt and consumed within the frame, so one copy serves every frame in flight
+    struct ClusterBuffers {
+        VkBuffer countBuffer;
+        VmaAllocation countMemory;
+        VkBuffer indexBuffer;
+        VmaAllocation indexMemory;
+    } clusterBuffers;
+
+    VkShaderModule cullShader;
+    // Shared by the culling shader, which writes the clusters, and the forward pass, which reads them.
+    VkDescriptorSetLayout clusterDescriptorSetLayout;
+    VkPipelineLayout pipelineLayout;
+    EvPipelineHandle pipeline;
+    VkDescriptorSet clusterDescriptorSet;
+
+    void createClusterBuffers();
+    void createDescriptorSetLayout();
+    void createPipelineLayout(VkDescriptorSetLayout frameSetLayout, VkDescriptorSetLayout lightSetLayout);
+    void createPipeline();
+    void createDescriptorSet();
+
+public:
+    LightCullPass(EvDevice& device, VkDescriptorSetLayout frameSetLayout, VkDescriptorSetLayout lightSetLayout);
+    ~LightCullPass();
+
+    inline VkDescriptorSetLayout getClusterSetLayout() const { return clusterDescriptorSetLayout; }
+
+    // Reads the camera of this frame from the frame ring.
+    void run(VkCommandBuffer cmdBuffer, const EvFrameRing& frameRing, const EvStorageMirror& lights) const;
+    void bindClusters(VkCommandBuffer cmdBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set) const;
+};
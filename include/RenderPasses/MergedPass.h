@@ -0,0 +1,63 @@
+#pragma once
+
+#include "../core.h"
+#include "../EvDevice.h"
+
+// The depth prepass, the forward pass and the composition of the post pass as the subpasses of a
+// single render pass. The composition reads what forward wrote at its own pixel as input attachments,
+// so depth, color and bloom never have to leave tile memory: they are cleared, used and discarded
+// within the render pass. Only the swapchain image is stored, for the overlay pass of the post pass.
+class MergedPass : NoCopy
+{
+public:
+    static constexpr uint32_t DEPTH_SUBPASS = 0;
+    static constexpr uint32_t FORWARD_SUBPASS = 1;
+    static constexpr uint32_t COMPOSE_SUBPASS = 2;
+
+private:
+    EvDevice& device;
+
+    // Lives as long as the pass, the pipelines of the depth and forward passes are built against it
+    VkRenderPass renderPass;
+
+    // One framebuffer per swapchain image, the other attachments belong to the render graph.
+    // Only there while the passes are merged, the attachments are transient then.
+    struct Buffer {
+        uint32_t width, height;
+        std::vector<VkFramebuffer> vkFrameBuffers;
+
+        void destroy(EvDevice& device) {
+            for(const auto& frameBuffer : vkFrameBuffers) vkDestroyFramebuffer(device.vkDevice, frameBuffer, nullptr);
+            vkFrameBuffers.clear();
+        }
+    } framebuffer;
+
+    VkShaderModule vertShader;
+    VkShaderModule fragShader;
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkPipelineLayout pipelineLayout;
+    EvPipelineHandle pipeline;
+    VkDescriptorSet descriptorSet;
+
+    void createRenderPass(VkFormat swapchainFormat, VkFormat depthFormat, VkFormat colorFormat, VkFormat bloomFormat);
+    void createDescriptorSetLayout();
+    void allocateDescriptorSet();
+    void createPipeline();
+
+public:
+    MergedPass(EvDevice& device, VkFormat swapchainFormat, VkFormat depthFormat, VkFormat colorFormat, VkFormat bloomFormat);
+    ~MergedPass();
+
+    inline VkRenderPass getRenderPass() const { return renderPass; }
+
+    void recreateFramebuffer(uint32_t width, uint32_t height, const std::vector<VkImageView>& swapchainImageViews,
+                             const EvFrameBufferAttachment& depthAttachment, const EvFrameBufferAttachment& colorAttachment,
+                             const EvFrameBufferAttachment& bloomAttachment);
+    // Begins the depth subpass. The viewport covers the whole framebuffer, there is no render scale to
+    // upsample from when the composition reads its own pixel.
+    void beginPass(VkCommandBuffer commandBuffer, uint32_t imageIdx) const;
+    void nextSubpass(VkCommandBuffer commandBuffer) const;
+    // Adds bloom to color into the swapchain image, within the composition subpass
+    void compose(VkCommandBuffer commandBuffer) const;
+    void endPass(VkCommandBuffer commandBuffer) const;
+};
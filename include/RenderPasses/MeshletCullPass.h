@@ -0,0 +1,62 @@
+#pragma once
+
+#include "../core.h"
+#include "../EvDevice.h"
+#include "../ShaderTypes.h"
+#include "../EvFrameRing.h"
+
+// Culls the meshlets of every instance that survived the instance culling, against the frustum
+// and by their normal cones. The visible ones are appended as indirect draw commands, in one batch
+// per index type of the geometry arena, which the forward pass draws with the count the culling left.
+class MeshletCullPass : NoCopy
+{
+    EvDevice& device;
+
+    struct DrawBuffers {
+        // Only read by the GPU within the frame, so one is enough. Batch i starts at i * MAX_DRAWS_PER_BATCH.
+        VkBuffer drawBuffer;
+        VmaAllocation drawMemory;
+        // Draw count per batch
+        VkBuffer countBuffer;
+        VmaAllocation countMemory;
+        // Read back by the host, one per frame in flight
+        std::vector<VkBuffer> statsBuffers;
+        std::vector<VmaAllocation> statsMemory;
+        std::vector<uint32_t*> mappedStats;
+    } drawBuffers;
+
+    struct CullPush {
+        glm::uvec4 params; // instanceCount, maxDrawsPerBatch, unused, unused
+    };
+
+    VkShaderModule cullShader;
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkPipelineLayout pipelineLayout;
+    EvPipelineHandle pipeline;
+    // one per frame in flight
+    std::vector<VkDescriptorSet> descriptorSets;
+
+    void createDrawBuffers(uint32_t nrFrames);
+    void createDescriptorSetLayout();
+    void createPipelineLayout(VkDescriptorSetLayout frameSetLayout);
+    void createPipeline();
+    void createDescriptorSets(uint32_t nrFrames, VkBuffer meshletBuffer, VkBuffer instanceDrawBuffer);
+
+public:
+    // Batch 0 holds the 16 bit index draws, batch 1 the 32 bit ones
+    static constexpr uint32_t BATCH_COUNT = 2;
+    static constexpr uint32_t MAX_DRAWS_PER_BATCH = 1 << 17;
+
+    // The instance draws are the ones the instance culling wrote, their instance count tells the visibility
+    MeshletCullPass(EvDevice& device, uint32_t nrFrames, VkDescriptorSetLayout frameSetLayout, VkBuffer meshletBuffer, VkBuffer instanceDrawBuffer);
+    ~MeshletCullPass();
+
+    // Number of meshlets drawn the last time this frame in flight was rendered.
+    inline uint32_t getVisibleCount(uint32_t frameIdx) const { return *drawBuffers.mappedStats[frameIdx]; }
+    inline void resetVisibleCount(uint32_t frameIdx) { *drawBuffers.mappedStats[frameIdx] = 0; }
+
+    // Reads the instances of this frame from the frame ring, after the instance culling ran.
+    void run(VkCommandBuffer cmdBuffer, uint32_t frameIdx, const EvFrameRing& frameRing, uint32_t instanceCount) const;
+    // The index buffer of the type has to be bound
+    void draw(VkCommandBuffer cmdBuffer, VkIndexType indexType) const;
+};
@@ -4,42 +4,60 @@
 #include "../EvDevice.h"
 
 class PostPass {
+public:
+    // Sampled by the composition, the merged pass composes from tile memory instead
+    struct Inputs {
+        EvFrameBufferAttachment color;
+        EvFrameBufferAttachment bloom;
+    };
+
+private:
     EvDevice& device;
 
     struct PostBuffer : public EvFrameBuffer {
+        // Compatible with the render pass above, it loads what the merged pass composed for the overlay
+        VkRenderPass overlayRenderPass;
 
+        void destroy(EvDevice& device) override {
+            EvFrameBuffer::destroy(device);
+            vkDestroyRenderPass(device.vkDevice, overlayRenderPass, nullptr);
+        }
     } framebuffer;
 
     VkShaderModule vertShader;
     VkShaderModule fragShader;
-    VkPipeline pipeline;
+    EvPipelineHandle pipeline;
     VkPipelineLayout pipelineLayout;
     VkDescriptorSetLayout descriptorSetLayout;
-    std::vector<VkDescriptorSet> descriptorSets;
-    std::vector<VkDescriptorSet> bloomDescriptorSets;
+    VkDescriptorSet descriptorSet;
+    VkDescriptorSet bloomDescriptorSet;
 
     VkSampler composedSampler;
 
-    void createBuffer(uint32_t width, uint32_t height, uint32_t nrImages, VkFormat swapchainFormat,
+    struct Push {
+        // Part of the inputs that was rendered to this frame
+        glm::vec2 renderScale;
+    };
+
+    void createBuffer(uint32_t width, uint32_t height, uint32_t nrImages, VkFormat swapchainFormat, VkImageLayout presentLayout,
                       const std::vector<VkImageView> &swapchainImageViews);
     void createDescriptorSetLayout();
-    void allocateDescriptorSets(uint32_t nrImages);
-    void createDescriptorSets(uint32_t nrImages, const std::vector<EvFrameBufferAttachment> &colorInputs, const std::vector<EvFrameBufferAttachment> &bloomInputs);
+    void allocateDescriptorSets();
+    void createDescriptorSets(const std::optional<Inputs>& inputs);
     void createPipeline();
 
 public:
-    PostPass(EvDevice &device, uint32_t width, uint32_t height, uint32_t nrImages, VkFormat swapchainFormat,
-             const std::vector<VkImageView> &swapchainImageViews,
-             const std::vector<EvFrameBufferAttachment> &colorInputs,
-             const std::vector<EvFrameBufferAttachment> &bloomInputs);
+    PostPass(EvDevice &device, uint32_t width, uint32_t height, uint32_t nrImages, VkFormat swapchainFormat, VkImageLayout presentLayout,
+             const std::vector<VkImageView> &swapchainImageViews, const std::optional<Inputs>& inputs);
     ~PostPass();
 
     inline VkRenderPass getRenderPass() const { return framebuffer.vkRenderPass; }
 
-    void recreateFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages,
-                             const std::vector<EvFrameBufferAttachment> &colorInputs,
-                             const std::vector<EvFrameBufferAttachment> &bloomInputs, VkFormat swapchainFormat,
-                             const std::vector<VkImageView> &swapchainImageViews);
-    void beginPass(VkCommandBuffer commandBuffer, uint32_t imageIdx) const;
+    void recreateFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages, const std::optional<Inputs>& inputs,
+                             VkFormat swapchainFormat, VkImageLayout presentLayout, const std::vector<VkImageView> &swapchainImageViews);
+    // Upsamples the top left renderScale of the inputs to the whole swapchain image
+    void beginPass(VkCommandBuffer commandBuffer, uint32_t imageIdx, glm::vec2 renderScale) const;
+    // Only for the overlay on top of what the merged pass left in the swapchain image
+    void beginOverlayPass(VkCommandBuffer commandBuffer, uint32_t imageIdx) const;
     void endPass(VkCommandBuffer commandBuffer) const;
 };
\ No newline at end of file
@@ -7,38 +7,129 @@
 #include "ShaderTypes.h"
 #include "EvTexture.h"
 #include "EvOverlay.h"
+#include "EvFrameRing.h"
+#include "EvTextureTable.h"
+#include "EvStorageMirror.h"
+#include "EvGpuProfiler.h"
+#include "EvRenderGraph.h"
 #include "Components.h"
 #include "RenderPasses/DepthPass.h"
+#include "RenderPasses/HiZPass.h"
+#include "RenderPasses/MeshletCullPass.h"
+#include "RenderPasses/LightCullPass.h"
 #include "RenderPasses/ForwardPass.h"
 #include "RenderPasses/BloomPass.h"
 #include "RenderPasses/PostPass.h"
+#include "RenderPasses/MergedPass.h"
 
 class RenderSystem : public System
 {
     struct LightSystem : public System
     {
+        // Slots in the light array that another light was moved into
+        std::vector<uint32_t> reusedIndices;
+        // Lowest light count since the last sync, new lights are appended from there
+        uint32_t shrunkTo = std::numeric_limits<uint32_t>::max();
+
         inline Signature GetSignature() const override {
             Signature signature;
             signature.set(m_coordinator->GetComponentType<LightComponent>());
             return signature;
         }
+
+        inline void EntityDestroyed(Entity entity) override {
+            // The component array fills the hole with its last element once the entity is gone
+            if (m_entities.count(entity)) {
+                reusedIndices.push_back(static_cast<uint32_t>(m_coordinator->GetComponentIndex<LightComponent>(entity)));
+                shrunkTo = std::min(shrunkTo, static_cast<uint32_t>(m_entities.size() - 1));
+            }
+        }
     };
     std::shared_ptr<LightSystem> lightSubSystem;
 
     EvDevice& device;
     std::unique_ptr<EvSwapchain> swapchain;
-    std::vector<VkCommandBuffer> commandBuffers;
+    // A frame is split over four submissions, so that bloom can run on the compute queue while
+    // the graphics queue moves on to the prepass of the next frame. With the passes merged there
+    // is no bloom, and everything after the start of the frame is recorded into post.
+    struct FrameCommandBuffers {
+        // depth prepass, hiz and light culling on the graphics queue
+        VkCommandBuffer prepass;
+        // forward pass on the graphics queue, also bloom when it does not run async
+        VkCommandBuffer forward;
+        // bloom on the compute queue
+        VkCommandBuffer bloom;
+        // post pass and overlay on the post queue
+        VkCommandBuffer post;
+    };
+    // one per frame in flight
+    std::vector<FrameCommandBuffers> commandBuffers;
+    // Signaled with the number of the frame once its forward pass, bloom or post pass is done
+    VkSemaphore forwardTimeline;
+    VkSemaphore bloomTimeline;
+    VkSemaphore postTimeline;
+    uint64_t frameNumber = 0;
+    std::unique_ptr<EvFrameRing> frameRing;
+    std::unique_ptr<EvTextureTable> textureTable;
+    std::unique_ptr<EvStorageMirror> lightBuffer;
+    uint32_t syncedLightCount = 0;
+
+    // Declares the passes for the current settings and owns the attachments between them
+    std::unique_ptr<EvRenderGraph> renderGraph;
+    struct {
+        EvRenderGraph::SubmissionId prepass, forward, bloom, post;
+    } graphSubmissions;
+    struct {
+        EvRenderGraph::ResourceId depth, color, bloom, bloomBlurred;
+        std::array<EvRenderGraph::ResourceId, 2> gaussian;
+    } graphImages;
+    // The settings that change which passes run, the graph is rebuilt when they do
+    struct GraphSettings {
+        bool bloomEnabled;
+        int bloomMode;
+        bool asyncCompute;
+        bool occlusionCulling;
+        bool meshletCulling;
+        bool mergedPasses;
+
+        bool operator==(const GraphSettings&) const = default;
+    } graphSettings;
+    // What the passes of the graph record for, set before each frame is recorded
+    struct {
+        const EvCamera* camera;
+        uint32_t frameIndex;
+        uint32_t imageIndex;
+    } frameContext;
 
+    std::unique_ptr<EvGpuProfiler> gpuProfiler;
     std::unique_ptr<EvOverlay> overlay;
     std::unique_ptr<DepthPass> depthPass;
+    std::unique_ptr<HiZPass> hiZPass;
+    std::unique_ptr<MeshletCullPass> meshletCullPass;
+    std::unique_ptr<LightCullPass> lightCullPass;
     std::unique_ptr<ForwardPass> forwardPass;
     std::unique_ptr<PostPass> postPass;
     std::unique_ptr<BloomPass> bloomPass;
+    std::unique_ptr<MergedPass> mergedPass;
+    // Part of the attachments rendered to, the rest of the swapchain extent is upsampled by the post pass
+    VkExtent2D renderExtent{};
 
+    // Declared before the meshes, they give their ranges back on destruction
+    std::unique_ptr<EvGeometryArena> geometryArena;
     std::vector<std::unique_ptr<EvMesh>> createdMeshes;
     std::vector<std::unique_ptr<EvTexture>> createdTextures;
     std::vector<std::unique_ptr<TextureSet>> createdTextureSets;
 
+    // One per entity, sorted so that draws sharing state end up next to each other.
+    struct DrawItem {
+        uint64_t key;
+        EvMesh* mesh;
+        TextureSet* textureSet;
+        uint32_t lod;
+        glm::mat4 model;
+    };
+    std::vector<DrawItem> drawList;
+
     EvMesh* m_cubeMesh;
     EvMesh* m_sphereMesh;
 
@@ -47,28 +138,65 @@ class RenderSystem : public System
         VmaAllocation imageMemory;
         VkImageView imageView;
         VkSampler sampler;
-        std::vector<VkDescriptorSet> descriptorSets;
+        VkDescriptorSet descriptorSet;
     } m_skybox;
 
 
-    void createSwapchain();
+    void createSwapchain(uint32_t framesInFlight = 0);
     void loadSkybox();
 
     void allocateCommandBuffers();
-    void recordCommandBuffer(uint32_t imageIndex, const EvCamera &camera);
+    void createTimelines();
+    void createFrameRing();
+    void syncLights();
+    static GraphSettings getGraphSettings(const UIInfo& uiInfo);
+    void compileGraph();
+    void rebuildGraph();
+    std::optional<BloomPass::GaussianImages> getGaussianImages() const;
+    // Read by the culling and both draws, in the order of the draw list
+    void writeInstances();
+    // The draws of the prepass and the forward pass, in whichever render pass and subpass they run
+    void recordDepthDraws(VkCommandBuffer commandBuffer);
+    void recordForwardDraws(VkCommandBuffer commandBuffer, bool merged);
+    void recordCommandBuffers(const FrameCommandBuffers& frameCommandBuffers, uint32_t imageIndex, const EvCamera &camera, bool asyncBloom);
+    void submit(VkQueue queue, VkCommandBuffer commandBuffer, std::optional<EvTimelinePoint> wait, VkPipelineStageFlags waitStage, std::optional<EvTimelinePoint> signal) const;
     void recreateSwapchain();
+    void updateRenderExtent();
+    inline glm::vec2 getRenderScale() const {
+        return glm::vec2(renderExtent.width, renderExtent.height) / glm::vec2(swapchain->extent.width, swapchain->extent.height);
+    }
+    uint32_t selectLod(const EvMesh& mesh, const glm::mat4& model, const EvCamera& camera);
+    void buildDrawList(const EvCamera& camera);
 
 public:
+    // The light buffer grows past this when needed
+    static constexpr uint32_t INITIAL_LIGHT_CAPACITY = 1024;
+    static constexpr VkDeviceSize FRAME_RING_PARTITION_SIZE = 1 << 20;
+    static constexpr uint32_t MAX_ARENA_VERTICES = 1 << 21;
+    static constexpr uint32_t MAX_ARENA_INDICES = 1 << 23;
+    static constexpr uint32_t MAX_ARENA_MESHLETS = 1 << 18;
+    // Texture table slots are packed in 16 bits per instance
+    static constexpr uint32_t MAX_TEXTURES = 1024;
+    // Draws further away than this all get the same depth in the sort key
+    static constexpr float MAX_SORT_DISTANCE = 100.0f;
+    // Fraction of the error in render scale corrected each frame, low enough to ride out the frames of latency
+    static constexpr float RENDER_SCALE_GAIN = 0.1f;
+
     EvTexture* m_whiteTexture;
     EvTexture* m_normalTexture;
     TextureSet* defaultTextureSet;
 
-    RenderSystem(EvDevice& device);
+    // The transient attachments are shared by all frames in flight, only the command buffers
+    // and the host visible buffers are multiplied by framesInFlight.
+    RenderSystem(EvDevice& device, uint32_t framesInFlight);
     ~RenderSystem();
 
     inline UIInfo& getUIInfo() { assert(overlay); return overlay->getUIInfo(); }
+    inline const EvGpuProfiler& getGpuProfiler() const { return *gpuProfiler; }
 
     void Render(const EvCamera &camera);
+    // Schedules the lights of these entities for upload, entities without a light are ignored.
+    void markLightsMoved(const std::vector<Entity>& entities);
 
     void RegisterStage() override;
 
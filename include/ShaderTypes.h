@@ -2,9 +2,76 @@
 
 #include "core.h"
 
-struct PushConstant
+// Bindings of the frame ring descriptor set, which is always bound at set 0.
+enum FrameBinding : uint32_t {
+    FRAME_BINDING_UNIFORMS = 0,
+    FRAME_BINDING_INSTANCES = 1,
+};
+
+// Everything that is constant for a frame (std140)
+struct FrameUniforms
+{
+    glm::mat4 viewProjection;
+    glm::vec4 camPos;
+    uint32_t lightCount;
+    float falloffConstant;
+    float falloffLinear;
+    float falloffQuadratic;
+    glm::mat4 view;
+    // tangent of half the field of view, horizontal and vertical
+    glm::vec2 tanHalfFov;
+    glm::vec2 screenSize;
+    float zNear;
+    float zFar;
+    // Radiance below which a light is considered out of range, determines the light radii
+    float lightCutoff;
+    float padding;
+    // Part of the attachments rendered to this frame, screenSize is that part in pixels
+    glm::vec2 renderScale;
+};
+
+// Dimensions of the view space light cluster grid, mirrored in clusters.glsl.
+// Slices along z are spaced exponentially between the near and far plane.
+static constexpr uint32_t CLUSTER_GRID_X = 16;
+static constexpr uint32_t CLUSTER_GRID_Y = 9;
+static constexpr uint32_t CLUSTER_GRID_Z = 24;
+static constexpr uint32_t CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+static constexpr uint32_t MAX_LIGHTS_PER_CLUSTER = 256;
+
+// Per instance data (std430). The vertex shaders index it with gl_InstanceIndex,
+// the culling shader turns it into an indirect draw command.
+struct InstanceData
+{
+    glm::mat4 model;
+    glm::vec4 bbMin;
+    glm::vec4 bbMax;
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    // Texture table slots, diffuse in the low 16 bits and normal in the high 16 bits
+    uint32_t textureIndices;
+    // Meshlets of the level of detail that is drawn, in the meshlet buffer of the geometry arena
+    uint32_t firstMeshlet;
+    uint32_t meshletCount;
+    // 32 bit indices, the meshlet draws of those go in a batch of their own
+    uint32_t wideIndices;
+    uint32_t padding;
+};
+
+// Limits of a meshlet, only buildMeshlets uses them. The shaders go by the index count of each meshlet.
+static constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+static constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// A run of consecutive triangles of one level of detail (std430). The culling shader rejects it
+// outside of the frustum with the sphere, and when all of its triangles face away with the cone.
+struct Meshlet
 {
-    glm::mat4 camera;
-    glm::mat4 mvp;
-    glm::vec3 camPos;
+    // Object space center and radius
+    glm::vec4 sphere;
+    // Axis and cutoff, a zero axis never rejects
+    glm::vec4 cone;
+    // Relative to the first index of the level
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t padding[2];
 };
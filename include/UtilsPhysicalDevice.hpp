@@ -29,15 +29,22 @@ namespace {
 
         for(uint i=0; i<queueFamilyCount; i++) {
             const auto& queueFamily = properties[i];
-            if (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) {
+            // A family without graphics is separate hardware on most GPUs, its work runs alongside the graphics queue
+            if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)
+                && (!indices.compute.has_value() || !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT))) {
                 indices.compute = i;
             }
             if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
                 indices.graphics = i;
             }
 
+            // Without a surface the offscreen images are "presented" by the graphics queue
             VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &presentSupport);
+            if (surface != VK_NULL_HANDLE) {
+                vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &presentSupport);
+            } else {
+                presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+            }
             if (presentSupport) {
                 indices.present = i;
             }
@@ -7,6 +7,7 @@ inline constexpr float PI = 3.14159265358979323846f;
 
 // STL
 #include <set>
+#include <map>
 #include <unordered_map>
 #include <memory>
 #include <vector>
@@ -21,6 +22,15 @@ inline constexpr float PI = 3.14159265358979323846f;
 #include <fstream>
 #include <limits>
 #include <optional>
+#include <span>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <thread>
 
 // HALF FLOATS
 #include <half.h>
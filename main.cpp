@@ -6,8 +6,49 @@
 
 #include "include/App.h"
 
-int main() {
-    App app{};
+static void printUsage(const char* program) {
+    printf("usage: %s [--headless] [--frames N] [--resolution WxH] [--bloom MODE]\n", program);
+    printf("  --headless        render offscreen without a window and print frame timings\n");
+    printf("  --frames N        number of frames to render in headless mode (default 1000)\n");
+    printf("  --resolution WxH  size of the window or offscreen images (default 1280x768)\n");
+    printf("  --bloom MODE      pyramid, gaussian, tiled or linear (default pyramid)\n");
+}
+
+static bool parseBloomMode(const char* name, int* mode) {
+    constexpr std::array<const char*, 4> names { "pyramid", "gaussian", "tiled", "linear" };
+    for(int i=0; i<names.size(); i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *mode = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    AppOptions options{};
+    for(int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            options.headless = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            options.benchmarkFrames = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--resolution") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%ix%i", &options.width, &options.height) != 2 || options.width <= 0 || options.height <= 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--bloom") == 0 && i + 1 < argc) {
+            if (!parseBloomMode(argv[++i], &options.bloomMode)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    App app(options);
     app.Run();
     return 0;
 }
@@ -3,8 +3,9 @@
 EvDeviceInfo deviceInfo {
 };
 
-App::App()
-    : window(1280, 768, "Hello world")
+App::App(const AppOptions& options)
+    : options(options)
+    , window(options.width, options.height, "Hello world", options.headless)
     , device(deviceInfo, window)
     , inputHelper(window.glfwWindow)
 {
@@ -12,24 +13,44 @@ App::App()
         .fov = 90,
     };
     createECSSystems();
+    renderSystem->getUIInfo().bloomMode = options.bloomMode;
     createWorld();
 }
 
 void App::Run() {
     uint tick = 0;
+    if (options.headless) frameTimes.reserve(options.benchmarkFrames);
     while (!window.shouldClose()) {
+        if (options.headless && tick >= options.benchmarkFrames) break;
         tick++;
-        double startFrame = glfwGetTime();
+        auto startFrame = std::chrono::steady_clock::now();
+        EvCpuProfiler::get().beginFrame();
+        EV_CPU_ZONE("frame");
         auto& uiinfo = renderSystem->getUIInfo();
 
-        window.processEvents();
-        inputHelper.swapBuffers();
-        camera.handleInput(inputHelper);
-        physicsSystem->Update(uiinfo.forceField);
-        renderSystem->Render(camera);
+        {
+            EV_CPU_ZONE("input");
+            window.processEvents();
+            inputHelper.swapBuffers();
+            camera.handleInput(inputHelper);
+        }
+        {
+            EV_CPU_ZONE("physics");
+            physicsSystem->Update(uiinfo.forceField);
+        }
+        renderSystem->markLightsMoved(physicsSystem->getMovedEntities());
+        {
+            EV_CPU_ZONE("render");
+            renderSystem->Render(camera);
+        }
         time += 0.01f;
-        double timePerFrame = glfwGetTime() - startFrame;
+        double timePerFrame = std::chrono::duration<double>(std::chrono::steady_clock::now() - startFrame).count();
+        if (tick == 1) {
+            // Recording the first frame waited for every pipeline, so this covers all of startup
+            printf("Startup to first frame: %.1f ms\n", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+        }
         uiinfo.fps = static_cast<float>(1.0f / timePerFrame);
+        if (options.headless) frameTimes.push_back(timePerFrame);
 
         physicsSystem->setWorldGravity(renderSystem->getUIInfo().gravity);
         auto& floorModel = ecsCoordinator.GetComponent<ModelComponent>(floor);
@@ -52,11 +73,57 @@ void App::Run() {
 
     printf("Flushing GPU before shutdown...\n");
     vkDeviceWaitIdle(device.vkDevice);
+    if (options.headless) {
+        printBenchmarkResults();
+        EvCpuProfiler::get().exportChromeTrace("cpu_trace.json");
+    }
     printf("Goodbye!\n");
 }
 
+void App::printBenchmarkResults() const {
+    // With frames in flight the CPU blocks on the fence of the frame it reuses,
+    // so once warmed up the frame time follows the GPU.
+    const size_t skip = frameTimes.size() > BENCHMARK_WARMUP_FRAMES ? BENCHMARK_WARMUP_FRAMES : 0;
+    std::vector<double> sorted(frameTimes.begin() + skip, frameTimes.end());
+    if (sorted.empty()) {
+        printf("Benchmark: no frames rendered\n");
+        return;
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    double total = 0.0;
+    for(const auto& t : sorted) total += t;
+    const double mean = total / static_cast<double>(sorted.size());
+    auto percentile = [&sorted](double p) {
+        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * static_cast<double>(sorted.size())))];
+    };
+
+    printf("Benchmark: %zu frames at %ix%i (%zu warmup frames skipped)\n", sorted.size(), window.width, window.height, skip);
+    printf("  total  %.3f s\n", total);
+    printf("  mean   %.3f ms (%.1f fps)\n", mean * 1000.0, 1.0 / mean);
+    printf("  min    %.3f ms\n", sorted.front() * 1000.0);
+    printf("  p50    %.3f ms\n", percentile(0.50) * 1000.0);
+    printf("  p95    %.3f ms\n", percentile(0.95) * 1000.0);
+    printf("  p99    %.3f ms\n", percentile(0.99) * 1000.0);
+    printf("  max    %.3f ms\n", sorted.back() * 1000.0);
+
+    const auto& gpuProfiler = renderSystem->getGpuProfiler();
+    if (gpuProfiler.isSupported()) {
+        printf("GPU zones, averaged over the last %u frames:\n", EvGpuProfiler::HISTORY_SIZE);
+        // Per queue, their timestamps cannot be compared with each other
+        for(uint32_t queue=0; queue<EvGpuProfiler::QUEUE_COUNT; queue++) {
+            const auto& span = gpuProfiler.getQueueZone(static_cast<EvGpuProfiler::Queue>(queue));
+            printf("  %-20s %.3f ms\n", ("queue " + span.name).c_str(), span.averageMs);
+        }
+        for(const auto& zone : gpuProfiler.getZones()) {
+            printf("  %-20s %.3f ms at %.3f ms in %s\n", zone.name.c_str(), zone.averageMs, zone.startMs,
+                   gpuProfiler.getQueueZone(zone.queue).name.c_str());
+        }
+    }
+}
+
 void App::createECSSystems() {
-    renderSystem = ecsCoordinator.RegisterSystem<RenderSystem>(device);
+    renderSystem = ecsCoordinator.RegisterSystem<RenderSystem>(device, FRAMES_IN_FLIGHT);
     physicsSystem = ecsCoordinator.RegisterSystem<PhysicsSystem>();
 }
 
@@ -1,10 +1,16 @@
 #include <utils.hpp>
 #include "EvCamera.h"
 
+glm::mat4 EvCamera::getViewMatrix() const {
+    return glm::lookAt(position, position + getViewDir(), glm::vec3(0,1,0));
+}
+
+glm::mat4 EvCamera::getProjectionMatrix(float aspectRatio) const {
+    return glm::perspective(glm::radians(fov), aspectRatio, zNear, zFar);
+}
+
 glm::mat4 EvCamera::getVPMatrix(float aspectRatio) const {
-    auto viewMatrix = glm::lookAt(position, position + getViewDir(), glm::vec3(0,1,0));
-    auto projectionMatrix = glm::perspective(glm::radians(fov), aspectRatio, 0.01f, 100.0f);
-    return projectionMatrix * viewMatrix;
+    return getProjectionMatrix(aspectRatio) * getViewMatrix();
 }
 
 void EvCamera::handleInput(const EvInputHelper &input) {
@@ -0,0 +1,121 @@
+#include "EvCpuProfiler.h"
+
+EvCpuProfiler::EvCpuProfiler() : epoch(std::chrono::steady_clock::now()) {
+}
+
+EvCpuProfiler &EvCpuProfiler::get() {
+    static EvCpuProfiler instance;
+    return instance;
+}
+
+EvCpuProfiler::ThreadBuffer &EvCpuProfiler::getThreadBuffer() {
+    // Registering is the only time a thread takes the lock
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (buffer == nullptr) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        threadBuffers.push_back(std::make_unique<ThreadBuffer>());
+        buffer = threadBuffers.back().get();
+        buffer->threadId = static_cast<uint32_t>(threadBuffers.size() - 1);
+        buffer->events = std::make_unique<Event[]>(RING_CAPACITY);
+    }
+    return *buffer;
+}
+
+uint64_t EvCpuProfiler::beginZone() {
+    getThreadBuffer().depth++;
+    return now();
+}
+
+void EvCpuProfiler::endZone(const char *name, uint64_t startNs) {
+    const uint64_t endNs = now();
+    auto& buffer = getThreadBuffer();
+    assert(buffer.depth > 0);
+    buffer.depth--;
+
+    const uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    buffer.events[head % RING_CAPACITY] = Event {
+        .name = name,
+        .startNs = startNs,
+        .endNs = endNs,
+        .depth = buffer.depth,
+    };
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void EvCpuProfiler::beginFrame() {
+    const uint64_t frameEndNs = now();
+    auto& buffer = getThreadBuffer();
+    assert(buffer.depth == 0 && "frames have to start outside of any zone");
+
+    // Events are written when their zone closes, so walking back from the head yields
+    // everything that closed during the frame until the first zone from before it.
+    const uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    const uint64_t oldest = head > RING_CAPACITY ? head - RING_CAPACITY : 0;
+    std::vector<Event> frameEvents;
+    for(uint64_t i = head; i > oldest; i--) {
+        const Event& event = buffer.events[(i - 1) % RING_CAPACITY];
+        if (event.startNs < frameStartNs) break;
+        frameEvents.push_back(event);
+    }
+
+    // Parents before their children
+    std::sort(frameEvents.begin(), frameEvents.end(), [](const Event& a, const Event& b) {
+        return a.startNs != b.startNs ? a.startNs < b.startNs : a.depth < b.depth;
+    });
+
+    frameSummary.clear();
+    for(const auto& event : frameEvents) {
+        frameSummary.push_back(SummaryEntry {
+            .name = event.name,
+            .depth = event.depth,
+            .ms = static_cast<float>(static_cast<double>(event.endNs - event.startNs) / 1e6),
+        });
+    }
+
+    frameMs = static_cast<float>(static_cast<double>(frameEndNs - frameStartNs) / 1e6);
+    frameStartNs = frameEndNs;
+}
+
+bool EvCpuProfiler::exportChromeTrace(const std::string &filename) {
+    FILE* file = fopen(filename.c_str(), "w");
+    if (file == nullptr) {
+        printf("Could not open %s for writing\n", filename.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    size_t eventCount = 0;
+    for(const auto& buffer : threadBuffers) {
+        const uint64_t head = buffer->head.load(std::memory_order_acquire);
+        const uint64_t oldest = head > RING_CAPACITY ? head - RING_CAPACITY : 0;
+        std::vector<Event> events;
+        events.reserve(head - oldest);
+        for(uint64_t i = oldest; i < head; i++) {
+            events.push_back(buffer->events[i % RING_CAPACITY]);
+        }
+
+        // The producer kept going while we copied, whatever it may have overwritten is dropped.
+        const uint64_t newHead = buffer->head.load(std::memory_order_acquire);
+        const uint64_t firstValid = newHead > RING_CAPACITY ? newHead - RING_CAPACITY : 0;
+        const size_t skip = static_cast<size_t>(std::min(events.size(), static_cast<size_t>(firstValid > oldest ? firstValid - oldest : 0)));
+
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                first ? "" : ",\n", buffer->threadId, buffer->threadId);
+        first = false;
+
+        for(size_t i = skip; i < events.size(); i++) {
+            const Event& event = events[i];
+            // Timestamps in the trace format are in microseconds
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    event.name, buffer->threadId, static_cast<double>(event.startNs) / 1e3, static_cast<double>(event.endNs - event.startNs) / 1e3);
+            eventCount++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    printf("Wrote %zu cpu zones to %s\n", eventCount, filename.c_str());
+    return true;
+}
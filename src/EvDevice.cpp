@@ -17,19 +17,29 @@ EvDevice::EvDevice(EvDeviceInfo info, EvWindow &window) : window(window), info(s
     createAllocator();
     createCommandPool();
     createDescriptorPool();
+    createPipelineCache();
+    pipelineBuilder = std::make_unique<EvPipelineBuilder>();
 }
 
 EvDevice::~EvDevice() {
+    // Let the builds still running land in the cache before saving it
+    pipelineBuilder.reset();
+    savePipelineCache();
+    printf("Destroying pipeline cache\n");
+    vkDestroyPipelineCache(vkDevice, vkPipelineCache, nullptr);
     printf("Destroying descriptor pool\n");
     vkDestroyDescriptorPool(vkDevice, vkDescriptorPool, nullptr);
     printf("Destroying commandPool\n");
     vkDestroyCommandPool(vkDevice, vkCommandPool, nullptr);
+    vkDestroyCommandPool(vkDevice, vkComputeCommandPool, nullptr);
     printf("Destroying the VMA allocator\n");
     vmaDestroyAllocator(vmaAllocator);
     printf("Destroying logical device\n");
     vkDestroyDevice(vkDevice, nullptr);
-    printf("Destroying surface\n");
-    vkDestroySurfaceKHR(vkInstance, vkSurface, nullptr);
+    if (vkSurface != VK_NULL_HANDLE) {
+        printf("Destroying surface\n");
+        vkDestroySurfaceKHR(vkInstance, vkSurface, nullptr);
+    }
     printf("Destroying instance\n");
     vkDestroyInstance(vkInstance, nullptr);
 }
@@ -40,7 +50,8 @@ void EvDevice::finalizeInfo() {
 #else
     printf("Release build, validation layers disabled.\n");
 #endif
-    info.deviceExtensions.insert(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    // Headless rendering never presents, so it also runs on devices without a swapchain
+    if (!window.headless) info.deviceExtensions.insert(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
     // dedicated allocations
     info.deviceExtensions.insert("VK_KHR_get_memory_requirements2");
     info.deviceExtensions.insert("VK_KHR_dedicated_allocation");
@@ -132,26 +143,50 @@ void EvDevice::createLogicalDevice() {
             queueFamilyIndices.present.value(),
     };
 
+    // A second graphics queue for the post pass when the family has one
+    uint32_t queueFamilyCount;
+    vkGetPhysicalDeviceQueueFamilyProperties(vkPhysicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(vkPhysicalDevice, &queueFamilyCount, queueFamilies.data());
+    const uint32_t graphicsQueueCount = std::min(queueFamilies[queueFamilyIndices.graphics.value()].queueCount, 2u);
+
     queueCreateInfos.reserve(uniqueQueueFamilies.size());
-    float queuePriority = 1.0f;
+    std::array<float, 2> queuePriorities = { 1.0f, 1.0f };
     for(uint queueFamily : uniqueQueueFamilies)
     {
         queueCreateInfos.push_back(VkDeviceQueueCreateInfo {
             .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
             .queueFamilyIndex = queueFamily,
-            .queueCount = 1,
-            .pQueuePriorities = &queuePriority,
+            .queueCount = queueFamily == queueFamilyIndices.graphics.value() ? graphicsQueueCount : 1,
+            .pQueuePriorities = queuePriorities.data(),
         });
     }
 
     VkPhysicalDeviceFeatures deviceFeatures{
+        .multiDrawIndirect = VK_TRUE,
+        .drawIndirectFirstInstance = VK_TRUE,
         .samplerAnisotropy = VK_TRUE,
     };
 
+    // Needed for the bindless texture table
+    VkPhysicalDeviceVulkan12Features vulkan12Features {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        // The meshlet culling decides how many draws there are
+        .drawIndirectCount = VK_TRUE,
+        .descriptorIndexing = VK_TRUE,
+        .shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+        .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+        .descriptorBindingPartiallyBound = VK_TRUE,
+        .runtimeDescriptorArray = VK_TRUE,
+        // Orders the graphics, compute and post submissions of a frame
+        .timelineSemaphore = VK_TRUE,
+    };
+
     std::vector<const char*> devicesExtensions(info.deviceExtensions.begin(), info.deviceExtensions.end());
 
     VkDeviceCreateInfo createInfo {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = &vulkan12Features,
         .queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()),
         .pQueueCreateInfos = queueCreateInfos.data(),
         .enabledExtensionCount = static_cast<uint32_t>(devicesExtensions.size()),
@@ -163,8 +198,13 @@ void EvDevice::createLogicalDevice() {
 
     vkGetDeviceQueue(vkDevice, queueFamilyIndices.compute.value(), 0, &computeQueue);
     vkGetDeviceQueue(vkDevice, queueFamilyIndices.graphics.value(), 0, &graphicsQueue);
+    vkGetDeviceQueue(vkDevice, queueFamilyIndices.graphics.value(), graphicsQueueCount - 1, &postQueue);
     vkGetDeviceQueue(vkDevice, queueFamilyIndices.present.value(), 0, &presentQueue);
 
+    printf("Compute queue family %u, %s\n", queueFamilyIndices.compute.value(),
+           hasSeparateComputeFamily() ? "separate from graphics" : "shared with graphics");
+    printf("Post pass on %s\n", postQueue != graphicsQueue ? "a second graphics queue" : "the graphics queue");
+
 }
 
 void EvDevice::createAllocator() {
@@ -187,6 +227,9 @@ void EvDevice::createCommandPool() {
     };
 
     vkCheck(vkCreateCommandPool(vkDevice, &createInfo, nullptr, &vkCommandPool));
+
+    createInfo.queueFamilyIndex = queueFamilyIndices.compute.value();
+    vkCheck(vkCreateCommandPool(vkDevice, &createInfo, nullptr, &vkComputeCommandPool));
 }
 
 void EvDevice::createDescriptorPool() {
@@ -215,8 +258,91 @@ void EvDevice::createDescriptorPool() {
     vkCheck(vkCreateDescriptorPool(vkDevice, &poolInfo, nullptr, &vkDescriptorPool));
 }
 
+namespace {
+    // Prefixed to the cache data on disk. The blob itself starts with a header carrying the
+    // vendor, device and cache UUID, but not the driver version, so it is kept here as well.
+    struct PipelineCacheFileHeader {
+        uint32_t magic;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint64_t dataSize;
+    };
+
+    constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x45564350; // "EVCP"
+
+    PipelineCacheFileHeader makePipelineCacheFileHeader(const VkPhysicalDeviceProperties& properties, uint64_t dataSize) {
+        PipelineCacheFileHeader header {
+            .magic = PIPELINE_CACHE_MAGIC,
+            .vendorID = properties.vendorID,
+            .deviceID = properties.deviceID,
+            .driverVersion = properties.driverVersion,
+            .dataSize = dataSize,
+        };
+        memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+        return header;
+    }
+}
+
+void EvDevice::createPipelineCache() {
+    // A cache from another device or driver is not an error, it is just ignored
+    std::vector<char> initialData;
+    std::ifstream file(PIPELINE_CACHE_FILE, std::ios::binary);
+    if (file.is_open()) {
+        PipelineCacheFileHeader header{};
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        const auto expected = makePipelineCacheFileHeader(vkPhysicalDeviceProperties, header.dataSize);
+        if (file && memcmp(&header, &expected, sizeof(header)) == 0) {
+            initialData.resize(header.dataSize);
+            file.read(initialData.data(), static_cast<long>(initialData.size()));
+            if (!file) initialData.clear();
+        }
+
+        if (initialData.empty()) {
+            printf("Ignoring %s, it was not written by this device and driver\n", PIPELINE_CACHE_FILE);
+        } else {
+            printf("Loaded %zu bytes of pipeline cache from %s\n", initialData.size(), PIPELINE_CACHE_FILE);
+        }
+    }
+
+    VkPipelineCacheCreateInfo createInfo {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = initialData.size(),
+        .pInitialData = initialData.empty() ? nullptr : initialData.data(),
+    };
+
+    vkCheck(vkCreatePipelineCache(vkDevice, &createInfo, nullptr, &vkPipelineCache));
+}
+
+void EvDevice::savePipelineCache() const {
+    size_t dataSize;
+    vkCheck(vkGetPipelineCacheData(vkDevice, vkPipelineCache, &dataSize, nullptr));
+    std::vector<char> data(dataSize);
+    vkCheck(vkGetPipelineCacheData(vkDevice, vkPipelineCache, &dataSize, data.data()));
+
+    // Written next to the real file and renamed, so a crash never leaves a truncated cache behind
+    const std::string tmpFile = std::string(PIPELINE_CACHE_FILE) + ".tmp";
+    {
+        std::ofstream file(tmpFile, std::ios::binary | std::ios::trunc);
+        const auto header = makePipelineCacheFileHeader(vkPhysicalDeviceProperties, dataSize);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(data.data(), static_cast<long>(dataSize));
+        if (!file) {
+            printf("Could not write %s\n", tmpFile.c_str());
+            return;
+        }
+    }
+
+    if (std::rename(tmpFile.c_str(), PIPELINE_CACHE_FILE) != 0) {
+        printf("Could not replace %s\n", PIPELINE_CACHE_FILE);
+        return;
+    }
+    printf("Saved %zu bytes of pipeline cache to %s\n", dataSize, PIPELINE_CACHE_FILE);
+}
+
 bool EvDevice::isDeviceSuitable(VkPhysicalDevice physicalDevice) const {
-    assert(vkSurface && "Surface should be initialized");
+    assert((vkSurface || window.headless) && "Surface should be initialized");
     auto indices = findQueueFamilies(physicalDevice, vkSurface);
     if (!indices.isComplete()) return false;
 
@@ -224,16 +350,32 @@ bool EvDevice::isDeviceSuitable(VkPhysicalDevice physicalDevice) const {
         return false;
     }
 
-    auto swapchainDetails = querySwapchainSupport(physicalDevice, vkSurface);
-    bool swapchainSuitable = !swapchainDetails.formats.empty() && !swapchainDetails.presentModes.empty();
-    if (!swapchainSuitable) {
-        return false;
+    if (!window.headless) {
+        auto swapchainDetails = querySwapchainSupport(physicalDevice, vkSurface);
+        bool swapchainSuitable = !swapchainDetails.formats.empty() && !swapchainDetails.presentModes.empty();
+        if (!swapchainSuitable) {
+            return false;
+        }
     }
 
-    VkPhysicalDeviceFeatures deviceFeatures{};
-    vkGetPhysicalDeviceFeatures(physicalDevice, &deviceFeatures);
+    VkPhysicalDeviceVulkan12Features vulkan12Features {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+    };
+    VkPhysicalDeviceFeatures2 deviceFeatures2 {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &vulkan12Features,
+    };
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures2);
+    const auto& deviceFeatures = deviceFeatures2.features;
+
+    bool bindlessSupported = vulkan12Features.descriptorIndexing
+            && vulkan12Features.shaderSampledImageArrayNonUniformIndexing
+            && vulkan12Features.descriptorBindingSampledImageUpdateAfterBind
+            && vulkan12Features.descriptorBindingPartiallyBound
+            && vulkan12Features.runtimeDescriptorArray;
 
-    return deviceFeatures.samplerAnisotropy;
+    return deviceFeatures.samplerAnisotropy && deviceFeatures.multiDrawIndirect && deviceFeatures.drawIndirectFirstInstance && bindlessSupported
+        && vulkan12Features.timelineSemaphore && vulkan12Features.drawIndirectCount;
 }
 
 void EvDevice::createDeviceImage(VkImageCreateInfo imageInfo, VkImage *image, VmaAllocation *memory) {
@@ -322,6 +464,22 @@ VkShaderModule EvDevice::createShaderModule(const char* filepath) const {
     return shaderModule;
 }
 
+VkSemaphore EvDevice::createTimelineSemaphore() const {
+    VkSemaphoreTypeCreateInfo typeInfo {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+
+    VkSemaphoreCreateInfo createInfo {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &typeInfo,
+    };
+
+    VkSemaphore semaphore;
+    vkCheck(vkCreateSemaphore(vkDevice, &createInfo, nullptr, &semaphore));
+    return semaphore;
+}
 
 void EvDevice::createHostBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer *buffer, VmaAllocation *bufferMemory) {
     VkBufferCreateInfo bufferInfo {
@@ -363,6 +521,21 @@ void EvDevice::createDeviceBuffer(VkDeviceSize size, void* src, VkBufferUsageFla
     vmaDestroyBuffer(vmaAllocator, stagingBuffer, stagingBufferMemory);
 }
 
+void EvDevice::createDeviceBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer *buffer, VmaAllocation *bufferMemory) {
+    VkBufferCreateInfo bufferInfo {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+
+    VmaAllocationCreateInfo allocInfo {
+        .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+    };
+
+    vkCheck(vmaCreateBuffer(vmaAllocator, &bufferInfo, &allocInfo, buffer, bufferMemory, nullptr));
+}
+
 VkCommandBuffer EvDevice::beginSingleTimeCommands() {
     VkCommandBufferAllocateInfo allocInfo {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
@@ -396,9 +569,10 @@ void EvDevice::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
     vkFreeCommandBuffers(vkDevice, vkCommandPool, 1, &commandBuffer);
 }
 
-void EvDevice::copyBuffer(VkBuffer dstBuffer, VkBuffer srcBuffer, VkDeviceSize size) {
+void EvDevice::copyBuffer(VkBuffer dstBuffer, VkBuffer srcBuffer, VkDeviceSize size, VkDeviceSize dstOffset) {
     VkCommandBuffer commandBuffer = beginSingleTimeCommands();
     VkBufferCopy copyRegion {
+        .dstOffset = dstOffset,
         .size = size,
     };
     vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
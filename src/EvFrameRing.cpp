@@ -0,0 +1,103 @@
+#include "EvFrameRing.h"
+
+EvFrameRing::EvFrameRing(EvDevice &device, VkDeviceSize partitionSize, uint32_t nrPartitions, std::vector<Binding> bindings)
+    : device(device), bindings(std::move(bindings)), partitionSize(partitionSize), nrPartitions(nrPartitions) {
+    assert(nrPartitions > 0);
+    dynamicOffsets.resize(this->bindings.size(), 0);
+
+    createBuffer();
+    createDescriptorSetLayout();
+    createDescriptorSet();
+}
+
+EvFrameRing::~EvFrameRing() {
+    vkDestroyDescriptorSetLayout(device.vkDevice, descriptorSetLayout, nullptr);
+    vmaUnmapMemory(device.vmaAllocator, bufferMemory);
+    vmaDestroyBuffer(device.vmaAllocator, buffer, bufferMemory);
+}
+
+void EvFrameRing::createBuffer() {
+    const auto& limits = device.vkPhysicalDeviceProperties.limits;
+    alignment = std::max(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment);
+    partitionSize = (partitionSize + alignment - 1) / alignment * alignment;
+
+    // A binding always exposes its full range, the slack at the end keeps the window
+    // of an allocation at the end of the last partition inside the buffer.
+    VkDeviceSize maxRange = 0;
+    for(const auto& binding : bindings) {
+        assert(binding.type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC || binding.type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC);
+        assert(binding.type != VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC || binding.range <= limits.maxUniformBufferRange);
+        assert(binding.range <= partitionSize);
+        maxRange = std::max(maxRange, binding.range);
+    }
+
+    device.createHostBuffer(partitionSize * nrPartitions + maxRange, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &buffer, &bufferMemory);
+    vkCheck(vmaMapMemory(device.vmaAllocator, bufferMemory, (void**)&mappedMemory));
+}
+
+void EvFrameRing::createDescriptorSetLayout() {
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings(bindings.size());
+    for(uint32_t i=0; i<bindings.size(); i++) {
+        layoutBindings[i] = vks::initializers::descriptorSetLayoutBinding(bindings[i].type, bindings[i].stageFlags, i);
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = static_cast<uint32_t>(layoutBindings.size()),
+        .pBindings = layoutBindings.data(),
+    };
+
+    vkCheck(vkCreateDescriptorSetLayout(device.vkDevice, &layoutInfo, nullptr, &descriptorSetLayout));
+}
+
+void EvFrameRing::createDescriptorSet() {
+    VkDescriptorSetAllocateInfo allocInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = device.vkDescriptorPool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &descriptorSetLayout,
+    };
+
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, &descriptorSet));
+
+    // Every binding looks at the start of the buffer, the dynamic offsets move the window.
+    std::vector<VkDescriptorBufferInfo> bufferInfos(bindings.size());
+    std::vector<VkWriteDescriptorSet> writes(bindings.size());
+    for(uint32_t i=0; i<bindings.size(); i++) {
+        bufferInfos[i] = VkDescriptorBufferInfo {
+            .buffer = buffer,
+            .offset = 0,
+            .range = bindings[i].range,
+        };
+        writes[i] = vks::initializers::writeDescriptorSet(descriptorSet, bindings[i].type, i, &bufferInfos[i]);
+    }
+
+    vkUpdateDescriptorSets(device.vkDevice, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void* EvFrameRing::allocateBytes(uint32_t binding, VkDeviceSize size) {
+    const VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+    if (offset + size > partitionStart + partitionSize) {
+        throw std::runtime_error("Frame ring partition exhausted");
+    }
+
+    head = offset + size;
+    dynamicOffsets[binding] = static_cast<uint32_t>(offset);
+    return mappedMemory + offset;
+}
+
+void EvFrameRing::beginFrame(uint32_t frameIdx) {
+    assert(frameIdx < nrPartitions);
+    partitionStart = frameIdx * partitionSize;
+    head = partitionStart;
+    std::fill(dynamicOffsets.begin(), dynamicOffsets.end(), static_cast<uint32_t>(partitionStart));
+}
+
+void EvFrameRing::flush() {
+    // no-op on coherent memory
+    vkCheck(vmaFlushAllocation(device.vmaAllocator, bufferMemory, partitionStart, head - partitionStart));
+}
+
+void EvFrameRing::bind(VkCommandBuffer cmdBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set) const {
+    vkCmdBindDescriptorSets(cmdBuffer, bindPoint, layout, set, 1, &descriptorSet, static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
+}
@@ -0,0 +1,152 @@
+#include "EvGeometryArena.h"
+
+EvRangeAllocator::EvRangeAllocator(uint32_t capacity) : capacity(capacity) {
+    freeRanges.insert({0, capacity});
+}
+
+std::optional<uint32_t> EvRangeAllocator::allocate(uint32_t size) {
+    assert(size > 0);
+    for(auto it = freeRanges.begin(); it != freeRanges.end(); it++) {
+        auto [offset, rangeSize] = *it;
+        if (rangeSize < size) continue;
+
+        freeRanges.erase(it);
+        if (rangeSize > size) freeRanges.insert({offset + size, rangeSize - size});
+        return offset;
+    }
+    return std::nullopt;
+}
+
+void EvRangeAllocator::free(uint32_t offset, uint32_t size) {
+    assert(offset + size <= capacity);
+    auto next = freeRanges.lower_bound(offset);
+
+    // merge with the range that ends where this one starts
+    if (next != freeRanges.begin()) {
+        auto prev = std::prev(next);
+        assert(prev->first + prev->second <= offset && "double free");
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            size += prev->second;
+            freeRanges.erase(prev);
+        }
+    }
+
+    // and with the range that starts where this one ends
+    if (next != freeRanges.end()) {
+        assert(offset + size <= next->first && "double free");
+        if (offset + size == next->first) {
+            size += next->second;
+            freeRanges.erase(next);
+        }
+    }
+
+    freeRanges.insert({offset, size});
+}
+
+EvGeometryArena::EvGeometryArena(EvDevice &device, uint32_t maxVertices, uint32_t maxIndices, uint32_t maxMeshlets)
+    : device(device), vertexRanges(maxVertices), indexRanges(maxIndices), shortIndexRanges(maxIndices), meshletRanges(maxMeshlets) {
+    device.createDeviceBuffer(maxVertices * sizeof(PackedVertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, &vertexBuffer, &vertexMemory);
+    device.createDeviceBuffer(maxVertices * sizeof(PackedPosition), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, &positionBuffer, &positionMemory);
+    device.createDeviceBuffer(maxIndices * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, &indexBuffer, &indexMemory);
+    device.createDeviceBuffer(maxIndices * sizeof(uint16_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, &shortIndexBuffer, &shortIndexMemory);
+    device.createDeviceBuffer(maxMeshlets * sizeof(Meshlet), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, &meshletBuffer, &meshletMemory);
+}
+
+EvGeometryArena::~EvGeometryArena() {
+    printf("Destroying geometry arena\n");
+    vmaDestroyBuffer(device.vmaAllocator, meshletBuffer, meshletMemory);
+    vmaDestroyBuffer(device.vmaAllocator, shortIndexBuffer, shortIndexMemory);
+    vmaDestroyBuffer(device.vmaAllocator, indexBuffer, indexMemory);
+    vmaDestroyBuffer(device.vmaAllocator, positionBuffer, positionMemory);
+    vmaDestroyBuffer(device.vmaAllocator, vertexBuffer, vertexMemory);
+}
+
+void EvGeometryArena::upload(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void *data, VkDeviceSize size) {
+    VkBuffer stagingBuffer;
+    VmaAllocation stagingBufferMemory;
+    device.createHostBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, &stagingBuffer, &stagingBufferMemory);
+    void* mapped;
+    vkCheck(vmaMapMemory(device.vmaAllocator, stagingBufferMemory, &mapped));
+    memcpy(mapped, data, static_cast<size_t>(size));
+    vmaUnmapMemory(device.vmaAllocator, stagingBufferMemory);
+
+    device.copyBuffer(dstBuffer, stagingBuffer, size, dstOffset);
+    vmaDestroyBuffer(device.vmaAllocator, stagingBuffer, stagingBufferMemory);
+}
+
+VkIndexType EvGeometryArena::getIndexType(uint32_t vertexCount) {
+    // Primitive restart is never enabled, so every 16 bit value is a vertex
+    return vertexCount <= 0x10000 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+
+EvGeometryArena::Range EvGeometryArena::allocate(std::span<const PackedPosition> positions, std::span<const PackedVertex> vertices, std::span<const uint8_t> indices,
+                                                 std::span<const Meshlet> meshlets) {
+    const VkIndexType indexType = getIndexType(static_cast<uint32_t>(vertices.size()));
+    const size_t indexSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    const uint32_t indexCount = static_cast<uint32_t>(indices.size() / indexSize);
+    assert(!vertices.empty() && positions.size() == vertices.size());
+    assert(indices.size() % indexSize == 0 && "indices not in the index type of the vertex count");
+    assert(indexCount > 0 && indexCount % 3 == 0 && "index count not a multiple of 3");
+    assert(!meshlets.empty());
+
+    auto vertexOffset = vertexRanges.allocate(vertices.size());
+    if (!vertexOffset) {
+        throw std::runtime_error("Geometry arena is out of vertex space");
+    }
+
+    auto& ranges = indexType == VK_INDEX_TYPE_UINT16 ? shortIndexRanges : indexRanges;
+    auto firstIndex = ranges.allocate(indexCount);
+    if (!firstIndex) {
+        vertexRanges.free(*vertexOffset, vertices.size());
+        throw std::runtime_error("Geometry arena is out of index space");
+    }
+
+    auto firstMeshlet = meshletRanges.allocate(meshlets.size());
+    if (!firstMeshlet) {
+        vertexRanges.free(*vertexOffset, vertices.size());
+        ranges.free(*firstIndex, indexCount);
+        throw std::runtime_error("Geometry arena is out of meshlet space");
+    }
+
+    upload(positionBuffer, *vertexOffset * sizeof(PackedPosition), positions.data(), positions.size_bytes());
+    upload(vertexBuffer, *vertexOffset * sizeof(PackedVertex), vertices.data(), vertices.size_bytes());
+    upload(indexType == VK_INDEX_TYPE_UINT16 ? shortIndexBuffer : indexBuffer, *firstIndex * indexSize, indices.data(), indices.size_bytes());
+    upload(meshletBuffer, *firstMeshlet * sizeof(Meshlet), meshlets.data(), meshlets.size_bytes());
+
+    return Range {
+        .vertexOffset = static_cast<int32_t>(*vertexOffset),
+        .vertexCount = static_cast<uint32_t>(vertices.size()),
+        .firstIndex = *firstIndex,
+        .indexCount = indexCount,
+        .indexType = indexType,
+        .firstMeshlet = *firstMeshlet,
+        .meshletCount = static_cast<uint32_t>(meshlets.size()),
+    };
+}
+
+void EvGeometryArena::free(const Range &range) {
+    vertexRanges.free(static_cast<uint32_t>(range.vertexOffset), range.vertexCount);
+    auto& ranges = range.indexType == VK_INDEX_TYPE_UINT16 ? shortIndexRanges : indexRanges;
+    ranges.free(range.firstIndex, range.indexCount);
+    meshletRanges.free(range.firstMeshlet, range.meshletCount);
+}
+
+void EvGeometryArena::bind(VkCommandBuffer commandBuffer) const {
+    const std::array<VkBuffer, 2> buffers = { positionBuffer, vertexBuffer };
+    const std::array<VkDeviceSize, 2> offsets = { 0, 0 };
+    vkCmdBindVertexBuffers(commandBuffer, 0, buffers.size(), buffers.data(), offsets.data());
+}
+
+void EvGeometryArena::bindPositions(VkCommandBuffer commandBuffer) const {
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &positionBuffer, &offset);
+}
+
+void EvGeometryArena::bindIndices(VkCommandBuffer commandBuffer, VkIndexType indexType) const {
+    vkCmdBindIndexBuffer(commandBuffer, indexType == VK_INDEX_TYPE_UINT16 ? shortIndexBuffer : indexBuffer, 0, indexType);
+}
+
+void EvGeometryArena::drawIndirect(VkCommandBuffer commandBuffer, VkBuffer indirectBuffer, uint32_t firstDraw, uint32_t drawCount) const {
+    vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, firstDraw * sizeof(VkDrawIndexedIndirectCommand), drawCount, sizeof(VkDrawIndexedIndirectCommand));
+}
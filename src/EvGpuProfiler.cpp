@@ -0,0 +1,149 @@
+#include "EvGpuProfiler.h"
+
+void EvGpuProfiler::Zone::push(float ms) {
+    history[head] = ms;
+    lastMs = ms;
+    head = (head + 1) % HISTORY_SIZE;
+    samples = std::min(samples + 1, HISTORY_SIZE);
+
+    // Unwritten slots are zero, they do not add to the sum
+    float sum = 0.0f;
+    for(const auto& sample : history) sum += sample;
+    averageMs = sum / static_cast<float>(samples);
+}
+
+EvGpuProfiler::EvGpuProfiler(EvDevice &device, uint32_t nrFrames) : device(device), nrFrames(nrFrames) {
+    assert(nrFrames > 0);
+    frameZones.resize(nrFrames);
+    queueZones[static_cast<uint32_t>(Queue::Graphics)] = Zone { .name = "graphics", .queue = Queue::Graphics };
+    queueZones[static_cast<uint32_t>(Queue::Compute)] = Zone { .name = "compute", .queue = Queue::Compute };
+    queueZones[static_cast<uint32_t>(Queue::Post)] = Zone { .name = "post", .queue = Queue::Post };
+
+    const auto& limits = device.vkPhysicalDeviceProperties.limits;
+    timestampPeriod = limits.timestampPeriod;
+
+    uint32_t queueFamilyCount;
+    vkGetPhysicalDeviceQueueFamilyProperties(device.vkPhysicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device.vkPhysicalDevice, &queueFamilyCount, queueFamilies.data());
+    const uint32_t validBits = std::min(queueFamilies[device.queueFamilyIndices.graphics.value()].timestampValidBits,
+                                        queueFamilies[device.queueFamilyIndices.compute.value()].timestampValidBits);
+    timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+    // Without timestamps every call is a no-op and the overlay shows nothing
+    supported = limits.timestampComputeAndGraphics && validBits > 0;
+    if (!supported) {
+        printf("GPU timestamps not supported, the GPU profiler is disabled\n");
+        return;
+    }
+
+    createQueryPool();
+}
+
+EvGpuProfiler::~EvGpuProfiler() {
+    if (queryPool != VK_NULL_HANDLE) vkDestroyQueryPool(device.vkDevice, queryPool, nullptr);
+}
+
+void EvGpuProfiler::createQueryPool() {
+    VkQueryPoolCreateInfo poolInfo {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = nrFrames * MAX_ZONES * 2,
+    };
+
+    vkCheck(vkCreateQueryPool(device.vkDevice, &poolInfo, nullptr, &queryPool));
+}
+
+uint32_t EvGpuProfiler::findZone(const char *name, Queue queue) {
+    for(uint32_t i=0; i<zones.size(); i++) {
+        if (zones[i].name == name) {
+            // The pyramid runs on either queue
+            zones[i].queue = queue;
+            return i;
+        }
+    }
+
+    zones.push_back(Zone { .name = name, .queue = queue });
+    return static_cast<uint32_t>(zones.size() - 1);
+}
+
+void EvGpuProfiler::readResults(uint32_t frameIdx) {
+    const auto& recorded = frameZones[frameIdx];
+    if (recorded.empty()) return;
+
+    std::array<uint64_t, MAX_ZONES * 2> timestamps{};
+    const uint32_t queryCount = static_cast<uint32_t>(recorded.size() * 2);
+    // No wait flag, the fence of this frame has signaled so the results are there.
+    // Should a driver still disagree the samples are dropped rather than waited for.
+    VkResult result = vkGetQueryPoolResults(device.vkDevice, queryPool, frameIdx * MAX_ZONES * 2, queryCount,
+                                            queryCount * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result == VK_NOT_READY) return;
+    vkCheck(result);
+
+    auto toTicks = [this](uint64_t begin, uint64_t end) {
+        return ((end & timestampMask) - (begin & timestampMask)) & timestampMask;
+    };
+    auto toMs = [this](uint64_t ticks) {
+        return static_cast<float>(static_cast<double>(ticks) * timestampPeriod / 1e6);
+    };
+
+    // A queue runs the zones of a frame in the order they were recorded, so its first zone
+    // begins its span. The last one recorded is not necessarily the last to finish.
+    std::array<std::optional<uint64_t>, QUEUE_COUNT> queueBegins;
+    std::array<uint64_t, QUEUE_COUNT> queueTicks{};
+    for(uint32_t i=0; i<recorded.size(); i++) {
+        const uint32_t queue = static_cast<uint32_t>(recorded[i].queue);
+        if (!queueBegins[queue]) queueBegins[queue] = timestamps[2 * i];
+        const uint64_t queueBegin = queueBegins[queue].value();
+
+        Zone& zone = zones[recorded[i].zone];
+        zone.push(toMs(toTicks(timestamps[2 * i], timestamps[2 * i + 1])));
+        zone.startMs = toMs(toTicks(queueBegin, timestamps[2 * i]));
+        queueTicks[queue] = std::max(queueTicks[queue], toTicks(queueBegin, timestamps[2 * i + 1]));
+    }
+
+    for(uint32_t queue=0; queue<QUEUE_COUNT; queue++) {
+        queueZones[queue].push(toMs(queueTicks[queue]));
+    }
+}
+
+float EvGpuProfiler::getBusiestQueueMs() const {
+    float busiestMs = 0.0f;
+    for(const auto& queueZone : queueZones) busiestMs = std::max(busiestMs, queueZone.lastMs);
+    return busiestMs;
+}
+
+void EvGpuProfiler::beginFrame(VkCommandBuffer cmdBuffer, uint32_t frameIdx) {
+    assert(frameIdx < nrFrames);
+    assert(!zoneOpen && "zone left open in the previous frame");
+    currentFrame = frameIdx;
+    if (!supported) return;
+
+    readResults(frameIdx);
+    frameZones[frameIdx].clear();
+    vkCmdResetQueryPool(cmdBuffer, queryPool, frameIdx * MAX_ZONES * 2, MAX_ZONES * 2);
+}
+
+void EvGpuProfiler::beginZone(VkCommandBuffer cmdBuffer, const char *name, Queue queue) {
+    assert(!zoneOpen && "zones do not nest");
+    if (!supported) return;
+
+    auto& recorded = frameZones[currentFrame];
+    assert(recorded.size() < MAX_ZONES);
+    const uint32_t query = currentFrame * MAX_ZONES * 2 + static_cast<uint32_t>(recorded.size()) * 2;
+    recorded.push_back(RecordedZone { .zone = findZone(name, queue), .queue = queue });
+    zoneOpen = true;
+
+    vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, query);
+}
+
+void EvGpuProfiler::endZone(VkCommandBuffer cmdBuffer) {
+    if (!supported) return;
+    assert(zoneOpen);
+
+    const auto& recorded = frameZones[currentFrame];
+    const uint32_t query = currentFrame * MAX_ZONES * 2 + static_cast<uint32_t>(recorded.size() - 1) * 2 + 1;
+    zoneOpen = false;
+
+    vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, query);
+}
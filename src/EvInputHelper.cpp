@@ -1,7 +1,8 @@
 #include "EvInputHelper.h"
 
 EvInputHelper::EvInputHelper(GLFWwindow *&window) : window(window) {
-    glfwSetInputMode(window, GLFW_STICKY_KEYS, GLFW_TRUE);
+    // There is no window to read keys from in headless mode
+    if (window) glfwSetInputMode(window, GLFW_STICKY_KEYS, GLFW_TRUE);
 
     uint key_size = GLFW_KEY_LAST + 1;
     key_state = std::vector<int>(key_size);
@@ -9,6 +10,7 @@ EvInputHelper::EvInputHelper(GLFWwindow *&window) : window(window) {
 }
 
 void EvInputHelper::swapBuffers() {
+   if (!window) return;
    // Keys below barcode 32 are not in use and generate errors
    for(int i=32; i<key_state.size(); i++) {
        old_key_state[i] = key_state[i];
@@ -1,139 +1,346 @@
 #include "EvMesh.h"
+#include "MeshProcessing.h"
 
-EvMesh::EvMesh(EvDevice &device, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, BoundingBox bb)
-        : device(device), boundingBox(bb) {
-    createVertexBuffer(vertices);
-    createIndexBuffer(indices);
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+EvMeshData::~EvMeshData() {
+    if (mapping) munmap(mapping, mappingSize);
 }
 
-EvMesh::~EvMesh() {
-    // Descriptor sets are destroyed when the pool is destroyed
-    printf("Destroying index buffer\n");
-    vmaDestroyBuffer(device.vmaAllocator, vkIndexBuffer, vkIndexMemory);
+EvMesh::EvMesh(EvGeometryArena &arena, const EvMeshData& data)
+        : arena(arena), lods(data.lods), boundingBox(data.box) {
+    assert(!lods.empty() && "a mesh needs at least its full resolution level");
+    range = arena.allocate(data.positions, data.vertices, data.indices, data.meshlets);
+}
 
-    printf("Destroying vertex buffer\n");
-    vmaDestroyBuffer(device.vmaAllocator, vkVertexBuffer, vkVertexMemory);
+EvMesh::~EvMesh() {
+    arena.free(range);
 }
 
-void EvMesh::loadMesh(const std::string &filename, std::vector<Vertex> *vertices, std::vector<uint32_t> *indices, BoundingBox *box, std::string *diffuseTextureFile, std::string *normalTextureFile) {
-    *box = BoundingBox::InsideOut();
-    tinyobj:: ObjReaderConfig config;
+namespace {
+    // Parses the obj and runs all of the import processing on it. The texture files are the diffuse
+    // and normal map of the last material, when the obj has any.
+    void importMesh(const std::string &filename, std::vector<Vertex> *vertices, std::vector<uint32_t> *indices, std::vector<MeshLod> *lods, std::vector<Meshlet> *meshlets, BoundingBox *box, std::optional<std::pair<std::string, std::string>> *textureFiles) {
+        *box = BoundingBox::InsideOut();
+        tinyobj:: ObjReaderConfig config;
 
-    tinyobj::ObjReader reader;
-    if (!reader.ParseFromFile(filename, config)) {
-        throw std::runtime_error("Tiny obj error: " + reader.Error());
-    }
+        tinyobj::ObjReader reader;
+        if (!reader.ParseFromFile(filename, config)) {
+            throw std::runtime_error("Tiny obj error: " + reader.Error());
+        }
 
-    if (!reader.Warning().empty()) {
-        printf("Tiny obj warning: %s", reader.Warning().c_str());
-    }
+        if (!reader.Warning().empty()) {
+            printf("Tiny obj warning: %s", reader.Warning().c_str());
+        }
 
-    const auto& attrib = reader.GetAttrib();
-    const auto& shapes = reader.GetShapes();
-    const auto& materials = reader.GetMaterials();
+        const auto& attrib = reader.GetAttrib();
+        const auto& shapes = reader.GetShapes();
+        const auto& materials = reader.GetMaterials();
 
-    for(const auto& mat : materials) {
-        if (diffuseTextureFile) *diffuseTextureFile = "./assets/textures/" + mat.diffuse_texname;
-        if (normalTextureFile) *normalTextureFile = "./assets/textures/" + mat.normal_texname;
-    }
+        for(const auto& mat : materials) {
+            *textureFiles = std::make_pair("./assets/textures/" + mat.diffuse_texname, "./assets/textures/" + mat.normal_texname);
+        }
 
-    uint indexHead = 0;
-    std::unordered_map<Vertex, uint32_t> indexMap(50000);
+        uint indexHead = 0;
+        std::unordered_map<Vertex, uint32_t> indexMap(50000);
 
-    for(const auto& shape : shapes) {
-        for(size_t f = 0; f < shape.mesh.num_face_vertices.size(); f++) {
-            assert(shape.mesh.num_face_vertices[f] == 3 && "Plz only triangles for now");
+        for(const auto& shape : shapes) {
+            for(size_t f = 0; f < shape.mesh.num_face_vertices.size(); f++) {
+                assert(shape.mesh.num_face_vertices[f] == 3 && "Plz only triangles for now");
 
-            Vertex triangle[3];
-            for(size_t v = 0; v<3; v++) {
-                const auto& idx = shape.mesh.indices[f * 3 + v];
+                Vertex triangle[3];
+                for(size_t v = 0; v<3; v++) {
+                    const auto& idx = shape.mesh.indices[f * 3 + v];
 
-                glm::vec3 vpos;
-                vpos[0] = attrib.vertices[3 * idx.vertex_index + 0];
-                vpos[1] = attrib.vertices[3 * idx.vertex_index + 1];
-                vpos[2] = attrib.vertices[3 * idx.vertex_index + 2];
+                    glm::vec3 vpos;
+                    vpos[0] = attrib.vertices[3 * idx.vertex_index + 0];
+                    vpos[1] = attrib.vertices[3 * idx.vertex_index + 1];
+                    vpos[2] = attrib.vertices[3 * idx.vertex_index + 2];
 
-                box->consumePoint(vpos);
+                    box->consumePoint(vpos);
 
-                glm::vec2 uv(0.0f);
-                if (idx.texcoord_index != -1) {
-                    uv[0] = attrib.texcoords[2 * idx.texcoord_index + 0];
-                    uv[1] = attrib.texcoords[2 * idx.texcoord_index + 1];
-                }
+                    glm::vec2 uv(0.0f);
+                    if (idx.texcoord_index != -1) {
+                        uv[0] = attrib.texcoords[2 * idx.texcoord_index + 0];
+                        uv[1] = attrib.texcoords[2 * idx.texcoord_index + 1];
+                    }
+
+                    glm::vec3 normal(0.0f, 0.0f, 1.0f);
 
-                glm::vec3 normal(0.0f, 0.0f, 1.0f);
+                    if (idx.normal_index != -1) {
+                        normal[0] = attrib.normals[3 * idx.normal_index + 0];
+                        normal[1] = attrib.normals[3 * idx.normal_index + 1];
+                        normal[2] = attrib.normals[3 * idx.normal_index + 2];
+                    }
 
-                if (idx.normal_index != -1) {
-                    normal[0] = attrib.normals[3 * idx.normal_index + 0];
-                    normal[1] = attrib.normals[3 * idx.normal_index + 1];
-                    normal[2] = attrib.normals[3 * idx.normal_index + 2];
+                    glm::vec3 tangent = glm::make_any_perp(normal);
+                    triangle[v] = Vertex { vpos, uv, normal, tangent };
                 }
 
-                glm::vec3 tangent = glm::make_any_perp(normal);
-                triangle[v] = Vertex { vpos, uv, normal, tangent };
-            }
+                // calculate the tangent if possible
+                {
+                    const auto edge1 = triangle[1].position - triangle[0].position;
+                    const auto edge2 = triangle[2].position - triangle[0].position;
+                    const auto deltaUV1 = triangle[1].uv - triangle[0].uv;
+                    const auto deltaUV2 = triangle[2].uv - triangle[0].uv;
 
-            // calculate the tangent if possible
-            {
-                const auto edge1 = triangle[1].position - triangle[0].position;
-                const auto edge2 = triangle[2].position - triangle[0].position;
-                const auto deltaUV1 = triangle[1].uv - triangle[0].uv;
-                const auto deltaUV2 = triangle[2].uv - triangle[0].uv;
-
-                const float invr = deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y;
-                if (invr > 0.00001f) {
-                    const float r = 1.0f / invr;
-                    const auto tangent = r * (edge1 * deltaUV2.y - edge2 * deltaUV1.y);
-
-                    triangle[0].tangent = tangent;
-                    triangle[1].tangent = tangent;
-                    triangle[2].tangent = tangent;
+                    const float invr = deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y;
+                    if (invr > 0.00001f) {
+                        const float r = 1.0f / invr;
+                        const auto tangent = r * (edge1 * deltaUV2.y - edge2 * deltaUV1.y);
+
+                        triangle[0].tangent = tangent;
+                        triangle[1].tangent = tangent;
+                        triangle[2].tangent = tangent;
+                    }
                 }
-            }
 
-            // insert triangle in the buffers
-            for(const auto& vertex : triangle) {
-                if (indexMap.find(vertex) == indexMap.end()) {
-                    indexMap.insert({vertex, indexHead++});
+                // insert triangle in the buffers
+                for(const auto& vertex : triangle) {
+                    if (indexMap.find(vertex) == indexMap.end()) {
+                        indexMap.insert({vertex, indexHead++});
+                    }
+                    indices->push_back(indexMap[vertex]);
                 }
-                indices->push_back(indexMap[vertex]);
             }
         }
+
+        vertices->resize(indexHead);
+        for(auto [vertex, index] : indexMap) {
+            (*vertices)[index] = vertex;
+        }
+
+        lods->clear();
+        lods->push_back(MeshLod { .firstIndex = 0, .indexCount = static_cast<uint32_t>(indices->size()), .error = 0.0f });
+        generateLods(*vertices, indices, lods);
+
+        // The triangle order of the file is arbitrary, the ratio is reported for the full resolution level
+        const float acmrBefore = computeAcmr(indices->data(), (*lods)[0].indexCount);
+        optimizeVertexCache(indices, *lods, static_cast<uint32_t>(vertices->size()));
+        optimizeVertexFetch(vertices, indices);
+        const float acmrAfter = computeAcmr(indices->data(), (*lods)[0].indexCount);
+        buildMeshlets(*vertices, *indices, lods, meshlets);
+
+        printf("Loaded model %s: Vertices: %lu, Indices: %lu, LODs: %lu, Meshlets: %u, ACMR: %.3f -> %.3f\n", filename.c_str(), vertices->size(), indices->size(), lods->size(), (*lods)[0].meshletCount, acmrBefore, acmrAfter);
     }
 
-    vertices->resize(indexHead);
-    for(auto [vertex, index] : indexMap) {
-        (*vertices)[index] = vertex;
+    // Prefixed to the processed mesh on disk, followed by the sections in the order of the counts:
+    // the packed positions, the packed vertices, the indices in their index type, the levels of detail
+    // and the meshlets, each starting at a multiple of CACHE_SECTION_ALIGNMENT, then the texture names.
+    // A cache is only used when it was written by this version from a source file of the same size and
+    // modification time.
+    struct MeshCacheHeader {
+        uint32_t magic;
+        // Bump whenever the layouts or the import processing change
+        uint32_t version;
+        int64_t sourceModified;
+        uint64_t sourceSize;
+        BoundingBox box;
+        uint32_t vertexCount;
+        uint32_t indexType;
+        uint32_t indexCount;
+        uint32_t lodCount;
+        uint32_t meshletCount;
+        // The obj had a material, the texture names are only written to the outputs then
+        uint32_t hasMaterial;
+        uint32_t diffuseNameLength;
+        uint32_t normalNameLength;
+    };
+
+    constexpr uint32_t MESH_CACHE_MAGIC = 0x45564d43; // "EVMC"
+    constexpr uint32_t MESH_CACHE_VERSION = 2;
+    // The mapping is page aligned, sections at this alignment can be used in place
+    constexpr size_t CACHE_SECTION_ALIGNMENT = 16;
+
+    size_t alignSection(size_t offset) {
+        return (offset + CACHE_SECTION_ALIGNMENT - 1) & ~(CACHE_SECTION_ALIGNMENT - 1);
     }
 
+    size_t getIndexSize(VkIndexType indexType) {
+        return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    }
 
-    printf("Loaded model %s: Vertices: %lu, Indices: %lu\n", filename.c_str(), vertices->size(), indices->size());
-}
+    std::string getMeshCacheFile(const std::string& filename) {
+        // FNV-1a of the path as given, every source gets a file of its own
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for(const char c : filename) {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 0x100000001b3ull;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hash));
+        return std::string(EvMesh::MESH_CACHE_DIR) + "/" + name;
+    }
 
-void EvMesh::createVertexBuffer(const std::vector<Vertex> &vertices) {
-    vertexCount = static_cast<uint32_t>(vertices.size());
-//    assert(vertexCount > 0 && vertexCount % 3 == 0 && "vertexCount not a multiple of 3");
+    MeshCacheHeader makeMeshCacheHeader(const std::string& filename) {
+        return MeshCacheHeader {
+            .magic = MESH_CACHE_MAGIC,
+            .version = MESH_CACHE_VERSION,
+            .sourceModified = static_cast<int64_t>(std::filesystem::last_write_time(filename).time_since_epoch().count()),
+            .sourceSize = static_cast<uint64_t>(std::filesystem::file_size(filename)),
+        };
+    }
 
-    VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
-    device.createDeviceBuffer(bufferSize, (void*)vertices.data(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, &vkVertexBuffer, &vkVertexMemory);
-}
+    // Maps the cache and points the streams of the data into the mapping, the arena copies them from
+    // there into staging. Anything that does not match the source or is cut short is a miss, the mesh
+    // is imported again then.
+    bool readMeshCache(const std::string& cacheFile, const MeshCacheHeader& expected, EvMeshData* data,
+                       std::string *diffuseTextureFile, std::string *normalTextureFile) {
+        const int fd = open(cacheFile.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat fileStat{};
+        if (fstat(fd, &fileStat) != 0 || static_cast<size_t>(fileStat.st_size) < sizeof(MeshCacheHeader)) {
+            close(fd);
+            return false;
+        }
+        const size_t fileSize = static_cast<size_t>(fileStat.st_size);
+        void* mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) return false;
+
+        const auto* bytes = static_cast<const uint8_t*>(mapped);
+        MeshCacheHeader header{};
+        memcpy(&header, bytes, sizeof(header));
+        const auto indexType = static_cast<VkIndexType>(header.indexType);
+
+        // The offsets of the sections, the last one is where the texture names start
+        std::array<size_t, 6> offsets{};
+        offsets[0] = alignSection(sizeof(header));
+        offsets[1] = alignSection(offsets[0] + header.vertexCount * sizeof(PackedPosition));
+        offsets[2] = alignSection(offsets[1] + header.vertexCount * sizeof(PackedVertex));
+        offsets[3] = alignSection(offsets[2] + header.indexCount * getIndexSize(indexType));
+        offsets[4] = alignSection(offsets[3] + header.lodCount * sizeof(MeshLod));
+        offsets[5] = offsets[4] + header.meshletCount * sizeof(Meshlet);
+        const bool valid = header.magic == expected.magic && header.version == expected.version
+                && header.sourceModified == expected.sourceModified && header.sourceSize == expected.sourceSize
+                && header.vertexCount > 0 && indexType == EvGeometryArena::getIndexType(header.vertexCount)
+                && header.lodCount > 0 && header.meshletCount > 0
+                && fileSize == offsets[5] + header.diffuseNameLength + header.normalNameLength;
+        if (!valid) {
+            munmap(mapped, fileSize);
+            return false;
+        }
+
+        data->mapping = mapped;
+        data->mappingSize = fileSize;
+        data->box = header.box;
+        data->positions = { reinterpret_cast<const PackedPosition*>(bytes + offsets[0]), header.vertexCount };
+        data->vertices = { reinterpret_cast<const PackedVertex*>(bytes + offsets[1]), header.vertexCount };
+        data->indices = { bytes + offsets[2], header.indexCount * getIndexSize(indexType) };
+        data->lods.resize(header.lodCount);
+        memcpy(data->lods.data(), bytes + offsets[3], header.lodCount * sizeof(MeshLod));
+        data->meshlets = { reinterpret_cast<const Meshlet*>(bytes + offsets[4]), header.meshletCount };
 
-void EvMesh::createIndexBuffer(const std::vector<uint32_t> &indices) {
-    indicesCount = static_cast<uint32_t>(indices.size());
-    assert(indicesCount > 0 && indicesCount % 3 == 0 && "index count not a multiple of 3");
+        if (header.hasMaterial) {
+            const char* names = reinterpret_cast<const char*>(bytes + offsets[5]);
+            if (diffuseTextureFile) *diffuseTextureFile = std::string(names, header.diffuseNameLength);
+            if (normalTextureFile) *normalTextureFile = std::string(names + header.diffuseNameLength, header.normalNameLength);
+        }
+        return true;
+    }
+
+    void writeMeshCache(const std::string& cacheFile, MeshCacheHeader header, const EvMeshData& data,
+                        const std::optional<std::pair<std::string, std::string>>& textureFiles) {
+        const auto indexType = EvGeometryArena::getIndexType(static_cast<uint32_t>(data.vertices.size()));
+        header.box = data.box;
+        header.vertexCount = static_cast<uint32_t>(data.vertices.size());
+        header.indexType = static_cast<uint32_t>(indexType);
+        header.indexCount = static_cast<uint32_t>(data.indices.size() / getIndexSize(indexType));
+        header.lodCount = static_cast<uint32_t>(data.lods.size());
+        header.meshletCount = static_cast<uint32_t>(data.meshlets.size());
+        header.hasMaterial = textureFiles.has_value();
+        const std::string diffuseName = textureFiles ? textureFiles->first : "";
+        const std::string normalName = textureFiles ? textureFiles->second : "";
+        header.diffuseNameLength = static_cast<uint32_t>(diffuseName.size());
+        header.normalNameLength = static_cast<uint32_t>(normalName.size());
+
+        std::error_code error;
+        std::filesystem::create_directories(EvMesh::MESH_CACHE_DIR, error);
+
+        // Written next to the real file and renamed, so a crash never leaves a truncated cache behind
+        const std::string tmpFile = cacheFile + ".tmp";
+        {
+            std::ofstream file(tmpFile, std::ios::binary | std::ios::trunc);
+            size_t offset = 0;
+            auto writeSection = [&](const void* section, size_t size) {
+                static constexpr char padding[CACHE_SECTION_ALIGNMENT] = {};
+                const size_t aligned = alignSection(offset);
+                file.write(padding, static_cast<long>(aligned - offset));
+                file.write(static_cast<const char*>(section), static_cast<long>(size));
+                offset = aligned + size;
+            };
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            offset = sizeof(header);
+            writeSection(data.positions.data(), data.positions.size_bytes());
+            writeSection(data.vertices.data(), data.vertices.size_bytes());
+            writeSection(data.indices.data(), data.indices.size_bytes());
+            writeSection(data.lods.data(), data.lods.size() * sizeof(MeshLod));
+            writeSection(data.meshlets.data(), data.meshlets.size_bytes());
+            file.write(diffuseName.data(), static_cast<long>(diffuseName.size()));
+            file.write(normalName.data(), static_cast<long>(normalName.size()));
+            if (!file) {
+                printf("Could not write %s\n", tmpFile.c_str());
+                return;
+            }
+        }
 
-    VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-    device.createDeviceBuffer(bufferSize, (void*)indices.data(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, &vkIndexBuffer, &vkIndexMemory);
+        if (std::rename(tmpFile.c_str(), cacheFile.c_str()) != 0) {
+            printf("Could not replace %s\n", cacheFile.c_str());
+        }
+    }
 }
 
-void EvMesh::bind(VkCommandBuffer commandBuffer) {
-    VkBuffer buffers[] = {vkVertexBuffer};
-    VkDeviceSize offsets[] = {0};
+void EvMesh::loadMesh(const std::string &filename, EvMeshData* data, std::string *diffuseTextureFile, std::string *normalTextureFile) {
+    const std::string cacheFile = getMeshCacheFile(filename);
+    const MeshCacheHeader expected = makeMeshCacheHeader(filename);
+    if (readMeshCache(cacheFile, expected, data, diffuseTextureFile, normalTextureFile)) {
+        const size_t indexSize = getIndexSize(EvGeometryArena::getIndexType(static_cast<uint32_t>(data->vertices.size())));
+        printf("Loaded model %s from %s: Vertices: %lu, Indices: %lu, LODs: %lu, Meshlets: %u\n", filename.c_str(), cacheFile.c_str(),
+               data->vertices.size(), data->indices.size() / indexSize, data->lods.size(), data->lods[0].meshletCount);
+        return;
+    }
 
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
-    vkCmdBindIndexBuffer(commandBuffer, vkIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    std::optional<std::pair<std::string, std::string>> textureFiles;
+    importMesh(filename, &vertices, &indices, &data->lods, &data->ownedMeshlets, &data->box, &textureFiles);
+    if (textureFiles) {
+        if (diffuseTextureFile) *diffuseTextureFile = textureFiles->first;
+        if (normalTextureFile) *normalTextureFile = textureFiles->second;
+    }
+
+    // Brought into the layout of the arena once, the cache keeps it in that layout
+    packVertices(vertices, data->box, &data->ownedPositions, &data->ownedVertices);
+    if (EvGeometryArena::getIndexType(static_cast<uint32_t>(vertices.size())) == VK_INDEX_TYPE_UINT16) {
+        const std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+        data->ownedIndices.resize(shortIndices.size() * sizeof(uint16_t));
+        memcpy(data->ownedIndices.data(), shortIndices.data(), data->ownedIndices.size());
+    } else {
+        data->ownedIndices.resize(indices.size() * sizeof(uint32_t));
+        memcpy(data->ownedIndices.data(), indices.data(), data->ownedIndices.size());
+    }
+    data->positions = data->ownedPositions;
+    data->vertices = data->ownedVertices;
+    data->indices = data->ownedIndices;
+    data->meshlets = data->ownedMeshlets;
+
+    writeMeshCache(cacheFile, expected, *data, textureFiles);
+}
+
+void EvMesh::bind(VkCommandBuffer commandBuffer) const {
+    arena.bind(commandBuffer);
+    arena.bindIndices(commandBuffer, range.indexType);
 }
 
 void EvMesh::draw(VkCommandBuffer commandBuffer, uint32_t instanceCount) const {
-    vkCmdDrawIndexed(commandBuffer, indicesCount, instanceCount, 0, 0, 0);
-}
\ No newline at end of file
+    drawLod(commandBuffer, 0, instanceCount);
+}
+
+void EvMesh::drawLod(VkCommandBuffer commandBuffer, uint32_t lod, uint32_t instanceCount, uint32_t firstInstance) const {
+    const MeshLod& level = lods[lod];
+    vkCmdDrawIndexed(commandBuffer, level.indexCount, instanceCount, range.firstIndex + level.firstIndex, range.vertexOffset, firstInstance);
+}
@@ -2,7 +2,8 @@
 
 // sourced from https://vkguide.dev/docs/extra-chapter/implementing_imgui/
 
-EvOverlay::EvOverlay(EvDevice &device, VkRenderPass renderPass, uint32_t nrImages) : device(device) {
+EvOverlay::EvOverlay(EvDevice &device, VkRenderPass renderPass, uint32_t nrImages, const EvGpuProfiler& gpuProfiler)
+    : device(device), gpuProfiler(gpuProfiler) {
     createDescriptorPool();
     initImGui(renderPass, nrImages);
 }
@@ -46,13 +47,15 @@ void EvOverlay::createDescriptorPool() {
 void EvOverlay::initImGui(VkRenderPass renderPass, uint32_t nrImages) {
     ImGui::CreateContext();
 
-    ImGui_ImplGlfw_InitForVulkan(device.window.glfwWindow, true);
+    // Headless mode has no GLFW window, NewFrame feeds imgui the display size itself
+    if (!device.window.headless) ImGui_ImplGlfw_InitForVulkan(device.window.glfwWindow, true);
 
     ImGui_ImplVulkan_InitInfo initInfo {
         .Instance = device.vkInstance,
         .PhysicalDevice = device.vkPhysicalDevice,
         .Device = device.vkDevice,
         .Queue = device.graphicsQueue,
+        .PipelineCache = device.vkPipelineCache,
         .DescriptorPool = imguiPool,
         .MinImageCount = nrImages,
         .ImageCount= nrImages,
@@ -70,20 +73,89 @@ void EvOverlay::initImGui(VkRenderPass renderPass, uint32_t nrImages) {
 
 void EvOverlay::NewFrame() {
     ImGui_ImplVulkan_NewFrame();
-    ImGui_ImplGlfw_NewFrame();
+    if (device.window.headless) {
+        ImGuiIO& io = ImGui::GetIO();
+        io.DisplaySize = ImVec2(static_cast<float>(device.window.width), static_cast<float>(device.window.height));
+        io.DeltaTime = 1.0f / 60.0f;
+    } else {
+        ImGui_ImplGlfw_NewFrame();
+    }
     ImGui::NewFrame();
 
     if (ImGui::Begin("Info")) {
         ImGui::TextUnformatted("test");
         ImGui::Text("fps: %f", uiInfo.fps);
+        if (gpuProfiler.isSupported()) {
+            // Averages over the history, a graph per pass with the average as its overlay
+            // The span of every queue, their timestamps cannot be compared with each other
+            char label[64];
+            char overlayText[48];
+            for(uint32_t queue=0; queue<EvGpuProfiler::QUEUE_COUNT; queue++) {
+                const auto& span = gpuProfiler.getQueueZone(static_cast<EvGpuProfiler::Queue>(queue));
+                snprintf(label, sizeof(label), "gpu %s", span.name.c_str());
+                snprintf(overlayText, sizeof(overlayText), "%.3f ms", span.averageMs);
+                ImGui::PlotLines(label, span.history.data(), EvGpuProfiler::HISTORY_SIZE, span.head, overlayText, 0.0f, FLT_MAX, ImVec2(0, 40));
+            }
+            // The overlay shows when each zone started within its queue, which is marked unless it is graphics
+            for(const auto& zone : gpuProfiler.getZones()) {
+                if (zone.queue == EvGpuProfiler::Queue::Graphics) {
+                    snprintf(label, sizeof(label), "%s", zone.name.c_str());
+                } else {
+                    snprintf(label, sizeof(label), "%s [%s]", zone.name.c_str(), gpuProfiler.getQueueZone(zone.queue).name.c_str());
+                }
+                snprintf(overlayText, sizeof(overlayText), "%.3f ms at %.3f ms", zone.averageMs, zone.startMs);
+                ImGui::PlotLines(label, zone.history.data(), EvGpuProfiler::HISTORY_SIZE, zone.head, overlayText, 0.0f, FLT_MAX, ImVec2(0, 24));
+            }
+        }
+        {
+            // The zones of the previous frame as a flame list, each bar is its share of the frame
+            auto& cpuProfiler = EvCpuProfiler::get();
+            const float frameMs = cpuProfiler.getFrameMs();
+            ImGui::Text("cpu: %.3f ms", frameMs);
+            char label[64];
+            for(const auto& entry : cpuProfiler.getFrameSummary()) {
+                snprintf(label, sizeof(label), "%s %.3f ms", entry.name, entry.ms);
+                ImGui::Indent(static_cast<float>(entry.depth + 1) * 8.0f);
+                ImGui::ProgressBar(frameMs > 0.0f ? entry.ms / frameMs : 0.0f, ImVec2(-1, 0), label);
+                ImGui::Unindent(static_cast<float>(entry.depth + 1) * 8.0f);
+            }
+            if (ImGui::Button("export cpu trace")) cpuProfiler.exportChromeTrace("cpu_trace.json");
+        }
         ImGui::SliderFloat("gravity", &uiInfo.gravity, -10.0f, 10.0f);
         ImGui::SliderFloat("texScale", &uiInfo.floorScale, 0.01f, 10.0f);
         ImGui::SliderFloat("forceField", &uiInfo.forceField, 0, 10);
         ImGui::TextUnformatted("");
         ImGui::SliderFloat("linear", &uiInfo.linear, 0.1f, 10.0f);
         ImGui::SliderFloat("quadratic", &uiInfo.quadratic, 0.1f, 10.0f);
+        ImGui::SliderFloat("light cutoff", &uiInfo.lightCutoff, 0.001f, 1.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
+        ImGui::Text("light upload: %u bytes", uiInfo.lightBytesUploaded);
         ImGui::TextUnformatted("");
         ImGui::Checkbox("bloom", &uiInfo.bloomEnabled);
+        ImGui::Combo("bloom mode", &uiInfo.bloomMode, "pyramid\0gaussian\0gaussian tiled\0gaussian linear\0");
+        ImGui::Checkbox("async compute", &uiInfo.asyncCompute);
+        ImGui::SameLine();
+        ImGui::TextUnformatted(device.hasSeparateComputeFamily() ? "(own queue family)" : "(shares the graphics family)");
+        ImGui::TextUnformatted("");
+        ImGui::Checkbox("occlusion culling", &uiInfo.occlusionCulling);
+        ImGui::Text("instances drawn: %u / %u", uiInfo.drawnInstances, uiInfo.totalInstances);
+        ImGui::Checkbox("meshlet culling", &uiInfo.meshletCulling);
+        if (uiInfo.meshletCulling) ImGui::Text("meshlets drawn: %u / %u", uiInfo.drawnMeshlets, uiInfo.totalMeshlets);
+        ImGui::Text("binds depth: %u forward: %u", uiInfo.depthPassBinds, uiInfo.forwardPassBinds);
+        ImGui::TextUnformatted("");
+        ImGui::Checkbox("mesh lods", &uiInfo.lodEnabled);
+        ImGui::SliderFloat("lod pixel error", &uiInfo.lodPixelError, 0.1f, 10.0f);
+        ImGui::TextUnformatted("");
+        if (gpuProfiler.isSupported()) ImGui::Checkbox("dynamic resolution", &uiInfo.dynamicResolution);
+        if (uiInfo.dynamicResolution) {
+            ImGui::SliderFloat("target gpu ms", &uiInfo.targetGpuMs, 1.0f, 33.0f);
+            ImGui::Text("render scale: %.2f", uiInfo.renderScale);
+        } else {
+            ImGui::SliderFloat("render scale", &uiInfo.renderScale, UIInfo::MIN_RENDER_SCALE, 1.0f);
+        }
+        ImGui::TextUnformatted("");
+        ImGui::Checkbox("merged passes", &uiInfo.mergedPasses);
+        ImGui::SameLine();
+        ImGui::TextUnformatted("(without bloom, occlusion culling or scaling)");
     }
     ImGui::End();
 
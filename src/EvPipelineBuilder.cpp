@@ -0,0 +1,47 @@
+#include "EvPipelineBuilder.h"
+#include "EvCpuProfiler.h"
+
+EvPipelineBuilder::EvPipelineBuilder(uint32_t nrWorkers) {
+    if (nrWorkers == 0) nrWorkers = std::max(1u, std::thread::hardware_concurrency());
+    printf("Building pipelines on %u threads\n", nrWorkers);
+    for(uint32_t i=0; i<nrWorkers; i++) {
+        workers.emplace_back(&EvPipelineBuilder::workerLoop, this);
+    }
+}
+
+EvPipelineBuilder::~EvPipelineBuilder() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+    for(auto& worker : workers) worker.join();
+}
+
+void EvPipelineBuilder::workerLoop() {
+    while (true) {
+        std::packaged_task<VkPipeline()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if (jobs.empty()) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        // Exceptions end up in the future
+        EV_CPU_ZONE("pipeline build");
+        job();
+    }
+}
+
+EvPipelineHandle EvPipelineBuilder::submit(std::function<VkPipeline()> job) {
+    std::packaged_task<VkPipeline()> task(std::move(job));
+    EvPipelineHandle handle = task.get_future().share();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(task));
+    }
+    jobAvailable.notify_one();
+    return handle;
+}
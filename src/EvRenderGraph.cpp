@@ -0,0 +1,402 @@
+#include "EvRenderGraph.h"
+
+namespace {
+    struct UsageState {
+        VkImageLayout layout;
+        VkPipelineStageFlags stages;
+        VkAccessFlags access;
+    };
+
+    constexpr VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+            | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    bool isDepthFormat(VkFormat format) {
+        return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_D32_SFLOAT || format == VK_FORMAT_D16_UNORM_S8_UINT
+            || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+    }
+
+    // Barriers have to name both aspects of a combined depth stencil format
+    VkImageAspectFlags barrierAspects(VkFormat format) {
+        if (!isDepthFormat(format)) return VK_IMAGE_ASPECT_COLOR_BIT;
+        const bool stencil = format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+        return VK_IMAGE_ASPECT_DEPTH_BIT | (stencil ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+    }
+
+    UsageState usageState(EvRenderGraph::Usage usage, bool depth, VkPipelineStageFlags shaderStages) {
+        using Usage = EvRenderGraph::Usage;
+        constexpr VkPipelineStageFlags fragmentTests = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        switch (usage) {
+            case Usage::ColorAttachment:
+                return { VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT };
+            case Usage::DepthAttachment:
+                return { VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, fragmentTests,
+                         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT };
+            case Usage::DepthTest:
+                return { VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, fragmentTests, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT };
+            case Usage::Sampled:
+                // Sampling a depth image does not take it out of the layout the depth test reads it in
+                return { depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, shaderStages, VK_ACCESS_SHADER_READ_BIT };
+            case Usage::Storage:
+                return { VK_IMAGE_LAYOUT_GENERAL, shaderStages, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT };
+            case Usage::TransferSrc:
+                return { VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT };
+            case Usage::TransferDst:
+                return { VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT };
+        }
+        throw std::range_error("Given usage not implemented");
+    }
+
+    VkImageUsageFlags imageUsage(EvRenderGraph::Usage usage) {
+        using Usage = EvRenderGraph::Usage;
+        switch (usage) {
+            case Usage::ColorAttachment: return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+            case Usage::DepthAttachment:
+            case Usage::DepthTest: return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+            case Usage::Sampled: return VK_IMAGE_USAGE_SAMPLED_BIT;
+            case Usage::Storage: return VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+            case Usage::TransferSrc: return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            case Usage::TransferDst: return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
+        throw std::range_error("Given usage not implemented");
+    }
+}
+
+EvRenderGraph::Pass &EvRenderGraph::Pass::read(ResourceId resource, Usage usage) {
+    uses.push_back(Use { .resource = resource, .usage = usage, .finalUsage = usage, .write = false });
+    return *this;
+}
+
+EvRenderGraph::Pass &EvRenderGraph::Pass::write(ResourceId resource, Usage usage, std::optional<Usage> finalUsage) {
+    uses.push_back(Use { .resource = resource, .usage = usage, .finalUsage = finalUsage.value_or(usage), .write = true });
+    return *this;
+}
+
+void EvRenderGraph::Barriers::record(VkCommandBuffer commandBuffer) const {
+    if (images.empty()) return;
+    vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(images.size()), images.data());
+}
+
+void EvRenderGraph::Barriers::add(const VkImageMemoryBarrier &barrier, VkPipelineStageFlags src, VkPipelineStageFlags dst) {
+    images.push_back(barrier);
+    srcStages |= src;
+    dstStages |= dst;
+}
+
+EvRenderGraph::EvRenderGraph(EvDevice &device) : device(device) {
+}
+
+EvRenderGraph::~EvRenderGraph() {
+    destroyImages();
+}
+
+void EvRenderGraph::reset() {
+    destroyImages();
+    compiledPasses.clear();
+    passes.clear();
+    images.clear();
+    resources.clear();
+    submissions.clear();
+}
+
+EvRenderGraph::SubmissionId EvRenderGraph::addSubmission(VkQueue queue, uint32_t queueFamily) {
+    submissions.push_back(Submission { .queue = queue, .queueFamily = queueFamily });
+    return static_cast<SubmissionId>(submissions.size() - 1);
+}
+
+EvRenderGraph::ResourceId EvRenderGraph::createImage(const ImageDesc &desc) {
+    assert(desc.sizeDivisor > 0);
+    images.push_back(Image { .desc = desc, .attachment = {}, .allocation = 0 });
+    resources.push_back(Resource { .name = desc.name, .image = static_cast<uint32_t>(images.size() - 1) });
+    return static_cast<ResourceId>(resources.size() - 1);
+}
+
+EvRenderGraph::ResourceId EvRenderGraph::createVersion(ResourceId resource, const char *name) {
+    assert(resource < resources.size());
+    resources.push_back(Resource { .name = name, .image = resources[resource].image });
+    return static_cast<ResourceId>(resources.size() - 1);
+}
+
+EvRenderGraph::Pass &EvRenderGraph::addPass(const char *name, SubmissionId submission, VkPipelineStageFlags shaderStages, std::function<void(VkCommandBuffer)> record) {
+    assert(submission < submissions.size());
+    assert((passes.empty() || passes.back().submission <= submission) && "passes have to be added in the order of their submissions");
+    passes.push_back(Pass { .name = name, .submission = submission, .shaderStages = shaderStages, .record = std::move(record) });
+    return passes.back();
+}
+
+void EvRenderGraph::compile(VkExtent2D extent) {
+    destroyImages();
+    compiledPasses.clear();
+
+    const std::vector<bool> live = cullPasses();
+    for(uint32_t i=0; i<passes.size(); i++) {
+        if (live[i]) compiledPasses.push_back(CompiledPass { .pass = i });
+        else printf("render graph: culled pass %s\n", passes[i].name);
+    }
+
+    createImages(live, extent);
+    deriveBarriers();
+}
+
+std::vector<bool> EvRenderGraph::cullPasses() const {
+    // Walks back from the passes with side effects, a pass lives when a live pass reads what it writes
+    std::vector<bool> live(passes.size(), false);
+    std::vector<bool> consumed(resources.size(), false);
+    for(size_t i=passes.size(); i-- > 0;) {
+        const Pass& pass = passes[i];
+        live[i] = pass.sideEffects || std::any_of(pass.uses.begin(), pass.uses.end(), [&](const Use& use) {
+            return use.write && consumed[use.resource];
+        });
+        if (!live[i]) continue;
+
+        // Earlier writers of the same resource are only needed if this pass reads it as well
+        for(const Use& use : pass.uses) if (use.write) consumed[use.resource] = false;
+        for(const Use& use : pass.uses) if (!use.write) consumed[use.resource] = true;
+    }
+    return live;
+}
+
+void EvRenderGraph::createImages(const std::vector<bool> &live, VkExtent2D extent) {
+    struct Lifetime {
+        VkImageUsageFlags usage = 0;
+        uint32_t first = std::numeric_limits<uint32_t>::max();
+        uint32_t last = 0;
+        VkQueue queue = VK_NULL_HANDLE;
+        bool singleQueue = true;
+    };
+
+    // Only the uses of live passes count, the images of culled passes are never created
+    std::vector<Lifetime> lifetimes(images.size());
+    for(uint32_t i=0; i<passes.size(); i++) {
+        if (!live[i]) continue;
+        const VkQueue queue = submissions[passes[i].submission].queue;
+        for(const Use& use : passes[i].uses) {
+            Lifetime& lifetime = lifetimes[resources[use.resource].image];
+            lifetime.usage |= imageUsage(use.usage) | imageUsage(use.finalUsage);
+            lifetime.first = std::min(lifetime.first, i);
+            lifetime.last = std::max(lifetime.last, i);
+            if (lifetime.queue != VK_NULL_HANDLE && lifetime.queue != queue) lifetime.singleQueue = false;
+            lifetime.queue = queue;
+        }
+    }
+
+    std::vector<uint32_t> usedImages;
+    std::vector<VkMemoryRequirements> requirements(images.size());
+    for(uint32_t i=0; i<images.size(); i++) {
+        if (lifetimes[i].usage == 0) continue;
+        Image& image = images[i];
+        lifetimes[i].usage |= image.desc.usage;
+        if (image.desc.transient) {
+            assert((lifetimes[i].usage & ~(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT)) == 0
+                   && "a transient image can only be used as an attachment");
+            lifetimes[i].usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        }
+        const uint32_t width = std::max(extent.width / image.desc.sizeDivisor, 1u);
+        const uint32_t height = std::max(extent.height / image.desc.sizeDivisor, 1u);
+        auto imageInfo = vks::initializers::imageCreateInfo(width, height, image.desc.format, lifetimes[i].usage);
+        vkCheck(vkCreateImage(device.vkDevice, &imageInfo, nullptr, &image.attachment.image));
+        vkGetImageMemoryRequirements(device.vkDevice, image.attachment.image, &requirements[i]);
+        image.attachment.format = image.desc.format;
+        usedImages.push_back(i);
+    }
+
+    // Largest first, every image goes into the first allocation that holds nothing alive at the same time.
+    // Only images that stay on one queue share, the passes of different queues have no order to rely on.
+    // Transient images keep to themselves, memory that is only committed on demand is not worth sharing.
+    struct Group {
+        VkMemoryRequirements requirements;
+        std::vector<uint32_t> images;
+        bool shared;
+        bool transient;
+    };
+    std::vector<Group> groups;
+    std::sort(usedImages.begin(), usedImages.end(), [&](uint32_t a, uint32_t b) { return requirements[a].size > requirements[b].size; });
+    for(uint32_t i : usedImages) {
+        const Lifetime& lifetime = lifetimes[i];
+        auto fits = [&](const Group& group) {
+            if (!group.shared || !lifetime.singleQueue || images[i].desc.transient) return false;
+            if ((group.requirements.memoryTypeBits & requirements[i].memoryTypeBits) == 0) return false;
+            return std::none_of(group.images.begin(), group.images.end(), [&](uint32_t other) {
+                const Lifetime& otherLifetime = lifetimes[other];
+                return otherLifetime.queue != lifetime.queue || (otherLifetime.first <= lifetime.last && lifetime.first <= otherLifetime.last);
+            });
+        };
+
+        auto group = std::find_if(groups.begin(), groups.end(), fits);
+        if (group == groups.end()) {
+            const bool transient = images[i].desc.transient;
+            groups.push_back(Group { .requirements = requirements[i], .images = {}, .shared = lifetime.singleQueue && !transient, .transient = transient });
+            group = std::prev(groups.end());
+        }
+        group->requirements.size = std::max(group->requirements.size, requirements[i].size);
+        group->requirements.alignment = std::max(group->requirements.alignment, requirements[i].alignment);
+        group->requirements.memoryTypeBits &= requirements[i].memoryTypeBits;
+        group->images.push_back(i);
+        images[i].allocation = static_cast<uint32_t>(std::distance(groups.begin(), group));
+    }
+
+    VkDeviceSize allocatedSize = 0;
+    VkDeviceSize unaliasedSize = 0;
+    allocations.resize(groups.size());
+    for(size_t g=0; g<groups.size(); g++) {
+        // Tile based GPUs never back the transient images with memory, desktop GPUs fall back to device local
+        VmaAllocationCreateInfo allocInfo {
+            .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+            .preferredFlags = groups[g].transient ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : 0u,
+        };
+        vkCheck(vmaAllocateMemory(device.vmaAllocator, &groups[g].requirements, &allocInfo, &allocations[g], nullptr));
+        allocatedSize += groups[g].requirements.size;
+    }
+
+    for(uint32_t i : usedImages) {
+        Image& image = images[i];
+        // Owned by the graph, shared with the other images of the allocation
+        image.attachment.imageMemory = allocations[image.allocation];
+        vkCheck(vmaBindImageMemory(device.vmaAllocator, image.attachment.imageMemory, image.attachment.image));
+        const VkImageAspectFlags viewAspect = isDepthFormat(image.desc.format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+        auto viewInfo = vks::initializers::imageViewCreateInfo(image.attachment.image, image.desc.format, viewAspect);
+        vkCheck(vkCreateImageView(device.vkDevice, &viewInfo, nullptr, &image.attachment.view));
+        unaliasedSize += requirements[i].size;
+    }
+
+    printf("render graph: %zu of %zu passes, %zu images in %zu allocations, %.1f MB (%.1f MB without aliasing)\n",
+           compiledPasses.size(), passes.size(), usedImages.size(), groups.size(),
+           static_cast<float>(allocatedSize) / (1024.0f * 1024.0f), static_cast<float>(unaliasedSize) / (1024.0f * 1024.0f));
+}
+
+void EvRenderGraph::deriveBarriers() {
+    // What the last live pass left every image and every allocation in
+    struct ImageState {
+        bool used = false;
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags stages = 0;
+        VkAccessFlags writes = 0;
+        SubmissionId submission = 0;
+        size_t compiledPass = 0;
+    };
+    struct AllocationState {
+        VkPipelineStageFlags stages = 0;
+        VkAccessFlags writes = 0;
+    };
+    std::vector<ImageState> imageStates(images.size());
+    std::vector<AllocationState> allocationStates(allocations.size());
+
+    // A pass can name an image more than once through its versions, the first use decides
+    // what it is transitioned to and the last what the pass leaves it in.
+    struct ImageAccess {
+        Usage usage;
+        Usage finalUsage;
+        bool read;
+        bool write;
+    };
+
+    for(size_t c=0; c<compiledPasses.size(); c++) {
+        CompiledPass& compiled = compiledPasses[c];
+        const Pass& pass = passes[compiled.pass];
+        const Submission& submission = submissions[pass.submission];
+
+        std::map<uint32_t, ImageAccess> accesses;
+        for(const Use& use : pass.uses) {
+            const uint32_t imageIdx = resources[use.resource].image;
+            auto [it, inserted] = accesses.insert({imageIdx, ImageAccess { .usage = use.usage, .finalUsage = use.finalUsage, .read = !use.write, .write = use.write }});
+            if (inserted) continue;
+            it->second.finalUsage = use.finalUsage;
+            it->second.read |= !use.write;
+            it->second.write |= use.write;
+        }
+
+        for(const auto& [imageIdx, access] : accesses) {
+            const Image& image = images[imageIdx];
+            const bool depth = isDepthFormat(image.desc.format);
+            const UsageState entry = usageState(access.usage, depth, pass.shaderStages);
+            const UsageState exit = usageState(access.finalUsage, depth, pass.shaderStages);
+            ImageState& state = imageStates[imageIdx];
+            AllocationState& allocationState = allocationStates[image.allocation];
+
+            auto barrier = vks::initializers::imageMemoryBarrier(image.attachment.image, state.layout, entry.layout);
+            barrier.subresourceRange.aspectMask = barrierAspects(image.desc.format);
+            barrier.dstAccessMask = entry.access;
+
+            if (!state.used) {
+                assert(access.write && !access.read && "the first use of an image in a frame has to write it");
+                // The contents are discarded, but the images that had the memory before have to be done with it.
+                // Transient images have their memory to themselves and the render pass discards them.
+                barrier.srcAccessMask = allocationState.writes;
+                if (!image.desc.transient) compiled.before.add(barrier, allocationState.stages ? allocationState.stages : entry.stages, entry.stages);
+            } else {
+                const Submission& previous = submissions[state.submission];
+                if (previous.queue == submission.queue) {
+                    // Reads in the same layout can overlap, anything else waits
+                    if (state.layout != entry.layout || state.writes || access.write) {
+                        barrier.srcAccessMask = state.writes;
+                        compiled.before.add(barrier, state.stages, entry.stages);
+                    }
+                } else if (previous.queueFamily == submission.queueFamily) {
+                    // The semaphore between the queues already made the writes visible, only a new layout is left.
+                    // All commands in the source scope chain it to whatever stage the semaphore is waited at.
+                    if (state.layout != entry.layout) {
+                        compiled.before.add(barrier, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, entry.stages);
+                    }
+                } else {
+                    // Released after the last use on the other family and acquired here, both halves transition
+                    barrier.srcQueueFamilyIndex = previous.queueFamily;
+                    barrier.dstQueueFamilyIndex = submission.queueFamily;
+                    auto release = barrier;
+                    release.srcAccessMask = state.writes;
+                    release.dstAccessMask = 0;
+                    compiledPasses[state.compiledPass].after.add(release, state.stages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+                    compiled.before.add(barrier, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, entry.stages);
+                }
+            }
+
+            state = ImageState {
+                .used = true,
+                .layout = exit.layout,
+                .stages = exit.stages,
+                .writes = access.write ? exit.access & WRITE_ACCESS : 0,
+                .submission = pass.submission,
+                .compiledPass = c,
+            };
+            allocationState = AllocationState { .stages = state.stages, .writes = state.writes };
+        }
+    }
+}
+
+void EvRenderGraph::destroyImages() {
+    for(Image& image : images) {
+        if (image.attachment.image == VK_NULL_HANDLE) continue;
+        vkDestroyImageView(device.vkDevice, image.attachment.view, nullptr);
+        vkDestroyImage(device.vkDevice, image.attachment.image, nullptr);
+        image.attachment = {};
+    }
+    for(VmaAllocation allocation : allocations) vmaFreeMemory(device.vmaAllocator, allocation);
+    allocations.clear();
+}
+
+const EvFrameBufferAttachment &EvRenderGraph::getImage(ResourceId resource) const {
+    assert(resource < resources.size());
+    const Image& image = images[resources[resource].image];
+    assert(image.attachment.image != VK_NULL_HANDLE && "the image is only used by culled passes");
+    return image.attachment;
+}
+
+bool EvRenderGraph::isLive(ResourceId resource) const {
+    assert(resource < resources.size());
+    return images[resources[resource].image].attachment.image != VK_NULL_HANDLE;
+}
+
+bool EvRenderGraph::hasPasses(SubmissionId submission) const {
+    return std::any_of(compiledPasses.begin(), compiledPasses.end(), [&](const CompiledPass& compiled) {
+        return passes[compiled.pass].submission == submission;
+    });
+}
+
+void EvRenderGraph::record(SubmissionId submission, VkCommandBuffer commandBuffer) const {
+    for(const CompiledPass& compiled : compiledPasses) {
+        const Pass& pass = passes[compiled.pass];
+        if (pass.submission != submission) continue;
+        compiled.before.record(commandBuffer);
+        pass.record(commandBuffer);
+        compiled.after.record(commandBuffer);
+    }
+}
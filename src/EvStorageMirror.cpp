@@ -0,0 +1,140 @@
+#include "EvStorageMirror.h"
+
+EvStorageMirror::EvStorageMirror(EvDevice &device, VkDeviceSize elementSize, uint32_t initialCapacity, uint32_t nrCopies, VkShaderStageFlags stageFlags)
+    : device(device), elementSize(elementSize), capacity(initialCapacity), nrCopies(nrCopies), stageFlags(stageFlags) {
+    assert(initialCapacity > 0);
+    assert(nrCopies > 0);
+    dirtyIndices.resize(nrCopies);
+    allDirty.resize(nrCopies, true);
+
+    createBuffer();
+    createDescriptorSetLayout();
+    createDescriptorSet();
+    writeDescriptorSet();
+}
+
+EvStorageMirror::~EvStorageMirror() {
+    vkDestroyDescriptorSetLayout(device.vkDevice, descriptorSetLayout, nullptr);
+    destroyBuffer();
+}
+
+void EvStorageMirror::createBuffer() {
+    const VkDeviceSize alignment = device.vkPhysicalDeviceProperties.limits.minStorageBufferOffsetAlignment;
+    copyStride = (capacity * elementSize + alignment - 1) / alignment * alignment;
+
+    device.createHostBuffer(copyStride * nrCopies, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &buffer, &bufferMemory);
+    vkCheck(vmaMapMemory(device.vmaAllocator, bufferMemory, (void**)&mappedMemory));
+}
+
+void EvStorageMirror::destroyBuffer() {
+    vmaUnmapMemory(device.vmaAllocator, bufferMemory);
+    vmaDestroyBuffer(device.vmaAllocator, buffer, bufferMemory);
+}
+
+void EvStorageMirror::createDescriptorSetLayout() {
+    auto binding = vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, stageFlags, 0);
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 1,
+        .pBindings = &binding,
+    };
+
+    vkCheck(vkCreateDescriptorSetLayout(device.vkDevice, &layoutInfo, nullptr, &descriptorSetLayout));
+}
+
+void EvStorageMirror::createDescriptorSet() {
+    VkDescriptorSetAllocateInfo allocInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = device.vkDescriptorPool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &descriptorSetLayout,
+    };
+
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, &descriptorSet));
+}
+
+void EvStorageMirror::writeDescriptorSet() {
+    // The window covers one copy, the dynamic offset selects which.
+    VkDescriptorBufferInfo bufferInfo {
+        .buffer = buffer,
+        .offset = 0,
+        .range = capacity * elementSize,
+    };
+
+    auto write = vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 0, &bufferInfo);
+    vkUpdateDescriptorSets(device.vkDevice, 1, &write, 0, nullptr);
+}
+
+void EvStorageMirror::grow(uint32_t minCapacity) {
+    // Every copy may still be in use, and the set is rewritten in place.
+    vkCheck(vkDeviceWaitIdle(device.vkDevice));
+    destroyBuffer();
+    capacity = std::max(minCapacity, capacity * 2);
+    createBuffer();
+    writeDescriptorSet();
+    markAllDirty();
+}
+
+void EvStorageMirror::markDirty(uint32_t index) {
+    for(uint32_t i=0; i<nrCopies; i++) {
+        if (!allDirty[i]) dirtyIndices[i].push_back(index);
+    }
+}
+
+void EvStorageMirror::markDirty(uint32_t first, uint32_t count) {
+    for(uint32_t index=first; index<first + count; index++) markDirty(index);
+}
+
+void EvStorageMirror::markAllDirty() {
+    for(uint32_t i=0; i<nrCopies; i++) {
+        allDirty[i] = true;
+        dirtyIndices[i].clear();
+    }
+}
+
+VkDeviceSize EvStorageMirror::sync(uint32_t copyIdx, const void *data, uint32_t count) {
+    assert(copyIdx < nrCopies);
+    if (count > capacity) grow(count);
+
+    dynamicOffset = static_cast<uint32_t>(copyIdx * copyStride);
+    uint8_t* dst = mappedMemory + dynamicOffset;
+    const auto* src = static_cast<const uint8_t*>(data);
+
+    if (allDirty[copyIdx]) {
+        allDirty[copyIdx] = false;
+        dirtyIndices[copyIdx].clear();
+        if (count == 0) return 0;
+        memcpy(dst, src, count * elementSize);
+        vkCheck(vmaFlushAllocation(device.vmaAllocator, bufferMemory, dynamicOffset, count * elementSize));
+        return count * elementSize;
+    }
+
+    auto& indices = dirtyIndices[copyIdx];
+    std::sort(indices.begin(), indices.end());
+
+    // Copy every run of consecutive indices in one go
+    VkDeviceSize bytesWritten = 0;
+    size_t i = 0;
+    while (i < indices.size() && indices[i] < count) {
+        const uint32_t first = indices[i];
+        uint32_t last = first;
+        while (i < indices.size() && indices[i] <= last + 1 && indices[i] < count) {
+            last = std::max(last, indices[i]);
+            i++;
+        }
+
+        const VkDeviceSize offset = first * elementSize;
+        const VkDeviceSize size = (last - first + 1) * elementSize;
+        memcpy(dst + offset, src + offset, size);
+        vkCheck(vmaFlushAllocation(device.vmaAllocator, bufferMemory, dynamicOffset + offset, size));
+        bytesWritten += size;
+    }
+
+    indices.clear();
+    return bytesWritten;
+}
+
+void EvStorageMirror::bind(VkCommandBuffer cmdBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set) const {
+    vkCmdBindDescriptorSets(cmdBuffer, bindPoint, layout, set, 1, &descriptorSet, 1, &dynamicOffset);
+}
@@ -2,18 +2,23 @@
 #include <array>
 #include <utility>
 
-EvSwapchain::EvSwapchain(EvDevice &device) : device(device) {
+EvSwapchain::EvSwapchain(EvDevice &device, uint32_t framesInFlight) : device(device), framesInFlight(framesInFlight) {
+    assert(framesInFlight > 0);
     init();
 }
 
 EvSwapchain::EvSwapchain(EvDevice &device, std::shared_ptr<EvSwapchain> previous)
-    : device(device), oldSwapchain(std::move(previous)) {
+    : device(device), framesInFlight(previous->framesInFlight), oldSwapchain(std::move(previous)) {
     init();
     oldSwapchain.reset();
 }
 
 void EvSwapchain::init() {
-    createSwapchain();
+    if (device.window.headless) {
+        createOffscreenImages();
+    } else {
+        createSwapchain();
+    }
     createImageViews();
     createSyncObjects();
 }
@@ -32,6 +37,13 @@ EvSwapchain::~EvSwapchain() {
     for(const auto& fence : inFlightFences)
         vkDestroyFence(device.vkDevice, fence, nullptr);
 
+    if (device.window.headless) {
+        printf("Destroying offscreen images\n");
+        for(int i=0; i<vkImages.size(); i++)
+            vmaDestroyImage(device.vmaAllocator, vkImages[i], offscreenMemory[i]);
+        return;
+    }
+
     printf("Destroying swapchain\n");
     vkDestroySwapchainKHR(device.vkDevice, vkSwapchain, nullptr);
 }
@@ -81,6 +93,25 @@ void EvSwapchain::createSwapchain() {
     vkGetSwapchainImagesKHR(device.vkDevice, vkSwapchain, &imageCount, nullptr);
     vkImages.resize(imageCount);
     vkGetSwapchainImagesKHR(device.vkDevice, vkSwapchain, &imageCount, vkImages.data());
+    presentLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+}
+
+void EvSwapchain::createOffscreenImages() {
+    // Same format the windowed path prefers, so both run the exact same passes
+    surfaceFormat = VkSurfaceFormatKHR { VK_FORMAT_B8G8R8A8_SRGB, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+    extent = VkExtent2D { static_cast<uint32_t>(device.window.width), static_cast<uint32_t>(device.window.height) };
+    vkSwapchain = VK_NULL_HANDLE;
+    // Left readable by transfers so a frame can be copied out for inspection
+    presentLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+    // One image per frame in flight, the fence of a frame also guards its image
+    vkImages.resize(framesInFlight);
+    offscreenMemory.resize(framesInFlight);
+    for(int i=0; i<framesInFlight; i++) {
+        auto imageInfo = vks::initializers::imageCreateInfo(extent.width, extent.height, surfaceFormat.format,
+                                                            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+        device.createDeviceImage(imageInfo, &vkImages[i], &offscreenMemory[i]);
+    }
 }
 
 void EvSwapchain::createImageViews() {
@@ -92,9 +123,9 @@ void EvSwapchain::createImageViews() {
 }
 
 void EvSwapchain::createSyncObjects() {
-    imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    imageAvailableSemaphores.resize(framesInFlight);
+    renderFinishedSemaphores.resize(framesInFlight);
+    inFlightFences.resize(framesInFlight);
     imagesInFlight.resize(vkImages.size(), VK_NULL_HANDLE);
 
     VkSemaphoreCreateInfo semInfo {
@@ -106,7 +137,7 @@ void EvSwapchain::createSyncObjects() {
         .flags = VK_FENCE_CREATE_SIGNALED_BIT,
     };
 
-    for(int i=0; i<MAX_FRAMES_IN_FLIGHT; i++) {
+    for(int i=0; i<framesInFlight; i++) {
         vkCheck(vkCreateSemaphore(device.vkDevice, &semInfo, nullptr, &imageAvailableSemaphores[i]));
         vkCheck(vkCreateSemaphore(device.vkDevice, &semInfo, nullptr, &renderFinishedSemaphores[i]));
         vkCheck(vkCreateFence(device.vkDevice, &fenceInfo, nullptr, &inFlightFences[i]));
@@ -154,45 +185,75 @@ VkExtent2D EvSwapchain::chooseSwapExtent() const {
 }
 
 VkResult EvSwapchain::acquireNextSwapchainImage(uint32_t *imageIndex) {
-    vkWaitForFences(device.vkDevice, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+    {
+        EV_CPU_ZONE("fence wait");
+        vkWaitForFences(device.vkDevice, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+    }
+    if (device.window.headless) {
+        *imageIndex = currentFrame;
+        return VK_SUCCESS;
+    }
     return vkAcquireNextImageKHR(device.vkDevice, vkSwapchain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, imageIndex);
 }
 
-VkResult EvSwapchain::presentCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+VkResult EvSwapchain::presentCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, EvTimelinePoint wait, EvTimelinePoint signal) {
     if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
         vkWaitForFences(device.vkDevice, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
     }
     imagesInFlight[imageIndex] = inFlightFences[currentFrame];
 
-    std::array<VkSemaphore,1> waitSemaphores = { imageAvailableSemaphores[currentFrame] };
-    std::array<VkPipelineStageFlags,1> waitStages = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    std::array<VkSemaphore,1> signalSemaphores = { renderFinishedSemaphores[currentFrame]};
+    // The binary semaphores only exist with a window, the values of the timeline ones follow
+    // the semaphores and are ignored for the binary ones.
+    const bool headless = device.window.headless;
+    std::array<VkSemaphore,2> waitSemaphores = { wait.semaphore, imageAvailableSemaphores[currentFrame] };
+    std::array<uint64_t,2> waitValues = { wait.value, 0 };
+    // Nothing of the submission may start before the inputs are ready, the timestamps it writes
+    // included: they have to come after the reset of the queries on the graphics queue.
+    std::array<VkPipelineStageFlags,2> waitStages = { VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+    std::array<VkSemaphore,2> signalSemaphores = { signal.semaphore, renderFinishedSemaphores[currentFrame] };
+    std::array<uint64_t,2> signalValues = { signal.value, 0 };
+    const uint32_t semaphoreCount = headless ? 1 : 2;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = semaphoreCount,
+            .pWaitSemaphoreValues = waitValues.data(),
+            .signalSemaphoreValueCount = semaphoreCount,
+            .pSignalSemaphoreValues = signalValues.data(),
+    };
 
     VkSubmitInfo submitInfo {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size()),
+            .pNext = &timelineInfo,
+            .waitSemaphoreCount = semaphoreCount,
             .pWaitSemaphores = waitSemaphores.data(),
             .pWaitDstStageMask = waitStages.data(),
             .commandBufferCount = 1,
             .pCommandBuffers = &commandBuffer,
-            .signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size()),
+            .signalSemaphoreCount = semaphoreCount,
             .pSignalSemaphores = signalSemaphores.data(),
     };
 
     vkResetFences(device.vkDevice, 1, &inFlightFences[currentFrame]);
-    vkCheck(vkQueueSubmit(device.graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]));
+    vkCheck(vkQueueSubmit(device.postQueue, 1, &submitInfo, inFlightFences[currentFrame]));
+
+    if (headless) {
+        // Nothing to present, the fence alone paces the frames
+        currentFrame = (currentFrame + 1) % framesInFlight;
+        return VK_SUCCESS;
+    }
 
     VkPresentInfoKHR presentInfo {
             .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-            .waitSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size()),
-            .pWaitSemaphores = signalSemaphores.data(),
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &renderFinishedSemaphores[currentFrame],
             .swapchainCount = 1,
             .pSwapchains = &vkSwapchain,
             .pImageIndices = &imageIndex,
             .pResults = nullptr,
     };
 
-    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    currentFrame = (currentFrame + 1) % framesInFlight;
     return vkQueuePresentKHR(device.presentQueue, &presentInfo);
 }
 
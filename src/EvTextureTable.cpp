@@ -0,0 +1,91 @@
+#include "EvTextureTable.h"
+
+EvTextureTable::EvTextureTable(EvDevice &device, uint32_t maxTextures) : device(device), maxTextures(maxTextures) {
+    createDescriptorPool();
+    createDescriptorSetLayout();
+    createDescriptorSet();
+}
+
+EvTextureTable::~EvTextureTable() {
+    vkDestroyDescriptorSetLayout(device.vkDevice, descriptorSetLayout, nullptr);
+    vkDestroyDescriptorPool(device.vkDevice, descriptorPool, nullptr);
+}
+
+void EvTextureTable::createDescriptorPool() {
+    VkDescriptorPoolSize poolSize {
+        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = maxTextures,
+    };
+
+    // The shared pool of the device cannot hold update after bind sets
+    VkDescriptorPoolCreateInfo poolInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+        .maxSets = 1,
+        .poolSizeCount = 1,
+        .pPoolSizes = &poolSize,
+    };
+
+    vkCheck(vkCreateDescriptorPool(device.vkDevice, &poolInfo, nullptr, &descriptorPool));
+}
+
+void EvTextureTable::createDescriptorSetLayout() {
+    VkDescriptorSetLayoutBinding binding {
+        .binding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = maxTextures,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+    };
+
+    // Slots that were never written stay empty, and registering a texture does not
+    // have to wait for the command buffers that have the set bound.
+    VkDescriptorBindingFlags bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+        .bindingCount = 1,
+        .pBindingFlags = &bindingFlags,
+    };
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &bindingFlagsInfo,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        .bindingCount = 1,
+        .pBindings = &binding,
+    };
+
+    vkCheck(vkCreateDescriptorSetLayout(device.vkDevice, &layoutInfo, nullptr, &descriptorSetLayout));
+}
+
+void EvTextureTable::createDescriptorSet() {
+    VkDescriptorSetAllocateInfo allocInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptorPool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &descriptorSetLayout,
+    };
+
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, &descriptorSet));
+}
+
+uint32_t EvTextureTable::registerTexture(const EvTexture &texture) {
+    auto it = indices.find(&texture);
+    if (it != indices.end()) return it->second;
+
+    if (indices.size() >= maxTextures) {
+        throw std::runtime_error("Texture table is full");
+    }
+
+    const auto index = static_cast<uint32_t>(indices.size());
+    auto imageInfo = texture.getDescriptorInfo();
+    auto write = vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &imageInfo);
+    write.dstArrayElement = index;
+    vkUpdateDescriptorSets(device.vkDevice, 1, &write, 0, nullptr);
+
+    indices.insert({&texture, index});
+    return index;
+}
+
+void EvTextureTable::bind(VkCommandBuffer cmdBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set) const {
+    vkCmdBindDescriptorSets(cmdBuffer, bindPoint, layout, set, 1, &descriptorSet, 0, nullptr);
+}
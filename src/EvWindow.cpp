@@ -1,7 +1,12 @@
 #include <cstdio>
 #include "EvWindow.h"
 
-EvWindow::EvWindow(int w, int h, std::string name) : width(w), height(h), name(name) {
+EvWindow::EvWindow(int w, int h, std::string name, bool headless) : width(w), height(h), name(name), headless(headless) {
+    if (headless) {
+        glfwWindow = nullptr;
+        return;
+    }
+
     if (!glfwInit()) {
         throw std::runtime_error("Could not initialize GLFW");
     }
@@ -13,16 +18,22 @@ EvWindow::EvWindow(int w, int h, std::string name) : width(w), height(h), name(n
 }
 
 EvWindow::~EvWindow() {
+    if (headless) return;
     printf("Destroying window\n");
     glfwDestroyWindow(glfwWindow);
     glfwTerminate();
 }
 
 void EvWindow::createWindowSurface(VkInstance instance, VkSurfaceKHR *surface) const {
+    if (headless) {
+        *surface = VK_NULL_HANDLE;
+        return;
+    }
     vkCheck(glfwCreateWindowSurface(instance, glfwWindow, nullptr, surface));
 }
 
 void EvWindow::collectInstanceExtensions(std::set<const char *> &instanceExtensions) const {
+    if (headless) return;
     uint extCount = 0;
     const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&extCount);
     for(uint i=0; i<extCount; i++) {
@@ -31,18 +42,24 @@ void EvWindow::collectInstanceExtensions(std::set<const char *> &instanceExtensi
 }
 
 bool EvWindow::shouldClose() const {
-    return glfwWindowShouldClose(glfwWindow);
+    return !headless && glfwWindowShouldClose(glfwWindow);
 }
 
 void EvWindow::processEvents() const {
-    glfwPollEvents();
+    if (!headless) glfwPollEvents();
 }
 
 void EvWindow::waitForEvent() const {
-    glfwWaitEvents();
+    if (!headless) glfwWaitEvents();
 }
 
 void EvWindow::getFramebufferSize(int *width, int *height) const {
+    if (headless) {
+        *width = this->width;
+        *height = this->height;
+        return;
+    }
+
     *width = 0;
     *height = 0;
     do {
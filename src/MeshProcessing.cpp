@@ -0,0 +1,460 @@
+#include "MeshProcessing.h"
+
+#include <array>
+#include <numeric>
+
+namespace {
+    // Sum of squared distances to a set of planes, weighted by triangle area.
+    struct Quadric {
+        double a2 = 0, b2 = 0, c2 = 0, d2 = 0;
+        double ab = 0, ac = 0, ad = 0;
+        double bc = 0, bd = 0, cd = 0;
+        double weight = 0;
+
+        static Quadric fromTriangle(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2) {
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            const float doubleArea = glm::length(normal);
+            if (doubleArea == 0.0f) return Quadric{};
+
+            normal /= doubleArea;
+            const double a = normal.x, b = normal.y, c = normal.z;
+            const double d = -glm::dot(normal, p0);
+            const double w = doubleArea * 0.5;
+            return Quadric {
+                .a2 = w * a * a, .b2 = w * b * b, .c2 = w * c * c, .d2 = w * d * d,
+                .ab = w * a * b, .ac = w * a * c, .ad = w * a * d,
+                .bc = w * b * c, .bd = w * b * d, .cd = w * c * d,
+                .weight = w,
+            };
+        }
+
+        void add(const Quadric& o) {
+            a2 += o.a2; b2 += o.b2; c2 += o.c2; d2 += o.d2;
+            ab += o.ab; ac += o.ac; ad += o.ad;
+            bc += o.bc; bd += o.bd; cd += o.cd;
+            weight += o.weight;
+        }
+
+        // Mean squared distance of p to the planes
+        double evaluate(const glm::vec3& p) const {
+            const double x = p.x, y = p.y, z = p.z;
+            const double sum = a2 * x * x + b2 * y * y + c2 * z * z + d2
+                             + 2.0 * (ab * x * y + ac * x * z + ad * x + bc * y * z + bd * y + cd * z);
+            return std::max(sum, 0.0) / std::max(weight, 1e-12);
+        }
+    };
+
+    struct Collapse {
+        uint32_t from, to;
+        double cost;
+    };
+
+    // Stop generating levels below this many triangles, there is nothing left to gain.
+    const uint32_t MIN_LOD_TRIANGLES = 32;
+
+    void buildTriangleAdjacency(const std::vector<uint32_t>& indices, uint32_t vertexCount, std::vector<uint32_t>* offsets, std::vector<uint32_t>* triangles) {
+        offsets->assign(vertexCount + 1, 0);
+        for(const auto& index : indices) (*offsets)[index + 1]++;
+        std::partial_sum(offsets->begin(), offsets->end(), offsets->begin());
+
+        triangles->resize(indices.size());
+        std::vector<uint32_t> heads(offsets->begin(), offsets->end() - 1);
+        for(uint32_t i=0; i<indices.size(); i++) {
+            (*triangles)[heads[indices[i]]++] = i / 3;
+        }
+    }
+
+    // Folds the lower half of the octahedron over the upper half, decoded by octDecode in vertex.glsl
+    glm::vec2 octEncode(glm::vec3 n) {
+        const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+        if (l1 == 0.0f) return glm::vec2(0.0f);
+        n /= l1;
+        glm::vec2 p(n.x, n.y);
+        if (n.z < 0.0f) {
+            const glm::vec2 signs(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+            p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * signs;
+        }
+        return p;
+    }
+}
+
+void generateLods(const std::vector<Vertex>& vertices, std::vector<uint32_t>* indices, std::vector<MeshLod>* lods, uint32_t maxLods) {
+    assert(lods->size() == 1 && "expected only the full resolution level");
+    const auto vertexCount = static_cast<uint32_t>(vertices.size());
+    const MeshLod base = lods->front();
+    std::vector<uint32_t> current(indices->begin() + base.firstIndex, indices->begin() + base.firstIndex + base.indexCount);
+
+    // Vertices with the same position are the same point on the surface, only split by their attributes.
+    std::vector<uint32_t> positionIds(vertexCount);
+    std::unordered_map<glm::vec3, uint32_t> positionMap(vertexCount);
+    for(uint32_t v=0; v<vertexCount; v++) {
+        auto [it, inserted] = positionMap.insert({vertices[v].position, static_cast<uint32_t>(positionMap.size())});
+        positionIds[v] = it->second;
+    }
+
+    const auto positionCount = static_cast<uint32_t>(positionMap.size());
+    std::vector<uint32_t> wedgeCount(positionCount, 0);
+    for(uint32_t v=0; v<vertexCount; v++) wedgeCount[positionIds[v]]++;
+
+    // Moving a vertex on an attribute seam would tear the seam open.
+    std::vector<char> locked(vertexCount, 0);
+    for(uint32_t v=0; v<vertexCount; v++) {
+        if (wedgeCount[positionIds[v]] > 1) locked[v] = 1;
+    }
+
+    // Moving a vertex on a border or non manifold edge would eat into the outline of the mesh.
+    std::unordered_map<uint64_t, uint32_t> edgeCount(current.size());
+    auto edgeKey = [&](uint32_t a, uint32_t b) {
+        uint64_t pa = positionIds[a], pb = positionIds[b];
+        return pa < pb ? (pa << 32 | pb) : (pb << 32 | pa);
+    };
+    for(uint32_t i=0; i<current.size(); i++) {
+        edgeCount[edgeKey(current[i], current[i - i % 3 + (i + 1) % 3])]++;
+    }
+    for(uint32_t i=0; i<current.size(); i++) {
+        uint32_t a = current[i];
+        uint32_t b = current[i - i % 3 + (i + 1) % 3];
+        if (edgeCount[edgeKey(a, b)] != 2) {
+            locked[a] = 1;
+            locked[b] = 1;
+        }
+    }
+
+    std::vector<Quadric> quadrics(positionCount);
+    for(uint32_t t=0; t<current.size() / 3; t++) {
+        const auto& p0 = vertices[current[t * 3 + 0]].position;
+        const auto& p1 = vertices[current[t * 3 + 1]].position;
+        const auto& p2 = vertices[current[t * 3 + 2]].position;
+        auto quadric = Quadric::fromTriangle(p0, p1, p2);
+        for(uint32_t k=0; k<3; k++) quadrics[positionIds[current[t * 3 + k]]].add(quadric);
+    }
+
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<char> touched(vertexCount);
+    std::vector<uint32_t> triangleOffsets;
+    std::vector<uint32_t> vertexTriangles;
+    std::vector<Collapse> collapses;
+
+    // Rejects collapses that would turn a triangle around the moved vertex inside out.
+    auto flipsTriangles = [&](const Collapse& collapse) {
+        const glm::vec3& target = vertices[collapse.to].position;
+        for(uint32_t i=triangleOffsets[collapse.from]; i<triangleOffsets[collapse.from + 1]; i++) {
+            const uint32_t t = vertexTriangles[i];
+            std::array<uint32_t, 3> tri { current[t * 3 + 0], current[t * 3 + 1], current[t * 3 + 2] };
+
+            // Triangles on the collapsed edge disappear
+            bool onEdge = false;
+            for(const auto& v : tri) onEdge |= positionIds[v] == positionIds[collapse.to];
+            if (onEdge) continue;
+
+            std::array<glm::vec3, 3> before{}, after{};
+            for(uint32_t k=0; k<3; k++) {
+                before[k] = vertices[tri[k]].position;
+                after[k] = tri[k] == collapse.from ? target : before[k];
+            }
+
+            const glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+            const glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+            // Also rejects triangles that would rotate by more than ~75 degrees
+            if (glm::dot(normalBefore, normalAfter) <= 0.25f * glm::length(normalBefore) * glm::length(normalAfter)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    uint32_t triangleTarget = base.indexCount / 3 / 2;
+    float maxError = 0.0f;
+
+    while (lods->size() < maxLods && triangleTarget >= MIN_LOD_TRIANGLES) {
+        const auto triangleCount = static_cast<uint32_t>(current.size() / 3);
+
+        if (triangleCount <= triangleTarget) {
+            lods->push_back(MeshLod {
+                .firstIndex = static_cast<uint32_t>(indices->size()),
+                .indexCount = static_cast<uint32_t>(current.size()),
+                .error = maxError,
+            });
+            indices->insert(indices->end(), current.begin(), current.end());
+            triangleTarget = triangleCount / 2;
+            continue;
+        }
+
+        buildTriangleAdjacency(current, vertexCount, &triangleOffsets, &vertexTriangles);
+
+        // Every edge once, moving whichever end is cheapest
+        collapses.clear();
+        for(uint32_t i=0; i<current.size(); i++) {
+            const uint32_t a = current[i];
+            const uint32_t b = current[i - i % 3 + (i + 1) % 3];
+            if (a > b || (locked[a] && locked[b])) continue;
+
+            Quadric quadric = quadrics[positionIds[a]];
+            quadric.add(quadrics[positionIds[b]]);
+            const double costAB = locked[a] ? std::numeric_limits<double>::infinity() : quadric.evaluate(vertices[b].position);
+            const double costBA = locked[b] ? std::numeric_limits<double>::infinity() : quadric.evaluate(vertices[a].position);
+            collapses.push_back(costAB <= costBA ? Collapse{a, b, costAB} : Collapse{b, a, costBA});
+        }
+
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& l, const Collapse& r) { return l.cost < r.cost; });
+
+        // Perform the cheapest collapses that do not overlap, each one removes about two triangles
+        std::iota(remap.begin(), remap.end(), 0);
+        std::fill(touched.begin(), touched.end(), 0);
+        const uint32_t trianglesToRemove = triangleCount - triangleTarget;
+        uint32_t collapseCount = 0;
+        for(const auto& collapse : collapses) {
+            if (collapseCount * 2 >= trianglesToRemove) break;
+            if (touched[collapse.from] || touched[collapse.to]) continue;
+            if (flipsTriangles(collapse)) continue;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[positionIds[collapse.to]].add(quadrics[positionIds[collapse.from]]);
+            maxError = std::max(maxError, static_cast<float>(std::sqrt(collapse.cost)));
+            collapseCount++;
+
+            // the one ring changed shape, leave it alone for the rest of this pass
+            for(uint32_t i=triangleOffsets[collapse.from]; i<triangleOffsets[collapse.from + 1]; i++) {
+                const uint32_t t = vertexTriangles[i];
+                touched[current[t * 3 + 0]] = 1;
+                touched[current[t * 3 + 1]] = 1;
+                touched[current[t * 3 + 2]] = 1;
+            }
+        }
+
+        if (collapseCount == 0) {
+            // Nothing left that can be collapsed, keep what we got if it is a real reduction
+            const uint32_t previousTriangleCount = lods->back().indexCount / 3;
+            if (triangleCount * 4 < previousTriangleCount * 3) {
+                lods->push_back(MeshLod {
+                    .firstIndex = static_cast<uint32_t>(indices->size()),
+                    .indexCount = static_cast<uint32_t>(current.size()),
+                    .error = maxError,
+                });
+                indices->insert(indices->end(), current.begin(), current.end());
+            }
+            break;
+        }
+
+        uint32_t write = 0;
+        for(uint32_t t=0; t<triangleCount; t++) {
+            const uint32_t a = remap[current[t * 3 + 0]];
+            const uint32_t b = remap[current[t * 3 + 1]];
+            const uint32_t c = remap[current[t * 3 + 2]];
+            if (positionIds[a] == positionIds[b] || positionIds[b] == positionIds[c] || positionIds[a] == positionIds[c]) continue;
+            current[write++] = a;
+            current[write++] = b;
+            current[write++] = c;
+        }
+        current.resize(write);
+    }
+}
+
+void packVertices(const std::vector<Vertex>& vertices, const BoundingBox& bounds,
+                  std::vector<PackedPosition>* positions, std::vector<PackedVertex>* packed) {
+    // Flat meshes have an axis without extent, everything on it decodes to the minimum
+    const glm::vec3 extent = bounds.vmax - bounds.vmin;
+    const glm::vec3 invExtent = glm::vec3(
+        extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+        extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+        extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+    positions->resize(vertices.size());
+    packed->resize(vertices.size());
+    for(size_t i=0; i<vertices.size(); i++) {
+        const Vertex& vertex = vertices[i];
+        const glm::vec3 t = glm::clamp((vertex.position - bounds.vmin) * invExtent, 0.0f, 1.0f);
+        (*positions)[i] = PackedPosition {
+            .position = glm::u16vec4(glm::round(t * 65535.0f), 0),
+        };
+        (*packed)[i] = PackedVertex {
+            .uv = glm::packHalf2x16(vertex.uv),
+            .normal = glm::packSnorm2x16(octEncode(vertex.normal)),
+            .tangent = glm::packSnorm2x16(octEncode(vertex.tangent)),
+        };
+    }
+}
+
+namespace {
+    // Tipsify on a single level, indices are written back in the new order
+    void tipsify(uint32_t* indices, uint32_t indexCount, uint32_t vertexCount, uint32_t cacheSize) {
+        const std::vector<uint32_t> input(indices, indices + indexCount);
+        std::vector<uint32_t> offsets, adjacency;
+        buildTriangleAdjacency(input, vertexCount, &offsets, &adjacency);
+
+        std::vector<uint32_t> liveTriangles(vertexCount);
+        for(uint32_t v=0; v<vertexCount; v++) liveTriangles[v] = offsets[v + 1] - offsets[v];
+
+        // Time at which a vertex last entered the cache, it is still in there while now - cacheTime <= cacheSize
+        std::vector<uint32_t> cacheTime(vertexCount, 0);
+        uint32_t now = cacheSize + 1;
+        std::vector<bool> emitted(indexCount / 3, false);
+        std::vector<uint32_t> deadEnds;
+        std::vector<uint32_t> candidates;
+        uint32_t cursor = 0;
+        uint32_t written = 0;
+
+        int64_t fan = indexCount > 0 ? input[0] : -1;
+        while (fan >= 0) {
+            candidates.clear();
+            for(uint32_t a=offsets[fan]; a<offsets[fan + 1]; a++) {
+                const uint32_t triangle = adjacency[a];
+                if (emitted[triangle]) continue;
+                emitted[triangle] = true;
+
+                for(uint32_t c=0; c<3; c++) {
+                    const uint32_t v = input[triangle * 3 + c];
+                    indices[written++] = v;
+                    deadEnds.push_back(v);
+                    candidates.push_back(v);
+                    liveTriangles[v]--;
+                    if (now - cacheTime[v] > cacheSize) cacheTime[v] = now++;
+                }
+            }
+
+            // The candidate that stays in the cache for all of its remaining triangles and
+            // entered it the longest ago, otherwise the first one that still has triangles left.
+            fan = -1;
+            int64_t best = -1;
+            for(const uint32_t v : candidates) {
+                if (liveTriangles[v] == 0) continue;
+                int64_t priority = 0;
+                if (now - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) priority = now - cacheTime[v];
+                if (priority > best) {
+                    best = priority;
+                    fan = v;
+                }
+            }
+            if (fan >= 0) continue;
+
+            while (!deadEnds.empty()) {
+                const uint32_t v = deadEnds.back();
+                deadEnds.pop_back();
+                if (liveTriangles[v] > 0) {
+                    fan = v;
+                    break;
+                }
+            }
+            while (fan < 0 && cursor < vertexCount) {
+                if (liveTriangles[cursor] > 0) fan = cursor;
+                cursor++;
+            }
+        }
+        assert(written == indexCount);
+    }
+}
+
+void optimizeVertexCache(std::vector<uint32_t>* indices, const std::vector<MeshLod>& lods, uint32_t vertexCount) {
+    for(const auto& lod : lods) {
+        tipsify(indices->data() + lod.firstIndex, lod.indexCount, vertexCount, VERTEX_CACHE_SIZE);
+    }
+}
+
+void optimizeVertexFetch(std::vector<Vertex>* vertices, std::vector<uint32_t>* indices) {
+    constexpr uint32_t unused = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(vertices->size(), unused);
+    std::vector<Vertex> reordered;
+    reordered.reserve(vertices->size());
+
+    for(auto& index : *indices) {
+        if (remap[index] == unused) {
+            remap[index] = static_cast<uint32_t>(reordered.size());
+            reordered.push_back((*vertices)[index]);
+        }
+        index = remap[index];
+    }
+    *vertices = std::move(reordered);
+}
+
+float computeAcmr(const uint32_t* indices, uint32_t indexCount, uint32_t cacheSize) {
+    if (indexCount == 0) return 0.0f;
+    std::deque<uint32_t> cache;
+    uint32_t misses = 0;
+    for(uint32_t i=0; i<indexCount; i++) {
+        if (std::find(cache.begin(), cache.end(), indices[i]) != cache.end()) continue;
+        misses++;
+        cache.push_back(indices[i]);
+        if (cache.size() > cacheSize) cache.pop_front();
+    }
+    return static_cast<float>(misses) / static_cast<float>(indexCount / 3);
+}
+
+namespace {
+    Meshlet computeMeshletBounds(const std::vector<Vertex>& vertices, const uint32_t* indices, uint32_t firstIndex, uint32_t indexCount) {
+        BoundingBox box = BoundingBox::InsideOut();
+        for(uint32_t i=0; i<indexCount; i++) box.consumePoint(vertices[indices[i]].position);
+        const glm::vec3 center = box.getCenter();
+        float radius = 0.0f;
+        for(uint32_t i=0; i<indexCount; i++) radius = std::max(radius, glm::distance(center, vertices[indices[i]].position));
+
+        // The cone of all triangle normals around their average. Counter clockwise is the front.
+        std::vector<glm::vec3> normals;
+        normals.reserve(indexCount / 3);
+        glm::vec3 axis(0.0f);
+        for(uint32_t i=0; i<indexCount; i+=3) {
+            const glm::vec3& p0 = vertices[indices[i + 0]].position;
+            const glm::vec3& p1 = vertices[indices[i + 1]].position;
+            const glm::vec3& p2 = vertices[indices[i + 2]].position;
+            const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            const float length = glm::length(normal);
+            if (length == 0.0f) continue;
+            normals.push_back(normal / length);
+            axis += normals.back();
+        }
+
+        glm::vec4 cone(0.0f, 0.0f, 0.0f, 1.0f);
+        const float axisLength = glm::length(axis);
+        if (axisLength > 0.0f) {
+            axis /= axisLength;
+            float minDot = 1.0f;
+            for(const auto& normal : normals) minDot = std::min(minDot, glm::dot(normal, axis));
+            // Cones wider than a hemisphere, or nearly so, always have a triangle facing the camera
+            if (minDot > 0.1f) cone = glm::vec4(axis, std::sqrt(1.0f - minDot * minDot));
+        }
+
+        return Meshlet {
+            .sphere = glm::vec4(center, radius),
+            .cone = cone,
+            .firstIndex = firstIndex,
+            .indexCount = indexCount,
+        };
+    }
+}
+
+void buildMeshlets(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+                   std::vector<MeshLod>* lods, std::vector<Meshlet>* meshlets) {
+    // Slot of a vertex in the meshlet that is being built, stamped with that meshlet
+    std::vector<uint32_t> stamp(vertices.size(), std::numeric_limits<uint32_t>::max());
+
+    meshlets->clear();
+    for(auto& lod : *lods) {
+        lod.firstMeshlet = static_cast<uint32_t>(meshlets->size());
+        const uint32_t* levelIndices = indices.data() + lod.firstIndex;
+
+        uint32_t start = 0;
+        while (start < lod.indexCount) {
+            const uint32_t id = static_cast<uint32_t>(meshlets->size());
+            uint32_t vertexCount = 0;
+            uint32_t end = start;
+            while (end < lod.indexCount && (end - start) / 3 < MESHLET_MAX_TRIANGLES) {
+                uint32_t newVertices = 0;
+                for(uint32_t c=0; c<3; c++) {
+                    if (stamp[levelIndices[end + c]] != id) newVertices++;
+                }
+                // A triangle can share a vertex with itself only when degenerate, counting it twice is conservative
+                if (vertexCount + newVertices > MESHLET_MAX_VERTICES) break;
+                for(uint32_t c=0; c<3; c++) {
+                    if (stamp[levelIndices[end + c]] != id) {
+                        stamp[levelIndices[end + c]] = id;
+                        vertexCount++;
+                    }
+                }
+                end += 3;
+            }
+
+            meshlets->push_back(computeMeshletBounds(vertices, levelIndices + start, start, end - start));
+            start = end;
+        }
+        lod.meshletCount = static_cast<uint32_t>(meshlets->size()) - lod.firstMeshlet;
+    }
+}
@@ -19,6 +19,7 @@ void PhysicsSystem::Update(float forceField) {
     world->update(1.0f / 60.0f);
 
     std::vector<Entity> killList{};
+    movedEntities.clear();
 
     for(const auto& entity : m_entities) {
         auto& physicsComp = m_coordinator->GetComponent<PhysicsComponent>(entity);
@@ -31,9 +32,12 @@ void PhysicsSystem::Update(float forceField) {
             transform.getOpenGLMatrix((float*)physicsComp.transformResult);
         }
 
+        bool moved = false;
         for(const auto& listener : physicsComp.positionListeners) {
+            moved |= *listener != worldPoint;
             *listener = worldPoint;
         }
+        if (moved) movedEntities.push_back(entity);
 
         if (distFromOrigin > 100) {
             killList.push_back(entity);
@@ -1,44 +1,106 @@
 #include "RenderPasses/BloomPass.h"
 
-BloomPass::BloomPass(EvDevice &device, uint32_t width, uint32_t height, uint32_t nrImages,
-                     const std::vector<EvFrameBufferAttachment> &inputs)
-                     : device(device), bloomAttachments(inputs) {
-    createFramebuffer(width, height, nrImages, inputs);
+namespace {
+    // Named after the resolution each step writes, relative to the input
+    constexpr std::array<const char*, BloomPass::PYRAMID_LEVELS> DOWN_ZONES {
+        "bloom down 1/2", "bloom down 1/4", "bloom down 1/8", "bloom down 1/16", "bloom down 1/32", "bloom down 1/64",
+    };
+    constexpr std::array<const char*, BloomPass::PYRAMID_LEVELS - 1> UP_ZONES {
+        "bloom up 1/2", "bloom up 1/4", "bloom up 1/8", "bloom up 1/16", "bloom up 1/32",
+    };
+
+    constexpr float BLUR_SIGMA = 8.0f;
+
+    // Weight of the taps at distance 0 to BLUR_RADIUS, left unnormalized like blur.comp computes them
+    std::array<float, BloomPass::BLUR_RADIUS + 1> gaussianWeights() {
+        std::array<float, BloomPass::BLUR_RADIUS + 1> weights;
+        for(uint32_t d=0; d<weights.size(); d++) {
+            const float x = static_cast<float>(d);
+            weights[d] = 1.0f / std::sqrt(2.0f * PI * BLUR_SIGMA * BLUR_SIGMA) * std::exp(-(x * x) / (2.0f * BLUR_SIGMA * BLUR_SIGMA));
+        }
+        return weights;
+    }
+
+    // Specialization constants of blur_linear.comp
+    struct MergedTaps {
+        float centerWeight;
+        std::array<float, BloomPass::BLUR_MERGED_TAPS> weights;
+        std::array<float, BloomPass::BLUR_MERGED_TAPS> offsets;
+    };
+
+    // Taps 2i+1 and 2i+2 become a single fetch in between them, sampling at the
+    // ratio of their weights. Past the radius the second tap has weight zero.
+    MergedTaps mergeTaps(const std::array<float, BloomPass::BLUR_RADIUS + 1>& weights) {
+        MergedTaps merged { .centerWeight = weights[0] };
+        for(uint32_t i=0; i<BloomPass::BLUR_MERGED_TAPS; i++) {
+            const uint32_t d1 = 2 * i + 1;
+            const uint32_t d2 = 2 * i + 2;
+            const float w1 = weights[d1];
+            const float w2 = d2 <= BloomPass::BLUR_RADIUS ? weights[d2] : 0.0f;
+            merged.weights[i] = w1 + w2;
+            merged.offsets[i] = (static_cast<float>(d1) * w1 + static_cast<float>(d2) * w2) / (w1 + w2);
+        }
+        return merged;
+    }
+}
+
+BloomPass::BloomPass(EvDevice &device, uint32_t width, uint32_t height, const EvFrameBufferAttachment &input, std::optional<GaussianImages> tmpImages)
+                     : device(device), bloomAttachment(input) {
+    createFramebuffer(width, height, tmpImages);
+    createPyramid(width, height);
     createDescriptorSetLayout();
     createPipelineLayout();
+    createLinearSampler();
     createPipeline();
-    allocateDescriptorSets(nrImages);
-    createDescriptorSets(nrImages, inputs);
+    createBlurVariantPipelines();
+    createPyramidPipelines();
+    allocateDescriptorSets();
+    createDescriptorSets();
+    createPyramidDescriptorSets();
 }
 
 BloomPass::~BloomPass() {
-    framebuffer.destroy(device);
+    vkDestroyPipeline(device.vkDevice, pipeline.get(), nullptr);
+    vkDestroyPipeline(device.vkDevice, tiledPipeline.get(), nullptr);
+    vkDestroyPipeline(device.vkDevice, linearPipeline.get(), nullptr);
+    vkDestroyPipeline(device.vkDevice, downPipeline.get(), nullptr);
+    vkDestroyPipeline(device.vkDevice, upPipeline.get(), nullptr);
+    pyramid.destroy(device);
     vkDestroyShaderModule(device.vkDevice, compShader, nullptr);
+    vkDestroyShaderModule(device.vkDevice, tiledShader, nullptr);
+    vkDestroyShaderModule(device.vkDevice, linearShader, nullptr);
+    vkDestroyShaderModule(device.vkDevice, downShader, nullptr);
+    vkDestroyShaderModule(device.vkDevice, upShader, nullptr);
+    vkDestroySampler(device.vkDevice, linearSampler, nullptr);
     vkDestroyDescriptorSetLayout(device.vkDevice, descriptorSetLayout, nullptr);
-    vkDestroyPipeline(device.vkDevice, pipeline, nullptr);
+    vkDestroyDescriptorSetLayout(device.vkDevice, pyramidSetLayout, nullptr);
     vkDestroyPipelineLayout(device.vkDevice, pipelineLayout, nullptr);
+    vkDestroyPipelineLayout(device.vkDevice, pyramidPipelineLayout, nullptr);
 }
 
-void BloomPass::createFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages, const std::vector<EvFrameBufferAttachment> &inputs) {
-    assert(nrImages > 0);
-    assert(inputs.size() == nrImages);
-
+void BloomPass::createFramebuffer(uint32_t width, uint32_t height, std::optional<GaussianImages> tmpImages) {
     framebuffer.width = width / 2;
     framebuffer.height = height / 2;
+    framebuffer.tmpImages = tmpImages;
+}
 
-    framebuffer.tmpImages.resize(nrImages*2);
-    framebuffer.tmpImageMemory.resize(nrImages*2);
-    framebuffer.tmpImageViews.resize(nrImages*2);
-    auto format = inputs[0].format;
-    for(int i=0; i<nrImages*2; i++) {
-        auto imageInfo = vks::initializers::imageCreateInfo(width / 2, height / 2, format, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
-        device.createDeviceImage(imageInfo, &framebuffer.tmpImages[i], &framebuffer.tmpImageMemory[i]);
-        if (i < nrImages)
-            device.transitionImageLayout(framebuffer.tmpImages[i], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, 1);
-        else
-            device.transitionImageLayout(framebuffer.tmpImages[i], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1, 1);
-        auto viewInfo = vks::initializers::imageViewCreateInfo(framebuffer.tmpImages[i], format, VK_IMAGE_ASPECT_COLOR_BIT);
-        vkCheck(vkCreateImageView(device.vkDevice, &viewInfo, nullptr, &framebuffer.tmpImageViews[i]));
+void BloomPass::createPyramid(uint32_t width, uint32_t height) {
+    pyramid.width = std::max(width / 2, 1u);
+    pyramid.height = std::max(height / 2, 1u);
+    // Tiny windows run out of levels before 1/64
+    const uint32_t maxLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(pyramid.width, pyramid.height)))) + 1;
+    pyramid.levels = std::min(PYRAMID_LEVELS, maxLevels);
+
+    auto format = bloomAttachment.format;
+    auto imageInfo = vks::initializers::imageCreateInfo(pyramid.width, pyramid.height, format, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+    imageInfo.mipLevels = pyramid.levels;
+    device.createDeviceImage(imageInfo, &pyramid.image, &pyramid.imageMemory);
+    device.transitionImageLayout(pyramid.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, pyramid.levels, 1);
+
+    for(uint32_t level=0; level<pyramid.levels; level++) {
+        auto mipViewInfo = vks::initializers::imageViewCreateInfo(pyramid.image, format, VK_IMAGE_ASPECT_COLOR_BIT);
+        mipViewInfo.subresourceRange.baseMipLevel = level;
+        vkCheck(vkCreateImageView(device.vkDevice, &mipViewInfo, nullptr, &pyramid.mipViews[level]));
     }
 }
 
@@ -66,6 +128,29 @@ void BloomPass::createDescriptorSetLayout() {
     };
 
     vkCheck(vkCreateDescriptorSetLayout(device.vkDevice, &layoutInfo, nullptr, &descriptorSetLayout));
+
+    std::array<VkDescriptorSetLayoutBinding, 2> pyramidBindings {
+        VkDescriptorSetLayoutBinding {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        VkDescriptorSetLayoutBinding {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+    };
+
+    VkDescriptorSetLayoutCreateInfo pyramidLayoutInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = static_cast<uint32_t>(pyramidBindings.size()),
+        .pBindings = pyramidBindings.data(),
+    };
+
+    vkCheck(vkCreateDescriptorSetLayout(device.vkDevice, &pyramidLayoutInfo, nullptr, &pyramidSetLayout));
 }
 
 void BloomPass::createPipelineLayout() {
@@ -84,37 +169,139 @@ void BloomPass::createPipelineLayout() {
     };
 
     vkCheck(vkCreatePipelineLayout(device.vkDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout));
+
+    VkPushConstantRange pyramidPushRange {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(PyramidPush),
+    };
+
+    VkPipelineLayoutCreateInfo pyramidLayoutInfo {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &pyramidSetLayout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pyramidPushRange,
+    };
+
+    vkCheck(vkCreatePipelineLayout(device.vkDevice, &pyramidLayoutInfo, nullptr, &pyramidPipelineLayout));
 }
 
 void BloomPass::createPipeline() {
-    compShader = device.createShaderModule("assets/shaders_bin/blur.comp.spv");
+    pipeline = device.pipelineBuilder->submit([this]() {
+        compShader = device.createShaderModule("assets/shaders_bin/blur.comp.spv");
+
+        auto compPipelineInfo = vks::initializers::computePipelineCreateInfo(pipelineLayout);
+        compPipelineInfo.stage = vks::initializers::pipelineShaderStageCreateInfo(compShader, VK_SHADER_STAGE_COMPUTE_BIT);
 
-    auto compPipelineInfo = vks::initializers::computePipelineCreateInfo(pipelineLayout);
-    compPipelineInfo.stage = vks::initializers::pipelineShaderStageCreateInfo(compShader, VK_SHADER_STAGE_COMPUTE_BIT);
+        VkPipeline vkPipeline;
+        vkCheck(vkCreateComputePipelines(device.vkDevice, device.vkPipelineCache, 1, &compPipelineInfo, nullptr, &vkPipeline));
+        return vkPipeline;
+    });
+}
+
+void BloomPass::createBlurVariantPipelines() {
+    tiledPipeline = device.pipelineBuilder->submit([this]() {
+        tiledShader = device.createShaderModule("assets/shaders_bin/blur_tiled.comp.spv");
+
+        const auto weights = gaussianWeights();
+        std::array<VkSpecializationMapEntry, BLUR_RADIUS + 1> mapEntries;
+        for(uint32_t i=0; i<mapEntries.size(); i++) {
+            mapEntries[i] = vks::initializers::specializationMapEntry(i, i * sizeof(float), sizeof(float));
+        }
+        auto specializationInfo = vks::initializers::specializationInfo(mapEntries.size(), mapEntries.data(), sizeof(weights), weights.data());
+
+        auto pipelineInfo = vks::initializers::computePipelineCreateInfo(pipelineLayout);
+        pipelineInfo.stage = vks::initializers::pipelineShaderStageCreateInfo(tiledShader, VK_SHADER_STAGE_COMPUTE_BIT);
+        pipelineInfo.stage.pSpecializationInfo = &specializationInfo;
+        VkPipeline vkPipeline;
+        vkCheck(vkCreateComputePipelines(device.vkDevice, device.vkPipelineCache, 1, &pipelineInfo, nullptr, &vkPipeline));
+        return vkPipeline;
+    });
+
+    linearPipeline = device.pipelineBuilder->submit([this]() {
+        linearShader = device.createShaderModule("assets/shaders_bin/blur_linear.comp.spv");
+
+        const auto merged = mergeTaps(gaussianWeights());
+        std::array<VkSpecializationMapEntry, 1 + 2 * BLUR_MERGED_TAPS> mapEntries;
+        mapEntries[0] = vks::initializers::specializationMapEntry(0, offsetof(MergedTaps, centerWeight), sizeof(float));
+        for(uint32_t i=0; i<BLUR_MERGED_TAPS; i++) {
+            mapEntries[1 + i] = vks::initializers::specializationMapEntry(1 + i, offsetof(MergedTaps, weights) + i * sizeof(float), sizeof(float));
+            mapEntries[1 + BLUR_MERGED_TAPS + i] = vks::initializers::specializationMapEntry(1 + BLUR_MERGED_TAPS + i, offsetof(MergedTaps, offsets) + i * sizeof(float), sizeof(float));
+        }
+        auto specializationInfo = vks::initializers::specializationInfo(mapEntries.size(), mapEntries.data(), sizeof(merged), &merged);
+
+        // The push constant range of the pyramid layout starts with the same ivec4
+        auto pipelineInfo = vks::initializers::computePipelineCreateInfo(pyramidPipelineLayout);
+        pipelineInfo.stage = vks::initializers::pipelineShaderStageCreateInfo(linearShader, VK_SHADER_STAGE_COMPUTE_BIT);
+        pipelineInfo.stage.pSpecializationInfo = &specializationInfo;
+        VkPipeline vkPipeline;
+        vkCheck(vkCreateComputePipelines(device.vkDevice, device.vkPipelineCache, 1, &pipelineInfo, nullptr, &vkPipeline));
+        return vkPipeline;
+    });
+}
+
+void BloomPass::createLinearSampler() {
+    // The filters are built on bilinear taps, clamped to the region in use by the shaders
+    VkSamplerCreateInfo samplerInfo = vks::initializers::samplerCreateInfo(1.0f);
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.anisotropyEnable = VK_FALSE;
+    vkCheck(vkCreateSampler(device.vkDevice, &samplerInfo, nullptr, &linearSampler));
+}
 
-    vkCheck(vkCreateComputePipelines(device.vkDevice, nullptr, 1, &compPipelineInfo, nullptr, &pipeline));
+void BloomPass::createPyramidPipelines() {
+    downPipeline = device.pipelineBuilder->submit([this]() {
+        downShader = device.createShaderModule("assets/shaders_bin/bloom_down.comp.spv");
+
+        auto pipelineInfo = vks::initializers::computePipelineCreateInfo(pyramidPipelineLayout);
+        pipelineInfo.stage = vks::initializers::pipelineShaderStageCreateInfo(downShader, VK_SHADER_STAGE_COMPUTE_BIT);
+        VkPipeline vkPipeline;
+        vkCheck(vkCreateComputePipelines(device.vkDevice, device.vkPipelineCache, 1, &pipelineInfo, nullptr, &vkPipeline));
+        return vkPipeline;
+    });
+
+    upPipeline = device.pipelineBuilder->submit([this]() {
+        upShader = device.createShaderModule("assets/shaders_bin/bloom_up.comp.spv");
+
+        auto pipelineInfo = vks::initializers::computePipelineCreateInfo(pyramidPipelineLayout);
+        pipelineInfo.stage = vks::initializers::pipelineShaderStageCreateInfo(upShader, VK_SHADER_STAGE_COMPUTE_BIT);
+        VkPipeline vkPipeline;
+        vkCheck(vkCreateComputePipelines(device.vkDevice, device.vkPipelineCache, 1, &pipelineInfo, nullptr, &vkPipeline));
+        return vkPipeline;
+    });
 }
 
-void BloomPass::allocateDescriptorSets(uint32_t nrImages) {
-    std::vector<VkDescriptorSetLayout> descriptorSetLayouts(nrImages, descriptorSetLayout);
+void BloomPass::allocateDescriptorSets() {
+    auto allocInfo = vks::initializers::descriptorSetAllocateInfo(device.vkDescriptorPool, &descriptorSetLayout, 1);
 
-    horzDescriptorSets.resize(nrImages);
-    vertDescriptorSets.resize(nrImages);
-    auto allocInfo = vks::initializers::descriptorSetAllocateInfo(device.vkDescriptorPool, descriptorSetLayouts.data(), descriptorSetLayouts.size());
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, &horzDescriptorSet));
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, &vertDescriptorSet));
 
-    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, horzDescriptorSets.data()));
-    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, vertDescriptorSets.data()));
+    auto linearAllocInfo = vks::initializers::descriptorSetAllocateInfo(device.vkDescriptorPool, &pyramidSetLayout, 1);
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &linearAllocInfo, &linearHorzDescriptorSet));
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &linearAllocInfo, &linearVertDescriptorSet));
+
+    // Allocated for all levels, a small window just leaves some unused
+    auto pyramidAllocInfo = vks::initializers::descriptorSetAllocateInfo(device.vkDescriptorPool, &pyramidSetLayout, 1);
+    for(auto& set : downDescriptorSets) vkCheck(vkAllocateDescriptorSets(device.vkDevice, &pyramidAllocInfo, &set));
+    for(auto& set : upDescriptorSets) vkCheck(vkAllocateDescriptorSets(device.vkDevice, &pyramidAllocInfo, &set));
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &pyramidAllocInfo, &finalDescriptorSet));
 }
 
-void BloomPass::createDescriptorSets(uint32_t nrImages, const std::vector<EvFrameBufferAttachment> &inputs) {
+void BloomPass::createDescriptorSets() {
+    if (!framebuffer.tmpImages) return;
+    const GaussianImages& tmpImages = *framebuffer.tmpImages;
+
     // horizontal descriptors
     // read from horizontal write to vert
-    for(int i=0; i<nrImages; i++) {
-        auto imageInputInfo = vks::initializers::descriptorImageInfo(nullptr, framebuffer.tmpImageViews[i], VK_IMAGE_LAYOUT_GENERAL);
-        auto writeInput = vks::initializers::writeDescriptorSet(horzDescriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageInputInfo);
+    {
+        auto imageInputInfo = vks::initializers::descriptorImageInfo(nullptr, tmpImages[0].view, VK_IMAGE_LAYOUT_GENERAL);
+        auto writeInput = vks::initializers::writeDescriptorSet(horzDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageInputInfo);
 
-        auto imageOutputInfo = vks::initializers::descriptorImageInfo(nullptr, framebuffer.tmpImageViews[i + nrImages], VK_IMAGE_LAYOUT_GENERAL);
-        auto writeOutput = vks::initializers::writeDescriptorSet(horzDescriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &imageOutputInfo);
+        auto imageOutputInfo = vks::initializers::descriptorImageInfo(nullptr, tmpImages[1].view, VK_IMAGE_LAYOUT_GENERAL);
+        auto writeOutput = vks::initializers::writeDescriptorSet(horzDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &imageOutputInfo);
 
         std::array<VkWriteDescriptorSet, 2> writes { writeInput, writeOutput };
         vkUpdateDescriptorSets(device.vkDevice, writes.size(), writes.data(), 0, nullptr);
@@ -122,32 +309,141 @@ void BloomPass::createDescriptorSets(uint32_t nrImages, const std::vector<EvFram
 
     // vertical descriptors
     // read from vert write to horz
-    for(int i=0; i<nrImages; i++) {
-        auto imageInputInfo = vks::initializers::descriptorImageInfo(nullptr, framebuffer.tmpImageViews[i + nrImages], VK_IMAGE_LAYOUT_GENERAL);
-        auto writeInput = vks::initializers::writeDescriptorSet(vertDescriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageInputInfo);
+    {
+        auto imageInputInfo = vks::initializers::descriptorImageInfo(nullptr, tmpImages[1].view, VK_IMAGE_LAYOUT_GENERAL);
+        auto writeInput = vks::initializers::writeDescriptorSet(vertDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageInputInfo);
 
-        auto imageOutputInfo = vks::initializers::descriptorImageInfo(nullptr, framebuffer.tmpImageViews[i], VK_IMAGE_LAYOUT_GENERAL);
-        auto writeOutput = vks::initializers::writeDescriptorSet(vertDescriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &imageOutputInfo);
+        auto imageOutputInfo = vks::initializers::descriptorImageInfo(nullptr, tmpImages[0].view, VK_IMAGE_LAYOUT_GENERAL);
+        auto writeOutput = vks::initializers::writeDescriptorSet(vertDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &imageOutputInfo);
 
         std::array<VkWriteDescriptorSet, 2> writes { writeInput, writeOutput };
         vkUpdateDescriptorSets(device.vkDevice, writes.size(), writes.data(), 0, nullptr);
     }
+
+    // the same ping pong with a sampled input for the merged taps
+    for(int i=0; i<2; i++) {
+        VkDescriptorSet set = i == 0 ? linearHorzDescriptorSet : linearVertDescriptorSet;
+        auto imageInputInfo = vks::initializers::descriptorImageInfo(linearSampler, tmpImages[i].view, VK_IMAGE_LAYOUT_GENERAL);
+        auto imageOutputInfo = vks::initializers::descriptorImageInfo(nullptr, tmpImages[1 - i].view, VK_IMAGE_LAYOUT_GENERAL);
+        std::array<VkWriteDescriptorSet, 2> writes {
+            vks::initializers::writeDescriptorSet(set, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &imageInputInfo),
+            vks::initializers::writeDescriptorSet(set, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &imageOutputInfo),
+        };
+        vkUpdateDescriptorSets(device.vkDevice, writes.size(), writes.data(), 0, nullptr);
+    }
 }
 
-void BloomPass::recreateFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages, const std::vector<EvFrameBufferAttachment> &inputs) {
-    bloomAttachments = inputs;
-    framebuffer.destroy(device);
-    createFramebuffer(width, height, nrImages, inputs);
-    createDescriptorSets(nrImages, inputs);
+void BloomPass::createPyramidDescriptorSets() {
+    auto writeStep = [this](VkDescriptorSet set, VkImageView input, VkImageView output) {
+        auto inputInfo = vks::initializers::descriptorImageInfo(linearSampler, input, VK_IMAGE_LAYOUT_GENERAL);
+        auto outputInfo = vks::initializers::descriptorImageInfo(nullptr, output, VK_IMAGE_LAYOUT_GENERAL);
+        std::array<VkWriteDescriptorSet, 2> writes {
+            vks::initializers::writeDescriptorSet(set, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &inputInfo),
+            vks::initializers::writeDescriptorSet(set, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &outputInfo),
+        };
+        vkUpdateDescriptorSets(device.vkDevice, writes.size(), writes.data(), 0, nullptr);
+    };
+
+    for(uint32_t level=0; level<pyramid.levels; level++) {
+        writeStep(downDescriptorSets[level], level == 0 ? bloomAttachment.view : pyramid.mipViews[level - 1], pyramid.mipViews[level]);
+    }
+    for(uint32_t level=0; level+1<pyramid.levels; level++) {
+        writeStep(upDescriptorSets[level], pyramid.mipViews[level + 1], pyramid.mipViews[level]);
+    }
+    writeStep(finalDescriptorSet, pyramid.mipViews[0], bloomAttachment.view);
 }
 
-void BloomPass::run(VkCommandBuffer cmdBuffer, uint32_t imageIdx) const {
-    const uint32_t nrImages = bloomAttachments.size();
-    Push push{};
-    push.d.x = framebuffer.width;
-    push.d.y = framebuffer.height;
-    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+void BloomPass::recreateFramebuffer(uint32_t width, uint32_t height, const EvFrameBufferAttachment &input, std::optional<GaussianImages> tmpImages) {
+    bloomAttachment = input;
+    pyramid.destroy(device);
+    createFramebuffer(width, height, tmpImages);
+    createPyramid(width, height);
+    createDescriptorSets();
+    createPyramidDescriptorSets();
+}
+
+void BloomPass::run(VkCommandBuffer cmdBuffer, VkExtent2D renderExtent, Mode mode, EvGpuProfiler &profiler, EvGpuProfiler::Queue queue) const {
+    if (mode == Mode::Pyramid) {
+        // The pyramid itself never leaves this queue, it is rebuilt every frame so it needs no transfer
+        runPyramid(cmdBuffer, renderExtent, profiler, queue);
+    } else {
+        assert(queue == EvGpuProfiler::Queue::Graphics && "the gaussians blit");
+        runGaussian(cmdBuffer, renderExtent, mode, profiler);
+    }
+}
+
+void BloomPass::runPyramid(VkCommandBuffer cmdBuffer, VkExtent2D renderExtent, EvGpuProfiler &profiler, EvGpuProfiler::Queue queue) const {
+    // Size of the region in use of each level, the images are sized for the full swapchain
+    std::array<glm::ivec2, PYRAMID_LEVELS> levelSizes;
+    for(uint32_t level=0; level<pyramid.levels; level++) {
+        levelSizes[level] = glm::ivec2(std::max(renderExtent.width >> (level + 1), 1u), std::max(renderExtent.height >> (level + 1), 1u));
+    }
+    const glm::ivec2 inputSize(renderExtent.width, renderExtent.height);
+
+    auto stepBarrier = vks::initializers::memoryBarrier();
+    stepBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    stepBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    auto dispatch = [&](VkDescriptorSet set, glm::ivec2 outputSize, glm::ivec2 stepInputSize, glm::vec2 weights) {
+        PyramidPush push {
+            .sizes = glm::ivec4(outputSize, stepInputSize),
+            .weights = weights,
+        };
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pyramidPipelineLayout, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(cmdBuffer, pyramidPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+        vkCmdDispatch(cmdBuffer, (outputSize.x + 7) / 8, (outputSize.y + 7) / 8, 1);
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &stepBarrier, 0, nullptr, 0, nullptr);
+    };
+
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, downPipeline.get());
+    for(uint32_t level=0; level<pyramid.levels; level++) {
+        profiler.beginZone(cmdBuffer, DOWN_ZONES[level], queue);
+        dispatch(downDescriptorSets[level], levelSizes[level], level == 0 ? inputSize : levelSizes[level - 1], glm::vec2(0.0f));
+        profiler.endZone(cmdBuffer);
+    }
+
+    // Each level gets the blur of all coarser ones added to it
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, upPipeline.get());
+    for(uint32_t level=pyramid.levels-1; level-- > 0;) {
+        profiler.beginZone(cmdBuffer, UP_ZONES[level], queue);
+        dispatch(upDescriptorSets[level], levelSizes[level], levelSizes[level + 1], glm::vec2(1.0f));
+        profiler.endZone(cmdBuffer);
+    }
+
+    // Level 0 now holds the sum of all levels, averaged into the input it keeps the brightness of the gaussian
+    profiler.beginZone(cmdBuffer, "bloom up 1/1", queue);
+    dispatch(finalDescriptorSet, inputSize, levelSizes[0], glm::vec2(0.0f, 1.0f / static_cast<float>(pyramid.levels)));
+    profiler.endZone(cmdBuffer);
+}
 
+void BloomPass::runGaussian(VkCommandBuffer cmdBuffer, VkExtent2D renderExtent, Mode mode, EvGpuProfiler& profiler) const {
+    // Only the rendered part of the input is blurred, at half its resolution
+    const int32_t width = std::max(static_cast<int32_t>(renderExtent.width / 2), 1);
+    const int32_t height = std::max(static_cast<int32_t>(renderExtent.height / 2), 1);
+    assert(width <= framebuffer.width && height <= framebuffer.height);
+    assert(framebuffer.tmpImages && "the render graph only creates the images of the gaussian when it runs");
+    const VkImage horzImage = (*framebuffer.tmpImages)[0].image;
+
+    Push push{};
+    push.d.x = width;
+    push.d.y = height;
+
+    // The variants only differ in the kernel, timed on their own to compare them
+    const char* blurZone = "bloom blur";
+    VkPipeline blurPipeline = pipeline.get();
+    VkPipelineLayout blurLayout = pipelineLayout;
+    VkDescriptorSet blurHorzSet = horzDescriptorSet;
+    VkDescriptorSet blurVertSet = vertDescriptorSet;
+    if (mode == Mode::GaussianTiled) {
+        blurZone = "bloom blur tiled";
+        blurPipeline = tiledPipeline.get();
+    } else if (mode == Mode::GaussianLinear) {
+        blurZone = "bloom blur linear";
+        blurPipeline = linearPipeline.get();
+        blurLayout = pyramidPipelineLayout;
+        blurHorzSet = linearHorzDescriptorSet;
+        blurVertSet = linearVertDescriptorSet;
+    }
 
     VkImageBlit blitInfo {
         .srcSubresource = {
@@ -156,51 +452,61 @@ void BloomPass::run(VkCommandBuffer cmdBuffer, uint32_t imageIdx) const {
             .baseArrayLayer = 0,
             .layerCount = 1,
         },
-        .srcOffsets = { {0,0,0}, {framebuffer.width * 2, framebuffer.height* 2, 1} },
+        .srcOffsets = { {0,0,0}, {static_cast<int32_t>(renderExtent.width), static_cast<int32_t>(renderExtent.height), 1} },
         .dstSubresource = {
             .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
             .mipLevel = 0,
             .baseArrayLayer = 0,
             .layerCount = 1,
         },
-        .dstOffsets = { {0,0,0}, {framebuffer.width, framebuffer.height, 1} },
+        .dstOffsets = { {0,0,0}, {width, height, 1} },
     };
 
-    vkCmdBlitImage(cmdBuffer, bloomAttachments[imageIdx].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, framebuffer.tmpImages[imageIdx], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blitInfo, VK_FILTER_LINEAR);
+    profiler.beginZone(cmdBuffer, "bloom blit down");
+    vkCmdBlitImage(cmdBuffer, bloomAttachment.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, horzImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blitInfo, VK_FILTER_LINEAR);
+    profiler.endZone(cmdBuffer);
 
     // transition to general for the compute passes
-    auto barrierInfo = vks::initializers::imageMemoryBarrier(framebuffer.tmpImages[imageIdx], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+    auto barrierInfo = vks::initializers::imageMemoryBarrier(horzImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+    barrierInfo.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrierInfo.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
     vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 1, &barrierInfo);
 
-    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &horzDescriptorSets[imageIdx], 0, nullptr);
+    profiler.beginZone(cmdBuffer, blurZone);
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, blurPipeline);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, blurLayout, 0, 1, &blurHorzSet, 0, nullptr);
     push.d.z = 0;
-    vkCmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
-    vkCmdDispatch(cmdBuffer, framebuffer.width / 256 + 1, framebuffer.height, 1);
+    vkCmdPushConstants(cmdBuffer, blurLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    vkCmdDispatch(cmdBuffer, width / 256 + 1, height, 1);
 
-    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &vertDescriptorSets[imageIdx], 0, nullptr);
+    // the vertical pass reads what the horizontal one wrote
+    auto blurBarrier = vks::initializers::memoryBarrier();
+    blurBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    blurBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &blurBarrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, blurLayout, 0, 1, &blurVertSet, 0, nullptr);
     push.d.z = 1;
-    vkCmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
-    vkCmdDispatch(cmdBuffer, framebuffer.height / 256 + 1, framebuffer.width, 1);
+    vkCmdPushConstants(cmdBuffer, blurLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    vkCmdDispatch(cmdBuffer, height / 256 + 1, width, 1);
+    profiler.endZone(cmdBuffer);
 
+    profiler.beginZone(cmdBuffer, "bloom blit up");
     // transition horz to src optimal for blitting back;
-    barrierInfo = vks::initializers::imageMemoryBarrier(framebuffer.tmpImages[imageIdx], VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    barrierInfo = vks::initializers::imageMemoryBarrier(horzImage, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    barrierInfo.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrierInfo.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
     vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 1, &barrierInfo);
 
-    // transition the input to dst optimal for the blit
-    barrierInfo = vks::initializers::imageMemoryBarrier(bloomAttachments[imageIdx].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 1, &barrierInfo);
+    // transition the input to dst optimal for the blit, the blit down was the last to read it
+    barrierInfo = vks::initializers::imageMemoryBarrier(bloomAttachment.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    barrierInfo.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 1, &barrierInfo);
 
     // do a reverse blit
     std::swap(blitInfo.srcOffsets, blitInfo.dstOffsets);
     std::swap(blitInfo.srcSubresource, blitInfo.dstSubresource);
 
-    vkCmdBlitImage(cmdBuffer, framebuffer.tmpImages[imageIdx], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, bloomAttachments[imageIdx].image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blitInfo, VK_FILTER_LINEAR);
-
-    // transition horz to dst optimal for the next round
-    barrierInfo = vks::initializers::imageMemoryBarrier(framebuffer.tmpImages[imageIdx], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 1, &barrierInfo);
-
-    // transfer image to shader read optimal for the post pass
-    auto imageBarrier = vks::initializers::imageMemoryBarrier(bloomAttachments[imageIdx].image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+    vkCmdBlitImage(cmdBuffer, horzImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, bloomAttachment.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blitInfo, VK_FILTER_LINEAR);
+    profiler.endZone(cmdBuffer);
 }
@@ -1,37 +1,27 @@
 #include "RenderPasses/DepthPass.h"
 
-DepthPass::DepthPass(EvDevice &device, uint32_t width, uint32_t height, uint32_t nrImages) : device(device) {
-    createFramebuffer(width, height, nrImages);
-    createPipelineLayout();
+DepthPass::DepthPass(EvDevice &device, uint32_t width, uint32_t height, const EvFrameBufferAttachment &depthAttachment,
+                     VkDescriptorSetLayout frameSetLayout) : device(device) {
+    createFramebuffer(width, height, depthAttachment);
+    createPipelineLayout(frameSetLayout);
     createPipeline();
 }
 
 DepthPass::~DepthPass() {
+    vkDestroyPipeline(device.vkDevice, pipeline.get(), nullptr);
+    if (mergedPipeline.valid()) vkDestroyPipeline(device.vkDevice, mergedPipeline.get(), nullptr);
     framebuffer.destroy(device);
-    vkDestroyPipeline(device.vkDevice, pipeline, nullptr);
     vkDestroyPipelineLayout(device.vkDevice, pipelineLayout, nullptr);
     vkDestroyShaderModule(device.vkDevice, vertShader, nullptr);
 }
 
-void DepthPass::createFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages) {
-    assert(nrImages > 0);
+void DepthPass::createFramebuffer(uint32_t width, uint32_t height, const EvFrameBufferAttachment& depthAttachment) {
     framebuffer.width = width;
     framebuffer.height = height;
 
-    framebuffer.depths.resize(nrImages);
-
-    auto depthFormat = device.findDepthFormat();
-    for(int i=0; i<nrImages; i++) {
-        device.createAttachment(
-                depthFormat,
-                VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-                VK_SAMPLE_COUNT_1_BIT,
-                width, height,
-                &framebuffer.depths[i]);
-    }
-
-
-    auto depthDescription = vks::initializers::attachmentDescription(depthFormat, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    // The render graph transitions the attachment, the render pass keeps it where it finds it
+    auto depthDescription = vks::initializers::attachmentDescription(depthAttachment.format, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    depthDescription.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
     depthDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     auto depthRef = vks::initializers::attachmentReference(0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 
@@ -52,42 +42,47 @@ void DepthPass::createFramebuffer(uint32_t width, uint32_t height, uint32_t nrIm
 
     vkCheck(vkCreateRenderPass(device.vkDevice, &renderPassInfo, nullptr, &framebuffer.vkRenderPass));
 
-    framebuffer.vkFrameBuffers.resize(nrImages);
-    for(int i=0; i<nrImages; i++) {
-        VkFramebufferCreateInfo framebufferInfo {
-            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-            .renderPass = framebuffer.vkRenderPass,
-            .attachmentCount = 1,
-            .pAttachments = &framebuffer.depths[i].view,
-            .width = width,
-            .height = height,
-            .layers = 1,
-        };
-
-        vkCheck(vkCreateFramebuffer(device.vkDevice, &framebufferInfo, nullptr, &framebuffer.vkFrameBuffers[i]));
-    }
-}
-
-void DepthPass::createPipelineLayout() {
-    VkPushConstantRange pushConstant {
-        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-        .offset = 0,
-        .size = sizeof(PushConstant),
+    VkFramebufferCreateInfo framebufferInfo {
+        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        .renderPass = framebuffer.vkRenderPass,
+        .attachmentCount = 1,
+        .pAttachments = &depthAttachment.view,
+        .width = width,
+        .height = height,
+        .layers = 1,
     };
 
+    framebuffer.vkFrameBuffers.resize(1);
+    vkCheck(vkCreateFramebuffer(device.vkDevice, &framebufferInfo, nullptr, &framebuffer.vkFrameBuffers[0]));
+}
+
+void DepthPass::createPipelineLayout(VkDescriptorSetLayout frameSetLayout) {
     VkPipelineLayoutCreateInfo layoutInfo {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 0,
-        .pushConstantRangeCount = 1,
-        .pPushConstantRanges = &pushConstant,
+        .setLayoutCount = 1,
+        .pSetLayouts = &frameSetLayout,
+        .pushConstantRangeCount = 0,
     };
 
     vkCheck(vkCreatePipelineLayout(device.vkDevice, &layoutInfo, nullptr, &pipelineLayout));
 }
 
 void DepthPass::createPipeline() {
-    vertShader = device.createShaderModule("assets/shaders_bin/depth.vert.spv");
+    pipeline = device.pipelineBuilder->submit([this]() {
+        vertShader = device.createShaderModule("assets/shaders_bin/depth.vert.spv");
+        return buildPipeline(framebuffer.vkRenderPass, 0);
+    });
+}
 
+void DepthPass::createMergedPipeline(VkRenderPass renderPass, uint32_t subpass) {
+    // Shares the shader module of the pipeline above, which creates it
+    mergedPipeline = device.pipelineBuilder->submit([this, renderPass, subpass]() {
+        pipeline.wait();
+        return buildPipeline(renderPass, subpass);
+    });
+}
+
+VkPipeline DepthPass::buildPipeline(VkRenderPass renderPass, uint32_t subpass) const {
     auto inputAssembly = vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
     auto rasterization = vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
     auto colorBlend = vks::initializers::pipelineColorBlendStateCreateInfo(0, nullptr);
@@ -100,8 +95,9 @@ void DepthPass::createPipeline() {
         vks::initializers::pipelineShaderStageCreateInfo(vertShader, VK_SHADER_STAGE_VERTEX_BIT),
     };
 
-    auto bindingDescriptions= Vertex::getBindingDescriptions();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    // The prepass only reads the positions, from their own packed stream
+    auto bindingDescriptions= PackedVertex::getPositionBindingDescriptions();
+    auto attributeDescriptions = PackedVertex::getPositionAttributeDescriptions();
     auto vertexInput = vks::initializers::pipelineVertexInputStateCreateInfo(bindingDescriptions, attributeDescriptions);
 
     VkGraphicsPipelineCreateInfo pipelineInfo {
@@ -117,19 +113,24 @@ void DepthPass::createPipeline() {
             .pColorBlendState = &colorBlend,
             .pDynamicState = &dynamicState,
             .layout = pipelineLayout,
-            .renderPass = framebuffer.vkRenderPass,
-            .subpass = 0,
+            .renderPass = renderPass,
+            .subpass = subpass,
     };
 
-    vkCheck(vkCreateGraphicsPipelines(device.vkDevice, nullptr, 1, &pipelineInfo, nullptr, &pipeline));
+    VkPipeline vkPipeline;
+    vkCheck(vkCreateGraphicsPipelines(device.vkDevice, device.vkPipelineCache, 1, &pipelineInfo, nullptr, &vkPipeline));
+    return vkPipeline;
 }
 
-void DepthPass::recreateFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages) {
+void DepthPass::recreateFramebuffer(uint32_t width, uint32_t height, const EvFrameBufferAttachment &depthAttachment) {
+    // The pipeline may still be building against the render pass that is about to go
+    pipeline.wait();
     framebuffer.destroy(device);
-    createFramebuffer(width, height, nrImages);
+    createFramebuffer(width, height, depthAttachment);
 }
 
-void DepthPass::startPass(VkCommandBuffer cmdBuffer, uint32_t imageIdx) const {
+void DepthPass::startPass(VkCommandBuffer cmdBuffer, VkExtent2D renderExtent) const {
+    assert(renderExtent.width <= framebuffer.width && renderExtent.height <= framebuffer.height);
     std::array<VkClearValue, 1> clearValues {
             VkClearValue { .depthStencil = {1.0f, 0}, },
     };
@@ -137,7 +138,7 @@ void DepthPass::startPass(VkCommandBuffer cmdBuffer, uint32_t imageIdx) const {
     VkRenderPassBeginInfo renderPassInfo {
             .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
             .renderPass = framebuffer.vkRenderPass,
-            .framebuffer = framebuffer.vkFrameBuffers[imageIdx],
+            .framebuffer = framebuffer.vkFrameBuffers[0],
             .renderArea = {
                     .offset = {0,0},
                     .extent = {framebuffer.width, framebuffer.height},
@@ -147,18 +148,18 @@ void DepthPass::startPass(VkCommandBuffer cmdBuffer, uint32_t imageIdx) const {
     };
     VkViewport viewport {
             .x = 0.0f,
-            .y = static_cast<float>(framebuffer.height),
-            .width = static_cast<float>(framebuffer.width),
-            .height = -static_cast<float>(framebuffer.height),
+            .y = static_cast<float>(renderExtent.height),
+            .width = static_cast<float>(renderExtent.width),
+            .height = -static_cast<float>(renderExtent.height),
             .minDepth = 0.0f,
             .maxDepth = 1.0f,
     };
-    VkRect2D scissor{{0,0}, {framebuffer.width, framebuffer.height}};
+    VkRect2D scissor{{0,0}, renderExtent};
 
     vkCmdBeginRenderPass(cmdBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
     vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
     vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
-    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.get());
 }
 
 void DepthPass::endPass(VkCommandBuffer cmdBuffer) const {
@@ -1,14 +1,13 @@
 #include "RenderPasses/ForwardPass.h"
 
-ForwardPass::ForwardPass(EvDevice &device, uint32_t width, uint32_t height, uint32_t nrImages,
-                         const std::vector<EvFrameBufferAttachment> &depthAttachments) : device(device) {
-    createFramebuffer(width, height, nrImages, depthAttachments);
+ForwardPass::ForwardPass(EvDevice &device, uint32_t width, uint32_t height, const EvFrameBufferAttachment &colorAttachment,
+                         const EvFrameBufferAttachment &bloomAttachment, const EvFrameBufferAttachment &depthAttachment,
+                         VkDescriptorSetLayout frameSetLayout, VkDescriptorSetLayout textureTableLayout,
+                         VkDescriptorSetLayout clusterSetLayout, VkDescriptorSetLayout lightSetLayout) : device(device) {
+    createFramebuffer(width, height, colorAttachment, bloomAttachment, depthAttachment);
 
-    createTexturesDescriptorSetLayout();
-    createLightBufferDescriptorSetLayout();
-    createPipelineLayout();
+    createPipelineLayout(frameSetLayout, textureTableLayout, clusterSetLayout, lightSetLayout);
     createPipeline();
-    createLightBuffers(nrImages);
 
     createSkyboxDescriptorSetLayout();
     createSkyboxPipelineLayout();
@@ -16,48 +15,36 @@ ForwardPass::ForwardPass(EvDevice &device, uint32_t width, uint32_t height, uint
 }
 
 ForwardPass::~ForwardPass() {
-    framebuffer.destroy(device);
+    vkDestroyPipeline(device.vkDevice, pipeline.get(), nullptr);
+    if (mergedPipeline.valid()) vkDestroyPipeline(device.vkDevice, mergedPipeline.get(), nullptr);
     skybox.destroy(device);
-    lightUBO->destroy();
+    framebuffer.destroy(device);
     vkDestroyShaderModule(device.vkDevice, vertShader, nullptr);
     vkDestroyShaderModule(device.vkDevice, fragShader, nullptr);
-    vkDestroyDescriptorSetLayout(device.vkDevice, texturesDescriptorSetLayout, nullptr);
-    vkDestroyDescriptorSetLayout(device.vkDevice, lightBufferDescriptorSetLayout, nullptr);
-    vkDestroyPipeline(device.vkDevice, pipeline, nullptr);
     vkDestroyPipelineLayout(device.vkDevice, pipelineLayout, nullptr);
 }
 
-void ForwardPass::createFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages,
-                                    const std::vector<EvFrameBufferAttachment>& depthAttachments) {
-    assert(nrImages > 0);
-    assert(depthAttachments.size() == nrImages);
-
+void ForwardPass::createFramebuffer(uint32_t width, uint32_t height, const EvFrameBufferAttachment& colorAttachment,
+                                    const EvFrameBufferAttachment& bloomAttachment, const EvFrameBufferAttachment& depthAttachment) {
     framebuffer.width = width;
     framebuffer.height = height;
 
-    framebuffer.colors.resize(nrImages);
-    framebuffer.blooms.resize(nrImages);
-
-    auto color_format = VK_FORMAT_R8G8B8A8_SNORM;
-    auto bloom_format = VK_FORMAT_R16G16B16A16_SFLOAT;
-    for(int i=0; i<nrImages; i++) {
-        device.createAttachment(color_format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_SAMPLE_COUNT_1_BIT, width, height, &framebuffer.colors[i]);
-        auto usage = static_cast<VkImageUsageFlagBits>(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-        device.createAttachment(bloom_format, usage, VK_SAMPLE_COUNT_1_BIT, width, height, &framebuffer.blooms[i]);
-    }
-
-    auto colorDescription = vks::initializers::attachmentDescription(color_format, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // The render graph transitions the attachments, the render pass keeps them where it finds them
+    auto colorDescription = vks::initializers::attachmentDescription(colorAttachment.format, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    colorDescription.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     auto colorReference = vks::initializers::attachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 
-    auto bloomDescription = vks::initializers::attachmentDescription(bloom_format, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    auto bloomDescription = vks::initializers::attachmentDescription(bloomAttachment.format, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    bloomDescription.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     auto bloomReference = vks::initializers::attachmentReference(1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 
     std::array<VkAttachmentReference, 2> colorAttachments { colorReference, bloomReference };
 
-    auto depthDescription = vks::initializers::attachmentDescription(depthAttachments[0].format, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // Only tested, the prepass wrote it
+    auto depthDescription = vks::initializers::attachmentDescription(depthAttachment.format, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
     depthDescription.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-    depthDescription.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-    auto depthReference = vks::initializers::attachmentReference(2, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    depthDescription.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    auto depthReference = vks::initializers::attachmentReference(2, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
 
     VkSubpassDescription subpassInfo {
         .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
@@ -78,92 +65,45 @@ void ForwardPass::createFramebuffer(uint32_t width, uint32_t height, uint32_t nr
 
     vkCheck(vkCreateRenderPass(device.vkDevice, &renderPassInfo, nullptr, &framebuffer.vkRenderPass));
 
-    framebuffer.vkFrameBuffers.resize(nrImages);
-    for(int i=0; i<nrImages; i++) {
-        std::array<VkImageView, 3> attachments { framebuffer.colors[i].view, framebuffer.blooms[i].view, depthAttachments[i].view };
-
-        VkFramebufferCreateInfo framebufferInfo {
-            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-            .renderPass = framebuffer.vkRenderPass,
-            .attachmentCount = static_cast<uint32_t>(attachments.size()),
-            .pAttachments = attachments.data(),
-            .width = width,
-            .height = height,
-            .layers = 1,
-        };
-
-        vkCheck(vkCreateFramebuffer(device.vkDevice, &framebufferInfo, nullptr, &framebuffer.vkFrameBuffers[i]));
-    }
-}
-
-void ForwardPass::createTexturesDescriptorSetLayout() {
-    VkDescriptorSetLayoutBinding albedoBinding {
-            .binding = 0,
-            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
-            .pImmutableSamplers = nullptr,
-    };
-
-    VkDescriptorSetLayoutBinding normalBinding {
-            .binding = 1,
-            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
-            .pImmutableSamplers = nullptr,
-    };
-
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {albedoBinding, normalBinding};
+    std::array<VkImageView, 3> attachments { colorAttachment.view, bloomAttachment.view, depthAttachment.view };
 
-    VkDescriptorSetLayoutCreateInfo layoutInfo {
-            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-            .bindingCount = static_cast<uint32_t>(bindings.size()),
-            .pBindings = bindings.data(),
+    VkFramebufferCreateInfo framebufferInfo {
+        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        .renderPass = framebuffer.vkRenderPass,
+        .attachmentCount = static_cast<uint32_t>(attachments.size()),
+        .pAttachments = attachments.data(),
+        .width = width,
+        .height = height,
+        .layers = 1,
     };
 
-    vkCheck(vkCreateDescriptorSetLayout(device.vkDevice, &layoutInfo, nullptr, &texturesDescriptorSetLayout));
+    framebuffer.vkFrameBuffers.resize(1);
+    vkCheck(vkCreateFramebuffer(device.vkDevice, &framebufferInfo, nullptr, &framebuffer.vkFrameBuffers[0]));
 }
 
-void ForwardPass::createLightBufferDescriptorSetLayout() {
-    VkDescriptorSetLayoutBinding uboBinding {
-        .binding = 2,
-        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-        .descriptorCount = 1,
-        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
-    };
-
-    VkDescriptorSetLayoutCreateInfo layoutInfo {
-            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-            .bindingCount = 1,
-            .pBindings = &uboBinding,
-    };
-
-    vkCheck(vkCreateDescriptorSetLayout(device.vkDevice, &layoutInfo, nullptr, &lightBufferDescriptorSetLayout));
-}
-
-void ForwardPass::createPipelineLayout() {
-    VkPushConstantRange pushConstantRange {
-        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-        .offset = 0,
-        .size = sizeof(PushConstant),
-    };
-
-    std::array<VkDescriptorSetLayout,2> descriptorSetLayouts {texturesDescriptorSetLayout, lightBufferDescriptorSetLayout};
+void ForwardPass::createPipelineLayout(VkDescriptorSetLayout frameSetLayout, VkDescriptorSetLayout textureTableLayout,
+                                       VkDescriptorSetLayout clusterSetLayout, VkDescriptorSetLayout lightSetLayout) {
+    // Four sets is the most every device is guaranteed to support
+    std::array<VkDescriptorSetLayout,4> descriptorSetLayouts {frameSetLayout, textureTableLayout, clusterSetLayout, lightSetLayout};
     VkPipelineLayoutCreateInfo pipelineLayoutInfo {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
             .setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size()),
             .pSetLayouts = descriptorSetLayouts.data(),
-            .pushConstantRangeCount = 1,
-            .pPushConstantRanges = &pushConstantRange,
+            .pushConstantRangeCount = 0,
     };
 
     vkCheck(vkCreatePipelineLayout(device.vkDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout));
 }
 
 void ForwardPass::createPipeline() {
-    vertShader = device.createShaderModule("assets/shaders_bin/forward.vert.spv");
-    fragShader = device.createShaderModule("assets/shaders_bin/forward.frag.spv");
+    pipeline = device.pipelineBuilder->submit([this]() {
+        vertShader = device.createShaderModule("assets/shaders_bin/forward.vert.spv");
+        fragShader = device.createShaderModule("assets/shaders_bin/forward.frag.spv");
+        return buildPipeline(framebuffer.vkRenderPass, 0);
+    });
+}
 
+VkPipeline ForwardPass::buildPipeline(VkRenderPass renderPass, uint32_t subpass) const {
     auto inputAssembly = vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
     auto rasterization = vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
     auto colorBlendInfo = vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE);
@@ -180,8 +120,8 @@ void ForwardPass::createPipeline() {
             vks::initializers::pipelineShaderStageCreateInfo(fragShader, VK_SHADER_STAGE_FRAGMENT_BIT),
     };
 
-    auto bindingDescriptions= Vertex::getBindingDescriptions();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    auto bindingDescriptions= PackedVertex::getBindingDescriptions();
+    auto attributeDescriptions = PackedVertex::getAttributeDescriptions();
     auto vertexInput = vks::initializers::pipelineVertexInputStateCreateInfo(bindingDescriptions, attributeDescriptions);
 
     VkGraphicsPipelineCreateInfo pipelineInfo {
@@ -197,22 +137,13 @@ void ForwardPass::createPipeline() {
             .pColorBlendState = &colorBlend,
             .pDynamicState = &dynamicState,
             .layout = pipelineLayout,
-            .renderPass = framebuffer.vkRenderPass,
-            .subpass = 0,
+            .renderPass = renderPass,
+            .subpass = subpass,
     };
 
-    vkCheck(vkCreateGraphicsPipelines(device.vkDevice, nullptr, 1, &pipelineInfo, nullptr, &pipeline));
-}
-
-void ForwardPass::createLightBuffers(uint32_t nrImages) {
-    lightUBO = std::make_unique<UBOBuffer<LightBuffer>>(device, 1, nrImages, 2, lightBufferDescriptorSetLayout);
-    for(int i=0; i<nrImages; i++) {
-        auto& buffer = *lightUBO->getPtr(i);
-        buffer.falloffConstant = 1.0f;
-        buffer.falloffLinear = 1.0f;
-        buffer.falloffQuadratic = 1.0f;
-        buffer.lightCount = 0;
-    }
+    VkPipeline vkPipeline;
+    vkCheck(vkCreateGraphicsPipelines(device.vkDevice, device.vkPipelineCache, 1, &pipelineInfo, nullptr, &vkPipeline));
+    return vkPipeline;
 }
 
 void ForwardPass::createSkyboxDescriptorSetLayout() {
@@ -251,9 +182,14 @@ void ForwardPass::createSkyboxPipelineLayout() {
 }
 
 void ForwardPass::createSkyboxPipeline() {
-    skybox.vertShader = device.createShaderModule("assets/shaders_bin/skybox.vert.spv");
-    skybox.fragShader = device.createShaderModule("assets/shaders_bin/skybox.frag.spv");
+    skybox.pipeline = device.pipelineBuilder->submit([this]() {
+        skybox.vertShader = device.createShaderModule("assets/shaders_bin/skybox.vert.spv");
+        skybox.fragShader = device.createShaderModule("assets/shaders_bin/skybox.frag.spv");
+        return buildSkyboxPipeline(framebuffer.vkRenderPass, 0);
+    });
+}
 
+VkPipeline ForwardPass::buildSkyboxPipeline(VkRenderPass renderPass, uint32_t subpass) const {
     auto inputAssembly = vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
     auto rasterization = vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
     auto colorBlendInfo = vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE);
@@ -270,8 +206,9 @@ void ForwardPass::createSkyboxPipeline() {
             vks::initializers::pipelineShaderStageCreateInfo(skybox.fragShader, VK_SHADER_STAGE_FRAGMENT_BIT),
     };
 
-    auto bindingDescriptions= Vertex::getBindingDescriptions();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    // The cube only needs its positions, the direction to sample in
+    auto bindingDescriptions= PackedVertex::getPositionBindingDescriptions();
+    auto attributeDescriptions = PackedVertex::getPositionAttributeDescriptions();
     auto vertexInput = vks::initializers::pipelineVertexInputStateCreateInfo(bindingDescriptions, attributeDescriptions);
 
     VkGraphicsPipelineCreateInfo pipelineInfo {
@@ -287,26 +224,37 @@ void ForwardPass::createSkyboxPipeline() {
             .pColorBlendState = &colorBlend,
             .pDynamicState = &dynamicState,
             .layout = skybox.pipelineLayout,
-            .renderPass = framebuffer.vkRenderPass,
-            .subpass = 0,
+            .renderPass = renderPass,
+            .subpass = subpass,
     };
 
-    vkCheck(vkCreateGraphicsPipelines(device.vkDevice, nullptr, 1, &pipelineInfo, nullptr, &skybox.pipeline));
+    VkPipeline vkPipeline;
+    vkCheck(vkCreateGraphicsPipelines(device.vkDevice, device.vkPipelineCache, 1, &pipelineInfo, nullptr, &vkPipeline));
+    return vkPipeline;
 }
 
-void ForwardPass::updateLights(LightComponent *lightData, uint32_t nrLights, uint32_t imageIdx) {
-    auto& buffer = *lightUBO->getPtr(imageIdx);
-    buffer.lightCount = nrLights;
-    memcpy(buffer.lightData, lightData, nrLights * sizeof(LightComponent));
+void ForwardPass::createMergedPipelines(VkRenderPass renderPass, uint32_t subpass) {
+    // Share the shader modules of the pipelines above, which create them
+    mergedPipeline = device.pipelineBuilder->submit([this, renderPass, subpass]() {
+        pipeline.wait();
+        return buildPipeline(renderPass, subpass);
+    });
+    skybox.mergedPipeline = device.pipelineBuilder->submit([this, renderPass, subpass]() {
+        skybox.pipeline.wait();
+        return buildSkyboxPipeline(renderPass, subpass);
+    });
 }
 
-void ForwardPass::recreateFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages,
-                                      const std::vector<EvFrameBufferAttachment> &depthAttachments) {
+void ForwardPass::recreateFramebuffer(uint32_t width, uint32_t height, const EvFrameBufferAttachment &colorAttachment,
+                                      const EvFrameBufferAttachment &bloomAttachment, const EvFrameBufferAttachment &depthAttachment) {
+    pipeline.wait();
+    skybox.pipeline.wait();
     framebuffer.destroy(device);
-    createFramebuffer(width, height, nrImages, depthAttachments);
+    createFramebuffer(width, height, colorAttachment, bloomAttachment, depthAttachment);
 }
 
-void ForwardPass::startPass(VkCommandBuffer cmdBuffer, uint32_t imageIdx) const {
+void ForwardPass::startPass(VkCommandBuffer cmdBuffer, VkExtent2D renderExtent) const {
+    assert(renderExtent.width <= framebuffer.width && renderExtent.height <= framebuffer.height);
     std::array<VkClearValue, 3> clearValues {
         VkClearValue {.color = {0.0f, 0.0f, 0.0f, 0.0f}},
         VkClearValue {.color = {0.0f, 0.0f, 0.0f, 0.0f}},
@@ -316,7 +264,7 @@ void ForwardPass::startPass(VkCommandBuffer cmdBuffer, uint32_t imageIdx) const
     VkRenderPassBeginInfo renderPassInfo {
             .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
             .renderPass = framebuffer.vkRenderPass,
-            .framebuffer = framebuffer.vkFrameBuffers[imageIdx],
+            .framebuffer = framebuffer.vkFrameBuffers[0],
             .renderArea = {
                     .offset = {0,0},
                     .extent = {framebuffer.width, framebuffer.height},
@@ -326,19 +274,18 @@ void ForwardPass::startPass(VkCommandBuffer cmdBuffer, uint32_t imageIdx) const
     };
     VkViewport viewport {
             .x = 0.0f,
-            .y = static_cast<float>(framebuffer.height),
-            .width = static_cast<float>(framebuffer.width),
-            .height = -static_cast<float>(framebuffer.height),
+            .y = static_cast<float>(renderExtent.height),
+            .width = static_cast<float>(renderExtent.width),
+            .height = -static_cast<float>(renderExtent.height),
             .minDepth = 0.0f,
             .maxDepth = 1.0f,
     };
-    VkRect2D scissor{{0,0}, {framebuffer.width, framebuffer.height}};
+    VkRect2D scissor{{0,0}, renderExtent};
 
     vkCmdBeginRenderPass(cmdBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
     vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
     vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
-    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, lightUBO->getDescriptorSet(imageIdx), 0, nullptr);
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.get());
 }
 
 void ForwardPass::endPass(VkCommandBuffer cmdBuffer) const {
@@ -0,0 +1,324 @@
+#include "RenderPasses/HiZPass.h"
+
+HiZPass::HiZPass(EvDevice &device, uint32_t width, uint32_t height, uint32_t nrFrames,
+                 const EvFrameBufferAttachment &depthAttachment, VkDescriptorSetLayout frameSetLayout)
+                 : device(device), depthAttachment(depthAttachment) {
+    createPyramid(width, height);
+    createCullBuffers(nrFrames);
+    createSampler();
+    createDescriptorSetLayouts();
+    createPipelineLayouts(frameSetLayout);
+    createPipelines();
+    createDescriptorPool(nrFrames);
+    allocateDescriptorSets(nrFrames);
+    createDescriptorSets(nrFrames);
+}
+
+HiZPass::~HiZPass() {
+    vkDestroyPipeline(device.vkDevice, buildPipeline.get(), nullptr);
+    vkDestroyPipeline(device.vkDevice, cullPipeline.get(), nullptr);
+    pyramid.destroy(device);
+    vmaDestroyBuffer(device.vmaAllocator, cullBuffers.indirectBuffer, cullBuffers.indirectMemory);
+    for(int i=0; i<cullBuffers.statsBuffers.size(); i++) {
+        vmaUnmapMemory(device.vmaAllocator, cullBuffers.statsMemory[i]);
+        vmaDestroyBuffer(device.vmaAllocator, cullBuffers.statsBuffers[i], cullBuffers.statsMemory[i]);
+    }
+    vkDestroyDescriptorPool(device.vkDevice, descriptorPool, nullptr);
+    vkDestroySampler(device.vkDevice, pointSampler, nullptr);
+    vkDestroyShaderModule(device.vkDevice, buildShader, nullptr);
+    vkDestroyShaderModule(device.vkDevice, cullShader, nullptr);
+    vkDestroyDescriptorSetLayout(device.vkDevice, buildDescriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device.vkDevice, cullDescriptorSetLayout, nullptr);
+    vkDestroyPipelineLayout(device.vkDevice, buildPipelineLayout, nullptr);
+    vkDestroyPipelineLayout(device.vkDevice, cullPipelineLayout, nullptr);
+}
+
+void HiZPass::createPyramid(uint32_t width, uint32_t height) {
+    // The first level already halves the depth buffer
+    pyramid.depthWidth = width;
+    pyramid.depthHeight = height;
+    pyramid.width = std::max(width / 2, 1u);
+    pyramid.height = std::max(height / 2, 1u);
+    pyramid.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(pyramid.width, pyramid.height)))) + 1;
+
+    pyramid.mipViews.resize(pyramid.mipLevels);
+
+    auto format = VK_FORMAT_R32_SFLOAT;
+    auto imageInfo = vks::initializers::imageCreateInfo(pyramid.width, pyramid.height, format, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+    imageInfo.mipLevels = pyramid.mipLevels;
+    device.createDeviceImage(imageInfo, &pyramid.image, &pyramid.imageMemory);
+    // The pyramid lives in general, it is both written and sampled by compute.
+    device.transitionImageLayout(pyramid.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, pyramid.mipLevels, 1);
+
+    auto viewInfo = vks::initializers::imageViewCreateInfo(pyramid.image, format, VK_IMAGE_ASPECT_COLOR_BIT);
+    viewInfo.subresourceRange.levelCount = pyramid.mipLevels;
+    vkCheck(vkCreateImageView(device.vkDevice, &viewInfo, nullptr, &pyramid.view));
+
+    for(uint32_t level=0; level<pyramid.mipLevels; level++) {
+        auto mipViewInfo = vks::initializers::imageViewCreateInfo(pyramid.image, format, VK_IMAGE_ASPECT_COLOR_BIT);
+        mipViewInfo.subresourceRange.baseMipLevel = level;
+        vkCheck(vkCreateImageView(device.vkDevice, &mipViewInfo, nullptr, &pyramid.mipViews[level]));
+    }
+}
+
+void HiZPass::createCullBuffers(uint32_t nrFrames) {
+    device.createDeviceBuffer(MAX_INSTANCES * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, &cullBuffers.indirectBuffer, &cullBuffers.indirectMemory);
+
+    cullBuffers.statsBuffers.resize(nrFrames);
+    cullBuffers.statsMemory.resize(nrFrames);
+    cullBuffers.mappedStats.resize(nrFrames);
+
+    for(int i=0; i<nrFrames; i++) {
+        device.createHostBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &cullBuffers.statsBuffers[i], &cullBuffers.statsMemory[i]);
+        vkCheck(vmaMapMemory(device.vmaAllocator, cullBuffers.statsMemory[i], (void**)&cullBuffers.mappedStats[i]));
+        *cullBuffers.mappedStats[i] = 0;
+    }
+}
+
+void HiZPass::createSampler() {
+    VkSamplerCreateInfo samplerInfo = vks::initializers::samplerCreateInfo(1.0f);
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.anisotropyEnable = VK_FALSE;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    vkCheck(vkCreateSampler(device.vkDevice, &samplerInfo, nullptr, &pointSampler));
+}
+
+void HiZPass::createDescriptorSetLayouts() {
+    {
+        VkDescriptorSetLayoutBinding inputBinding {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+
+        VkDescriptorSetLayoutBinding outputBinding {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {inputBinding, outputBinding};
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .bindingCount = static_cast<uint32_t>(bindings.size()),
+            .pBindings = bindings.data(),
+        };
+
+        vkCheck(vkCreateDescriptorSetLayout(device.vkDevice, &layoutInfo, nullptr, &buildDescriptorSetLayout));
+    }
+    {
+        std::array<VkDescriptorSetLayoutBinding, 3> bindings {
+            VkDescriptorSetLayoutBinding {
+                .binding = 0,
+                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .descriptorCount = 1,
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            },
+            VkDescriptorSetLayoutBinding {
+                .binding = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = 1,
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            },
+            VkDescriptorSetLayoutBinding {
+                .binding = 2,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = 1,
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            },
+        };
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .bindingCount = static_cast<uint32_t>(bindings.size()),
+            .pBindings = bindings.data(),
+        };
+
+        vkCheck(vkCreateDescriptorSetLayout(device.vkDevice, &layoutInfo, nullptr, &cullDescriptorSetLayout));
+    }
+}
+
+void HiZPass::createPipelineLayouts(VkDescriptorSetLayout frameSetLayout) {
+    VkPushConstantRange buildPushRange {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(BuildPush),
+    };
+
+    VkPipelineLayoutCreateInfo buildLayoutInfo {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &buildDescriptorSetLayout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &buildPushRange,
+    };
+
+    vkCheck(vkCreatePipelineLayout(device.vkDevice, &buildLayoutInfo, nullptr, &buildPipelineLayout));
+
+    VkPushConstantRange cullPushRange {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(CullPush),
+    };
+
+    std::array<VkDescriptorSetLayout, 2> cullSetLayouts { frameSetLayout, cullDescriptorSetLayout };
+    VkPipelineLayoutCreateInfo cullLayoutInfo {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = static_cast<uint32_t>(cullSetLayouts.size()),
+        .pSetLayouts = cullSetLayouts.data(),
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &cullPushRange,
+    };
+
+    vkCheck(vkCreatePipelineLayout(device.vkDevice, &cullLayoutInfo, nullptr, &cullPipelineLayout));
+}
+
+void HiZPass::createPipelines() {
+    buildPipeline = device.pipelineBuilder->submit([this]() {
+        buildShader = device.createShaderModule("assets/shaders_bin/hiz.comp.spv");
+
+        auto buildPipelineInfo = vks::initializers::computePipelineCreateInfo(buildPipelineLayout);
+        buildPipelineInfo.stage = vks::initializers::pipelineShaderStageCreateInfo(buildShader, VK_SHADER_STAGE_COMPUTE_BIT);
+        VkPipeline vkPipeline;
+        vkCheck(vkCreateComputePipelines(device.vkDevice, device.vkPipelineCache, 1, &buildPipelineInfo, nullptr, &vkPipeline));
+        return vkPipeline;
+    });
+
+    cullPipeline = device.pipelineBuilder->submit([this]() {
+        cullShader = device.createShaderModule("assets/shaders_bin/cull.comp.spv");
+
+        auto cullPipelineInfo = vks::initializers::computePipelineCreateInfo(cullPipelineLayout);
+        cullPipelineInfo.stage = vks::initializers::pipelineShaderStageCreateInfo(cullShader, VK_SHADER_STAGE_COMPUTE_BIT);
+        VkPipeline vkPipeline;
+        vkCheck(vkCreateComputePipelines(device.vkDevice, device.vkPipelineCache, 1, &cullPipelineInfo, nullptr, &vkPipeline));
+        return vkPipeline;
+    });
+}
+
+void HiZPass::createDescriptorPool(uint32_t nrFrames) {
+    // The number of levels depends on the resolution, so the pass keeps its own pool
+    // that is simply reset when the swapchain is recreated.
+    std::array<VkDescriptorPoolSize, 3> poolSizes {
+        VkDescriptorPoolSize { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_LEVELS + nrFrames },
+        VkDescriptorPoolSize { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_LEVELS },
+        VkDescriptorPoolSize { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nrFrames * 2 },
+    };
+
+    VkDescriptorPoolCreateInfo poolInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = MAX_LEVELS + nrFrames,
+        .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
+        .pPoolSizes = poolSizes.data(),
+    };
+
+    vkCheck(vkCreateDescriptorPool(device.vkDevice, &poolInfo, nullptr, &descriptorPool));
+}
+
+void HiZPass::allocateDescriptorSets(uint32_t nrFrames) {
+    assert(pyramid.mipLevels <= MAX_LEVELS);
+    buildDescriptorSets.resize(pyramid.mipLevels);
+    std::vector<VkDescriptorSetLayout> buildLayouts(buildDescriptorSets.size(), buildDescriptorSetLayout);
+    auto buildAllocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, buildLayouts.data(), buildLayouts.size());
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &buildAllocInfo, buildDescriptorSets.data()));
+
+    cullDescriptorSets.resize(nrFrames);
+    std::vector<VkDescriptorSetLayout> cullLayouts(nrFrames, cullDescriptorSetLayout);
+    auto cullAllocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, cullLayouts.data(), cullLayouts.size());
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &cullAllocInfo, cullDescriptorSets.data()));
+}
+
+void HiZPass::createDescriptorSets(uint32_t nrFrames) {
+    for(uint32_t level=0; level<pyramid.mipLevels; level++) {
+        // level 0 reduces the depth buffer itself, every other level the one before it. The depth buffer
+        // is sampled in the read only depth layout, the forward pass tests against it without a transition.
+        auto inputInfo = level == 0
+                ? vks::initializers::descriptorImageInfo(pointSampler, depthAttachment.view, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL)
+                : vks::initializers::descriptorImageInfo(pointSampler, pyramid.mipViews[level - 1], VK_IMAGE_LAYOUT_GENERAL);
+        auto outputInfo = vks::initializers::descriptorImageInfo(nullptr, pyramid.mipViews[level], VK_IMAGE_LAYOUT_GENERAL);
+
+        auto descriptorSet = buildDescriptorSets[level];
+        std::array<VkWriteDescriptorSet, 2> writes {
+            vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &inputInfo),
+            vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &outputInfo),
+        };
+        vkUpdateDescriptorSets(device.vkDevice, writes.size(), writes.data(), 0, nullptr);
+    }
+
+    for(int i=0; i<nrFrames; i++) {
+        auto pyramidInfo = vks::initializers::descriptorImageInfo(pointSampler, pyramid.view, VK_IMAGE_LAYOUT_GENERAL);
+        VkDescriptorBufferInfo indirectInfo { .buffer = cullBuffers.indirectBuffer, .offset = 0, .range = VK_WHOLE_SIZE };
+        VkDescriptorBufferInfo statsInfo { .buffer = cullBuffers.statsBuffers[i], .offset = 0, .range = VK_WHOLE_SIZE };
+
+        std::array<VkWriteDescriptorSet, 3> writes {
+            vks::initializers::writeDescriptorSet(cullDescriptorSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &pyramidInfo),
+            vks::initializers::writeDescriptorSet(cullDescriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &indirectInfo),
+            vks::initializers::writeDescriptorSet(cullDescriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &statsInfo),
+        };
+        vkUpdateDescriptorSets(device.vkDevice, writes.size(), writes.data(), 0, nullptr);
+    }
+}
+
+void HiZPass::recreateFramebuffer(uint32_t width, uint32_t height, uint32_t nrFrames, const EvFrameBufferAttachment &depthAttachment) {
+    this->depthAttachment = depthAttachment;
+    vkCheck(vkResetDescriptorPool(device.vkDevice, descriptorPool, 0));
+    pyramid.destroy(device);
+    createPyramid(width, height);
+    allocateDescriptorSets(nrFrames);
+    createDescriptorSets(nrFrames);
+}
+
+void HiZPass::run(VkCommandBuffer cmdBuffer, uint32_t frameIdx, const EvFrameRing &frameRing, uint32_t instanceCount, bool cullingEnabled) const {
+    assert(instanceCount <= MAX_INSTANCES);
+    if (cullingEnabled) {
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, buildPipeline.get());
+
+        BuildPush push {
+            .sizes = glm::ivec4(pyramid.depthWidth, pyramid.depthHeight, 0, 0),
+        };
+        for(uint32_t level=0; level<pyramid.mipLevels; level++) {
+            const int32_t outputWidth = std::max(static_cast<int32_t>(pyramid.width >> level), 1);
+            const int32_t outputHeight = std::max(static_cast<int32_t>(pyramid.height >> level), 1);
+            push.sizes.z = outputWidth;
+            push.sizes.w = outputHeight;
+
+            vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, buildPipelineLayout, 0, 1, &buildDescriptorSets[level], 0, nullptr);
+            vkCmdPushConstants(cmdBuffer, buildPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+            vkCmdDispatch(cmdBuffer, (outputWidth + 7) / 8, (outputHeight + 7) / 8, 1);
+
+            auto levelBarrier = vks::initializers::imageMemoryBarrier(pyramid.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
+            levelBarrier.subresourceRange.baseMipLevel = level;
+            levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &levelBarrier);
+
+            push.sizes.x = outputWidth;
+            push.sizes.y = outputHeight;
+        }
+    }
+
+    if (instanceCount == 0) return;
+
+    CullPush cullPush {
+        .params = glm::uvec4(pyramid.width, pyramid.height, instanceCount, cullingEnabled ? 1 : 0),
+    };
+
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline.get());
+    frameRing.bind(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 1, 1, &cullDescriptorSets[frameIdx], 0, nullptr);
+    vkCmdPushConstants(cmdBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(cullPush), &cullPush);
+    vkCmdDispatch(cmdBuffer, (instanceCount + 63) / 64, 1, 1);
+
+    // the draw commands are consumed by the forward pass, the visible count by the host once the frame is done.
+    auto memoryBarrier = vks::initializers::memoryBarrier();
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
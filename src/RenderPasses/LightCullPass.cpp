@@ -0,0 +1,107 @@
+#include "RenderPasses/LightCullPass.h"
+
+LightCullPass::LightCullPass(EvDevice &device, VkDescriptorSetLayout frameSetLayout, VkDescriptorSetLayout lightSetLayout)
+    : device(device) {
+    createClusterBuffers();
+    createDescriptorSetLayout();
+    createPipelineLayout(frameSetLayout, lightSetLayout);
+    createPipeline();
+    createDescriptorSet();
+}
+
+LightCullPass::~LightCullPass() {
+    vkDestroyPipeline(device.vkDevice, pipeline.get(), nullptr);
+    vmaDestroyBuffer(device.vmaAllocator, clusterBuffers.countBuffer, clusterBuffers.countMemory);
+    vmaDestroyBuffer(device.vmaAllocator, clusterBuffers.indexBuffer, clusterBuffers.indexMemory);
+    vkDestroyShaderModule(device.vkDevice, cullShader, nullptr);
+    vkDestroyDescriptorSetLayout(device.vkDevice, clusterDescriptorSetLayout, nullptr);
+    vkDestroyPipelineLayout(device.vkDevice, pipelineLayout, nullptr);
+}
+
+void LightCullPass::createClusterBuffers() {
+    device.createDeviceBuffer(CLUSTER_COUNT * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &clusterBuffers.countBuffer, &clusterBuffers.countMemory);
+    device.createDeviceBuffer(CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &clusterBuffers.indexBuffer, &clusterBuffers.indexMemory);
+}
+
+void LightCullPass::createDescriptorSetLayout() {
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings {
+        VkDescriptorSetLayoutBinding {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+        },
+        VkDescriptorSetLayoutBinding {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+        },
+    };
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = static_cast<uint32_t>(bindings.size()),
+        .pBindings = bindings.data(),
+    };
+
+    vkCheck(vkCreateDescriptorSetLayout(device.vkDevice, &layoutInfo, nullptr, &clusterDescriptorSetLayout));
+}
+
+void LightCullPass::createPipelineLayout(VkDescriptorSetLayout frameSetLayout, VkDescriptorSetLayout lightSetLayout) {
+    std::array<VkDescriptorSetLayout, 3> setLayouts { frameSetLayout, clusterDescriptorSetLayout, lightSetLayout };
+    VkPipelineLayoutCreateInfo layoutInfo {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
+        .pSetLayouts = setLayouts.data(),
+        .pushConstantRangeCount = 0,
+    };
+
+    vkCheck(vkCreatePipelineLayout(device.vkDevice, &layoutInfo, nullptr, &pipelineLayout));
+}
+
+void LightCullPass::createPipeline() {
+    pipeline = device.pipelineBuilder->submit([this]() {
+        cullShader = device.createShaderModule("assets/shaders_bin/lightcull.comp.spv");
+
+        auto pipelineInfo = vks::initializers::computePipelineCreateInfo(pipelineLayout);
+        pipelineInfo.stage = vks::initializers::pipelineShaderStageCreateInfo(cullShader, VK_SHADER_STAGE_COMPUTE_BIT);
+        VkPipeline vkPipeline;
+        vkCheck(vkCreateComputePipelines(device.vkDevice, device.vkPipelineCache, 1, &pipelineInfo, nullptr, &vkPipeline));
+        return vkPipeline;
+    });
+}
+
+void LightCullPass::createDescriptorSet() {
+    auto allocInfo = vks::initializers::descriptorSetAllocateInfo(device.vkDescriptorPool, &clusterDescriptorSetLayout, 1);
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, &clusterDescriptorSet));
+
+    VkDescriptorBufferInfo countInfo { .buffer = clusterBuffers.countBuffer, .offset = 0, .range = VK_WHOLE_SIZE };
+    VkDescriptorBufferInfo indexInfo { .buffer = clusterBuffers.indexBuffer, .offset = 0, .range = VK_WHOLE_SIZE };
+
+    std::array<VkWriteDescriptorSet, 2> writes {
+        vks::initializers::writeDescriptorSet(clusterDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &countInfo),
+        vks::initializers::writeDescriptorSet(clusterDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &indexInfo),
+    };
+    vkUpdateDescriptorSets(device.vkDevice, writes.size(), writes.data(), 0, nullptr);
+}
+
+void LightCullPass::run(VkCommandBuffer cmdBuffer, const EvFrameRing &frameRing, const EvStorageMirror &lights) const {
+    // The write after read hazard on the clusters against the previous frame is covered by
+    // the barrier at the start of every frame.
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.get());
+    frameRing.bind(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0);
+    bindClusters(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 1);
+    lights.bind(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 2);
+    vkCmdDispatch(cmdBuffer, (CLUSTER_COUNT + 63) / 64, 1, 1);
+
+    // the clusters are read by the forward pass
+    auto memoryBarrier = vks::initializers::memoryBarrier();
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+void LightCullPass::bindClusters(VkCommandBuffer cmdBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set) const {
+    vkCmdBindDescriptorSets(cmdBuffer, bindPoint, layout, set, 1, &clusterDescriptorSet, 0, nullptr);
+}
@@ -0,0 +1,298 @@
+#include "RenderPasses/MergedPass.h"
+
+MergedPass::MergedPass(EvDevice &device, VkFormat swapchainFormat, VkFormat depthFormat, VkFormat colorFormat, VkFormat bloomFormat)
+                       : device(device) {
+    createRenderPass(swapchainFormat, depthFormat, colorFormat, bloomFormat);
+    createDescriptorSetLayout();
+    allocateDescriptorSet();
+    createPipeline();
+}
+
+MergedPass::~MergedPass() {
+    vkDestroyPipeline(device.vkDevice, pipeline.get(), nullptr);
+    vkDestroyShaderModule(device.vkDevice, vertShader, nullptr);
+    vkDestroyShaderModule(device.vkDevice, fragShader, nullptr);
+    framebuffer.destroy(device);
+    vkDestroyRenderPass(device.vkDevice, renderPass, nullptr);
+    vkDestroyDescriptorSetLayout(device.vkDevice, descriptorSetLayout, nullptr);
+    vkDestroyPipelineLayout(device.vkDevice, pipelineLayout, nullptr);
+}
+
+void MergedPass::createRenderPass(VkFormat swapchainFormat, VkFormat depthFormat, VkFormat colorFormat, VkFormat bloomFormat) {
+    // The composition covers every pixel, and the overlay pass picks the image up after
+    VkAttachmentDescription swapchainDescription {
+            .format = swapchainFormat,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+
+    // Cleared and discarded, nothing outside of the render pass ever sees them. They end in the
+    // layouts the render graph expects them in, it leaves the transitions of transient images to us.
+    auto transientDescription = [](VkFormat format, VkImageLayout layout) {
+        auto description = vks::initializers::attachmentDescription(format, layout);
+        description.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        description.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        return description;
+    };
+
+    std::array<VkAttachmentDescription, 4> attachmentDescriptions {
+        swapchainDescription,
+        transientDescription(depthFormat, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL),
+        transientDescription(colorFormat, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+        transientDescription(bloomFormat, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+    };
+
+    auto depthWriteReference = vks::initializers::attachmentReference(1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    auto depthTestReference = vks::initializers::attachmentReference(1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+    std::array<VkAttachmentReference, 2> forwardReferences {
+        vks::initializers::attachmentReference(2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+        vks::initializers::attachmentReference(3, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+    };
+    std::array<VkAttachmentReference, 2> inputReferences {
+        vks::initializers::attachmentReference(2, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+        vks::initializers::attachmentReference(3, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+    };
+    auto swapchainReference = vks::initializers::attachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+    // Laid out like the separate passes, so the depth and forward pipelines only differ in the subpass
+    std::array<VkSubpassDescription, 3> subpasses {
+        VkSubpassDescription {
+            .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+            .colorAttachmentCount = 0,
+            .pDepthStencilAttachment = &depthWriteReference,
+        },
+        VkSubpassDescription {
+            .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+            .colorAttachmentCount = static_cast<uint32_t>(forwardReferences.size()),
+            .pColorAttachments = forwardReferences.data(),
+            .pDepthStencilAttachment = &depthTestReference,
+        },
+        VkSubpassDescription {
+            .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+            .inputAttachmentCount = static_cast<uint32_t>(inputReferences.size()),
+            .pInputAttachments = inputReferences.data(),
+            .colorAttachmentCount = 1,
+            .pColorAttachments = &swapchainReference,
+        },
+    };
+
+    // Every subpass only reads what the one before it wrote at the same pixel, so the tiles never wait on each other
+    std::array<VkSubpassDependency, 3> dependencies {
+        VkSubpassDependency {
+            .srcSubpass = VK_SUBPASS_EXTERNAL,
+            .dstSubpass = COMPOSE_SUBPASS,
+            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        },
+        VkSubpassDependency {
+            .srcSubpass = DEPTH_SUBPASS,
+            .dstSubpass = FORWARD_SUBPASS,
+            .srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+            .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
+        },
+        VkSubpassDependency {
+            .srcSubpass = FORWARD_SUBPASS,
+            .dstSubpass = COMPOSE_SUBPASS,
+            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+            .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
+        },
+    };
+
+    VkRenderPassCreateInfo renderPassInfo {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .attachmentCount = static_cast<uint32_t>(attachmentDescriptions.size()),
+        .pAttachments = attachmentDescriptions.data(),
+        .subpassCount = static_cast<uint32_t>(subpasses.size()),
+        .pSubpasses = subpasses.data(),
+        .dependencyCount = static_cast<uint32_t>(dependencies.size()),
+        .pDependencies = dependencies.data(),
+    };
+
+    vkCheck(vkCreateRenderPass(device.vkDevice, &renderPassInfo, nullptr, &renderPass));
+}
+
+void MergedPass::createDescriptorSetLayout() {
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings {
+        VkDescriptorSetLayoutBinding {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        },
+        VkDescriptorSetLayoutBinding {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        },
+    };
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .bindingCount = static_cast<uint32_t>(bindings.size()),
+            .pBindings = bindings.data(),
+    };
+
+    vkCheck(vkCreateDescriptorSetLayout(device.vkDevice, &layoutInfo, nullptr, &descriptorSetLayout));
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &descriptorSetLayout,
+        .pushConstantRangeCount = 0,
+    };
+
+    vkCheck(vkCreatePipelineLayout(device.vkDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout));
+}
+
+void MergedPass::allocateDescriptorSet() {
+    VkDescriptorSetAllocateInfo allocInfo {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool = device.vkDescriptorPool,
+            .descriptorSetCount = 1,
+            .pSetLayouts = &descriptorSetLayout,
+    };
+
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, &descriptorSet));
+}
+
+void MergedPass::createPipeline() {
+    pipeline = device.pipelineBuilder->submit([this]() {
+        vertShader = device.createShaderModule("assets/shaders_bin/screenfill.vert.spv");
+        fragShader = device.createShaderModule("assets/shaders_bin/compose.frag.spv");
+
+        auto inputAssembly = vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
+        auto rasterization = vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE, 0);
+        auto blendAttachment = vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE);
+        auto colorBlend = vks::initializers::pipelineColorBlendStateCreateInfo(1, &blendAttachment);
+        auto depthStencil = vks::initializers::pipelineDepthStencilStateCreateInfo(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+        auto viewport = vks::initializers::pipelineViewportStateCreateInfo(1, 1, 0);
+        auto multisample = vks::initializers::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT, 0);
+        std::vector<VkDynamicState> dynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        auto dynamicState = vks::initializers::pipelineDynamicStateCreateInfo(dynamicStateEnables);
+        std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages {
+            vks::initializers::pipelineShaderStageCreateInfo(vertShader, VK_SHADER_STAGE_VERTEX_BIT),
+            vks::initializers::pipelineShaderStageCreateInfo(fragShader, VK_SHADER_STAGE_FRAGMENT_BIT),
+        };
+        auto vertexInput = vks::initializers::pipelineVertexInputStateCreateInfo();
+
+        VkGraphicsPipelineCreateInfo pipelineInfo {
+            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            .stageCount = static_cast<uint32_t>(shaderStages.size()),
+            .pStages = shaderStages.data(),
+            .pVertexInputState = &vertexInput,
+            .pInputAssemblyState = &inputAssembly,
+            .pViewportState = &viewport,
+            .pRasterizationState = &rasterization,
+            .pMultisampleState = &multisample,
+            .pDepthStencilState = &depthStencil,
+            .pColorBlendState = &colorBlend,
+            .pDynamicState = &dynamicState,
+            .layout = pipelineLayout,
+            .renderPass = renderPass,
+            .subpass = COMPOSE_SUBPASS,
+        };
+
+        VkPipeline vkPipeline;
+        vkCheck(vkCreateGraphicsPipelines(device.vkDevice, device.vkPipelineCache, 1, &pipelineInfo, nullptr, &vkPipeline));
+        return vkPipeline;
+    });
+}
+
+void MergedPass::recreateFramebuffer(uint32_t width, uint32_t height, const std::vector<VkImageView> &swapchainImageViews,
+                                     const EvFrameBufferAttachment &depthAttachment, const EvFrameBufferAttachment &colorAttachment,
+                                     const EvFrameBufferAttachment &bloomAttachment) {
+    framebuffer.destroy(device);
+    framebuffer.width = width;
+    framebuffer.height = height;
+
+    framebuffer.vkFrameBuffers.resize(swapchainImageViews.size());
+    for(size_t i=0; i<swapchainImageViews.size(); i++) {
+        std::array<VkImageView, 4> attachments { swapchainImageViews[i], depthAttachment.view, colorAttachment.view, bloomAttachment.view };
+
+        VkFramebufferCreateInfo framebufferInfo {
+                .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+                .renderPass = renderPass,
+                .attachmentCount = static_cast<uint32_t>(attachments.size()),
+                .pAttachments = attachments.data(),
+                .width = width,
+                .height = height,
+                .layers = 1,
+        };
+
+        vkCheck(vkCreateFramebuffer(device.vkDevice, &framebufferInfo, nullptr, &framebuffer.vkFrameBuffers[i]));
+    }
+
+    auto colorInfo = vks::initializers::descriptorImageInfo(VK_NULL_HANDLE, colorAttachment.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    auto bloomInfo = vks::initializers::descriptorImageInfo(VK_NULL_HANDLE, bloomAttachment.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    std::array<VkWriteDescriptorSet, 2> writes {
+        vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 0, &colorInfo),
+        vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 1, &bloomInfo),
+    };
+    vkUpdateDescriptorSets(device.vkDevice, writes.size(), writes.data(), 0, nullptr);
+}
+
+void MergedPass::beginPass(VkCommandBuffer commandBuffer, uint32_t imageIdx) const {
+    assert(imageIdx < framebuffer.vkFrameBuffers.size() && "the framebuffers only exist while the passes are merged");
+    // The same clears as the separate depth and forward passes
+    std::array<VkClearValue, 4> clearValues {
+        VkClearValue { .color = {0.0f, 0.0f, 0.0f, 0.0f} },
+        VkClearValue { .depthStencil = {1.0f, 0} },
+        VkClearValue { .color = {0.0f, 0.0f, 0.0f, 0.0f} },
+        VkClearValue { .color = {0.0f, 0.0f, 0.0f, 0.0f} },
+    };
+
+    VkRenderPassBeginInfo renderPassInfo {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            .renderPass = renderPass,
+            .framebuffer = framebuffer.vkFrameBuffers[imageIdx],
+            .renderArea = {
+                    .offset = {0,0},
+                    .extent = {framebuffer.width, framebuffer.height},
+            },
+            .clearValueCount = static_cast<uint32_t>(clearValues.size()),
+            .pClearValues = clearValues.data(),
+    };
+    // Flipped like the separate passes, the composition draws one triangle over everything either way
+    VkViewport viewport {
+            .x = 0.0f,
+            .y = static_cast<float>(framebuffer.height),
+            .width = static_cast<float>(framebuffer.width),
+            .height = -static_cast<float>(framebuffer.height),
+            .minDepth = 0.0f,
+            .maxDepth = 1.0f,
+    };
+    VkRect2D scissor{{0,0}, {framebuffer.width, framebuffer.height}};
+
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+void MergedPass::nextSubpass(VkCommandBuffer commandBuffer) const {
+    vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+}
+
+void MergedPass::compose(VkCommandBuffer commandBuffer) const {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.get());
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+}
+
+void MergedPass::endPass(VkCommandBuffer commandBuffer) const {
+    vkCmdEndRenderPass(commandBuffer);
+}
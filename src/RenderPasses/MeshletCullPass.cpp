@@ -0,0 +1,159 @@
+#include "RenderPasses/MeshletCullPass.h"
+
+MeshletCullPass::MeshletCullPass(EvDevice &device, uint32_t nrFrames, VkDescriptorSetLayout frameSetLayout,
+                                 VkBuffer meshletBuffer, VkBuffer instanceDrawBuffer)
+    : device(device) {
+    createDrawBuffers(nrFrames);
+    createDescriptorSetLayout();
+    createPipelineLayout(frameSetLayout);
+    createPipeline();
+    createDescriptorSets(nrFrames, meshletBuffer, instanceDrawBuffer);
+}
+
+MeshletCullPass::~MeshletCullPass() {
+    vkDestroyPipeline(device.vkDevice, pipeline.get(), nullptr);
+    vmaDestroyBuffer(device.vmaAllocator, drawBuffers.drawBuffer, drawBuffers.drawMemory);
+    vmaDestroyBuffer(device.vmaAllocator, drawBuffers.countBuffer, drawBuffers.countMemory);
+    for(int i=0; i<drawBuffers.statsBuffers.size(); i++) {
+        vmaUnmapMemory(device.vmaAllocator, drawBuffers.statsMemory[i]);
+        vmaDestroyBuffer(device.vmaAllocator, drawBuffers.statsBuffers[i], drawBuffers.statsMemory[i]);
+    }
+    vkDestroyShaderModule(device.vkDevice, cullShader, nullptr);
+    vkDestroyDescriptorSetLayout(device.vkDevice, descriptorSetLayout, nullptr);
+    vkDestroyPipelineLayout(device.vkDevice, pipelineLayout, nullptr);
+}
+
+void MeshletCullPass::createDrawBuffers(uint32_t nrFrames) {
+    device.createDeviceBuffer(BATCH_COUNT * MAX_DRAWS_PER_BATCH * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                              &drawBuffers.drawBuffer, &drawBuffers.drawMemory);
+    // Cleared with a fill at the start of every run
+    device.createDeviceBuffer(BATCH_COUNT * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              &drawBuffers.countBuffer, &drawBuffers.countMemory);
+
+    drawBuffers.statsBuffers.resize(nrFrames);
+    drawBuffers.statsMemory.resize(nrFrames);
+    drawBuffers.mappedStats.resize(nrFrames);
+
+    for(int i=0; i<nrFrames; i++) {
+        device.createHostBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &drawBuffers.statsBuffers[i], &drawBuffers.statsMemory[i]);
+        vkCheck(vmaMapMemory(device.vmaAllocator, drawBuffers.statsMemory[i], (void**)&drawBuffers.mappedStats[i]));
+        *drawBuffers.mappedStats[i] = 0;
+    }
+}
+
+void MeshletCullPass::createDescriptorSetLayout() {
+    // meshlets, instance draws, meshlet draws, draw counts, stats
+    std::array<VkDescriptorSetLayoutBinding, 5> bindings {};
+    for(uint32_t i=0; i<bindings.size(); i++) {
+        bindings[i] = VkDescriptorSetLayoutBinding {
+            .binding = i,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = static_cast<uint32_t>(bindings.size()),
+        .pBindings = bindings.data(),
+    };
+
+    vkCheck(vkCreateDescriptorSetLayout(device.vkDevice, &layoutInfo, nullptr, &descriptorSetLayout));
+}
+
+void MeshletCullPass::createPipelineLayout(VkDescriptorSetLayout frameSetLayout) {
+    VkPushConstantRange pushRange {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(CullPush),
+    };
+
+    std::array<VkDescriptorSetLayout, 2> setLayouts { frameSetLayout, descriptorSetLayout };
+    VkPipelineLayoutCreateInfo layoutInfo {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
+        .pSetLayouts = setLayouts.data(),
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushRange,
+    };
+
+    vkCheck(vkCreatePipelineLayout(device.vkDevice, &layoutInfo, nullptr, &pipelineLayout));
+}
+
+void MeshletCullPass::createPipeline() {
+    pipeline = device.pipelineBuilder->submit([this]() {
+        cullShader = device.createShaderModule("assets/shaders_bin/meshlet_cull.comp.spv");
+
+        auto pipelineInfo = vks::initializers::computePipelineCreateInfo(pipelineLayout);
+        pipelineInfo.stage = vks::initializers::pipelineShaderStageCreateInfo(cullShader, VK_SHADER_STAGE_COMPUTE_BIT);
+        VkPipeline vkPipeline;
+        vkCheck(vkCreateComputePipelines(device.vkDevice, device.vkPipelineCache, 1, &pipelineInfo, nullptr, &vkPipeline));
+        return vkPipeline;
+    });
+}
+
+void MeshletCullPass::createDescriptorSets(uint32_t nrFrames, VkBuffer meshletBuffer, VkBuffer instanceDrawBuffer) {
+    descriptorSets.resize(nrFrames);
+    std::vector<VkDescriptorSetLayout> layouts(nrFrames, descriptorSetLayout);
+    auto allocInfo = vks::initializers::descriptorSetAllocateInfo(device.vkDescriptorPool, layouts.data(), layouts.size());
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, descriptorSets.data()));
+
+    for(int i=0; i<nrFrames; i++) {
+        std::array<VkDescriptorBufferInfo, 5> bufferInfos {
+            VkDescriptorBufferInfo { .buffer = meshletBuffer, .offset = 0, .range = VK_WHOLE_SIZE },
+            VkDescriptorBufferInfo { .buffer = instanceDrawBuffer, .offset = 0, .range = VK_WHOLE_SIZE },
+            VkDescriptorBufferInfo { .buffer = drawBuffers.drawBuffer, .offset = 0, .range = VK_WHOLE_SIZE },
+            VkDescriptorBufferInfo { .buffer = drawBuffers.countBuffer, .offset = 0, .range = VK_WHOLE_SIZE },
+            VkDescriptorBufferInfo { .buffer = drawBuffers.statsBuffers[i], .offset = 0, .range = VK_WHOLE_SIZE },
+        };
+
+        std::array<VkWriteDescriptorSet, 5> writes {};
+        for(uint32_t b=0; b<writes.size(); b++) {
+            writes[b] = vks::initializers::writeDescriptorSet(descriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, b, &bufferInfos[b]);
+        }
+        vkUpdateDescriptorSets(device.vkDevice, writes.size(), writes.data(), 0, nullptr);
+    }
+}
+
+void MeshletCullPass::run(VkCommandBuffer cmdBuffer, uint32_t frameIdx, const EvFrameRing &frameRing, uint32_t instanceCount) const {
+    // The instance culling right before wrote which instances survived, the render graph does not track buffers
+    auto instanceBarrier = vks::initializers::memoryBarrier();
+    instanceBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    instanceBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &instanceBarrier, 0, nullptr, 0, nullptr);
+
+    vkCmdFillBuffer(cmdBuffer, drawBuffers.countBuffer, 0, VK_WHOLE_SIZE, 0);
+
+    auto clearBarrier = vks::initializers::memoryBarrier();
+    clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+    if (instanceCount > 0) {
+        CullPush push {
+            .params = glm::uvec4(instanceCount, MAX_DRAWS_PER_BATCH, 0, 0),
+        };
+
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.get());
+        frameRing.bind(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 1, 1, &descriptorSets[frameIdx], 0, nullptr);
+        vkCmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+        // One workgroup per instance, its invocations stride over the meshlets
+        vkCmdDispatch(cmdBuffer, instanceCount, 1, 1);
+    }
+
+    // the draws and their counts are consumed by the forward pass, the visible count by the host once the frame is done.
+    auto memoryBarrier = vks::initializers::memoryBarrier();
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+void MeshletCullPass::draw(VkCommandBuffer cmdBuffer, VkIndexType indexType) const {
+    const uint32_t batch = indexType == VK_INDEX_TYPE_UINT32 ? 1 : 0;
+    vkCmdDrawIndexedIndirectCount(cmdBuffer,
+                                  drawBuffers.drawBuffer, batch * MAX_DRAWS_PER_BATCH * sizeof(VkDrawIndexedIndirectCommand),
+                                  drawBuffers.countBuffer, batch * sizeof(uint32_t),
+                                  MAX_DRAWS_PER_BATCH, sizeof(VkDrawIndexedIndirectCommand));
+}
@@ -1,29 +1,27 @@
 #include "RenderPasses/PostPass.h"
 
-PostPass::PostPass(EvDevice &device, uint32_t width, uint32_t height, uint32_t nrImages, VkFormat swapchainFormat,
-                   const std::vector<VkImageView> &swapchainImageViews,
-                   const std::vector<EvFrameBufferAttachment> &colorInputs,
-                   const std::vector<EvFrameBufferAttachment> &bloomInputs)
+PostPass::PostPass(EvDevice &device, uint32_t width, uint32_t height, uint32_t nrImages, VkFormat swapchainFormat, VkImageLayout presentLayout,
+                   const std::vector<VkImageView> &swapchainImageViews, const std::optional<Inputs>& inputs)
                        : device(device) {
-    createBuffer(width, height, nrImages, swapchainFormat, swapchainImageViews);
+    createBuffer(width, height, nrImages, swapchainFormat, presentLayout, swapchainImageViews);
     createDescriptorSetLayout();
-    allocateDescriptorSets(nrImages);
-    createDescriptorSets(nrImages, colorInputs, bloomInputs);
+    allocateDescriptorSets();
+    createDescriptorSets(inputs);
     createPipeline();
 }
 
 PostPass::~PostPass() {
+    vkDestroyPipeline(device.vkDevice, pipeline.get(), nullptr);
     vkDestroySampler(device.vkDevice, composedSampler, nullptr);
     vkDestroyShaderModule(device.vkDevice, vertShader, nullptr);
     vkDestroyShaderModule(device.vkDevice, fragShader, nullptr);
     framebuffer.destroy(device);
     vkDestroyDescriptorSetLayout(device.vkDevice, descriptorSetLayout, nullptr);
-    vkDestroyPipeline(device.vkDevice, pipeline, nullptr);
     vkDestroyPipelineLayout(device.vkDevice, pipelineLayout, nullptr);
 }
 
 
-void PostPass::createBuffer(uint32_t width, uint32_t height, uint32_t nrImages, VkFormat swapchainFormat,
+void PostPass::createBuffer(uint32_t width, uint32_t height, uint32_t nrImages, VkFormat swapchainFormat, VkImageLayout presentLayout,
                               const std::vector<VkImageView> &swapchainImageViews) {
     assert(nrImages > 0);
     framebuffer.width = width;
@@ -37,7 +35,7 @@ void PostPass::createBuffer(uint32_t width, uint32_t height, uint32_t nrImages,
             .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
             .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
             .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+            .finalLayout = presentLayout,
     };
 
     VkAttachmentReference colorAttachmentRef {
@@ -52,13 +50,14 @@ void PostPass::createBuffer(uint32_t width, uint32_t height, uint32_t nrImages,
             .pDepthStencilAttachment = nullptr,
     };
 
+    // Waits for the image to be acquired, and in the overlay pass for the merged pass to finish writing it
     VkSubpassDependency dependency {
             .srcSubpass = VK_SUBPASS_EXTERNAL,
             .dstSubpass = 0,
             .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
             .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            .srcAccessMask = 0,
-            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
     };
 
     VkRenderPassCreateInfo createInfo {
@@ -73,6 +72,11 @@ void PostPass::createBuffer(uint32_t width, uint32_t height, uint32_t nrImages,
 
     vkCheck(vkCreateRenderPass(device.vkDevice, &createInfo, nullptr, &framebuffer.vkRenderPass));
 
+    // Only the load and the initial layout differ, so the framebuffers and pipelines of the one above work with it
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    vkCheck(vkCreateRenderPass(device.vkDevice, &createInfo, nullptr, &framebuffer.overlayRenderPass));
+
     framebuffer.vkFrameBuffers.resize(nrImages);
     for(int i=0; i<nrImages; i++) {
         std::array<VkImageView, 1> attachments{
@@ -111,108 +115,109 @@ void PostPass::createDescriptorSetLayout() {
     vkCheck(vkCreateDescriptorSetLayout(device.vkDevice, &layoutInfo, nullptr, &descriptorSetLayout));
 }
 
-void PostPass::allocateDescriptorSets(uint32_t nrImages) {
-    descriptorSets.resize(nrImages);
-    bloomDescriptorSets.resize(nrImages);
-    std::vector<VkDescriptorSetLayout> descriptorSetLayouts(nrImages, descriptorSetLayout);
+void PostPass::allocateDescriptorSets() {
     VkDescriptorSetAllocateInfo allocInfo {
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
             .descriptorPool = device.vkDescriptorPool,
-            .descriptorSetCount = nrImages,
-            .pSetLayouts = descriptorSetLayouts.data(),
+            .descriptorSetCount = 1,
+            .pSetLayouts = &descriptorSetLayout,
     };
 
-    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, descriptorSets.data()));
-    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, bloomDescriptorSets.data()));
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, &descriptorSet));
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, &bloomDescriptorSet));
 
     VkSamplerCreateInfo samplerInfo = vks::initializers::samplerCreateInfo(device.vkPhysicalDeviceProperties.limits.maxSamplerAnisotropy);
-    samplerInfo.minFilter = VK_FILTER_NEAREST;
-    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    // The upsampling filter in the shader is built on bilinear taps
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
     samplerInfo.anisotropyEnable = false;
     vkCheck(vkCreateSampler(device.vkDevice, &samplerInfo, nullptr, &composedSampler));
 }
 
-void PostPass::createDescriptorSets(uint32_t nrImages, const std::vector<EvFrameBufferAttachment> &colorInputs, const std::vector<EvFrameBufferAttachment> &bloomInputs) {
-    assert(colorInputs.size() == nrImages);
-
-    for(int i=0; i<nrImages; i++) {
-        auto composedInfo = vks::initializers::descriptorImageInfo(composedSampler, colorInputs[i].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-        auto composedWrite = vks::initializers::writeDescriptorSet(descriptorSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &composedInfo);
+void PostPass::createDescriptorSets(const std::optional<Inputs>& inputs) {
+    if (!inputs) return;
+    auto composedInfo = vks::initializers::descriptorImageInfo(composedSampler, inputs->color.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    auto composedWrite = vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &composedInfo);
 
-        std::array<VkWriteDescriptorSet, 1> writes { composedWrite };
-        vkUpdateDescriptorSets(device.vkDevice, writes.size(), writes.data(), 0, nullptr);
-    }
+    auto bloomInfo = vks::initializers::descriptorImageInfo(composedSampler, inputs->bloom.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    auto bloomWrite = vks::initializers::writeDescriptorSet(bloomDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &bloomInfo);
 
-    for(int i=0; i<nrImages; i++) {
-        auto bloomInfo = vks::initializers::descriptorImageInfo(composedSampler, bloomInputs[i].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-        auto bloomWrite = vks::initializers::writeDescriptorSet(bloomDescriptorSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &bloomInfo);
-
-        std::array<VkWriteDescriptorSet, 1> writes { bloomWrite };
-        vkUpdateDescriptorSets(device.vkDevice, writes.size(), writes.data(), 0, nullptr);
-    }
+    std::array<VkWriteDescriptorSet, 2> writes { composedWrite, bloomWrite };
+    vkUpdateDescriptorSets(device.vkDevice, writes.size(), writes.data(), 0, nullptr);
 }
 
 void PostPass::createPipeline() {
+    VkPushConstantRange pushRange {
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .offset = 0,
+        .size = sizeof(Push),
+    };
+
     VkPipelineLayoutCreateInfo pipelineLayoutInfo {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
         .setLayoutCount = 1,
         .pSetLayouts = &descriptorSetLayout,
-        .pushConstantRangeCount = 0,
-        .pPushConstantRanges = nullptr,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushRange,
     };
 
     vkCheck(vkCreatePipelineLayout(device.vkDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout));
 
-    vertShader = device.createShaderModule("assets/shaders_bin/screenfill.vert.spv");
-    fragShader = device.createShaderModule("assets/shaders_bin/post.frag.spv");
-
-    auto inputAssembly = vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
-    auto rasterization = vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE, 0);
-    auto blendAttachment = vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_TRUE);
-    blendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-    blendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
-    auto colorBlend = vks::initializers::pipelineColorBlendStateCreateInfo(1, &blendAttachment);
-    auto depthStencil = vks::initializers::pipelineDepthStencilStateCreateInfo(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
-    auto viewport = vks::initializers::pipelineViewportStateCreateInfo(1, 1, 0);
-    auto multisample = vks::initializers::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT, 0);
-    std::vector<VkDynamicState> dynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
-    auto dynamicState = vks::initializers::pipelineDynamicStateCreateInfo(dynamicStateEnables);
-    std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages {
-        vks::initializers::pipelineShaderStageCreateInfo(vertShader, VK_SHADER_STAGE_VERTEX_BIT),
-        vks::initializers::pipelineShaderStageCreateInfo(fragShader, VK_SHADER_STAGE_FRAGMENT_BIT),
-    };
-    auto vertexInput = vks::initializers::pipelineVertexInputStateCreateInfo();
-
-    VkGraphicsPipelineCreateInfo pipelineInfo {
-        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-        .stageCount = static_cast<uint32_t>(shaderStages.size()),
-        .pStages = shaderStages.data(),
-        .pVertexInputState = &vertexInput,
-        .pInputAssemblyState = &inputAssembly,
-        .pViewportState = &viewport,
-        .pRasterizationState = &rasterization,
-        .pMultisampleState = &multisample,
-        .pDepthStencilState = &depthStencil,
-        .pColorBlendState = &colorBlend,
-        .pDynamicState = &dynamicState,
-        .layout = pipelineLayout,
-        .renderPass = framebuffer.vkRenderPass,
-        .subpass = 0
-    };
+    pipeline = device.pipelineBuilder->submit([this]() {
+        vertShader = device.createShaderModule("assets/shaders_bin/screenfill.vert.spv");
+        fragShader = device.createShaderModule("assets/shaders_bin/post.frag.spv");
+
+        auto inputAssembly = vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
+        auto rasterization = vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE, 0);
+        auto blendAttachment = vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_TRUE);
+        blendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        blendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        auto colorBlend = vks::initializers::pipelineColorBlendStateCreateInfo(1, &blendAttachment);
+        auto depthStencil = vks::initializers::pipelineDepthStencilStateCreateInfo(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+        auto viewport = vks::initializers::pipelineViewportStateCreateInfo(1, 1, 0);
+        auto multisample = vks::initializers::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT, 0);
+        std::vector<VkDynamicState> dynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        auto dynamicState = vks::initializers::pipelineDynamicStateCreateInfo(dynamicStateEnables);
+        std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages {
+            vks::initializers::pipelineShaderStageCreateInfo(vertShader, VK_SHADER_STAGE_VERTEX_BIT),
+            vks::initializers::pipelineShaderStageCreateInfo(fragShader, VK_SHADER_STAGE_FRAGMENT_BIT),
+        };
+        auto vertexInput = vks::initializers::pipelineVertexInputStateCreateInfo();
+
+        VkGraphicsPipelineCreateInfo pipelineInfo {
+            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            .stageCount = static_cast<uint32_t>(shaderStages.size()),
+            .pStages = shaderStages.data(),
+            .pVertexInputState = &vertexInput,
+            .pInputAssemblyState = &inputAssembly,
+            .pViewportState = &viewport,
+            .pRasterizationState = &rasterization,
+            .pMultisampleState = &multisample,
+            .pDepthStencilState = &depthStencil,
+            .pColorBlendState = &colorBlend,
+            .pDynamicState = &dynamicState,
+            .layout = pipelineLayout,
+            .renderPass = framebuffer.vkRenderPass,
+            .subpass = 0
+        };
 
-    vkCheck(vkCreateGraphicsPipelines(device.vkDevice, nullptr, 1, &pipelineInfo, nullptr, &pipeline));
+        VkPipeline vkPipeline;
+        vkCheck(vkCreateGraphicsPipelines(device.vkDevice, device.vkPipelineCache, 1, &pipelineInfo, nullptr, &vkPipeline));
+        return vkPipeline;
+    });
 }
 
-void PostPass::recreateFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages,
-                                   const std::vector<EvFrameBufferAttachment> &colorInputs,
-                                   const std::vector<EvFrameBufferAttachment> &bloomInputs, VkFormat swapchainFormat,
-                                   const std::vector<VkImageView> &swapchainImageViews) {
+void PostPass::recreateFramebuffer(uint32_t width, uint32_t height, uint32_t nrImages, const std::optional<Inputs>& inputs,
+                                   VkFormat swapchainFormat, VkImageLayout presentLayout, const std::vector<VkImageView> &swapchainImageViews) {
+    pipeline.wait();
     framebuffer.destroy(device);
-    createBuffer(width, height, nrImages, swapchainFormat, swapchainImageViews);
-    createDescriptorSets(nrImages, colorInputs, bloomInputs);
+    createBuffer(width, height, nrImages, swapchainFormat, presentLayout, swapchainImageViews);
+    createDescriptorSets(inputs);
 }
 
-void PostPass::beginPass(VkCommandBuffer commandBuffer, uint32_t imageIdx) const {
+void PostPass::beginPass(VkCommandBuffer commandBuffer, uint32_t imageIdx, glm::vec2 renderScale) const {
     assert(imageIdx >= 0 && imageIdx < framebuffer.vkFrameBuffers.size());
     std::array<VkClearValue, 1> clearValues {
             VkClearValue { .color = {0.0f, 0.0f, 0.0f, 0.0f}, },
@@ -242,15 +247,33 @@ void PostPass::beginPass(VkCommandBuffer commandBuffer, uint32_t imageIdx) const
     vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
     vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.get());
+    Push push { .renderScale = renderScale };
+    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(push), &push);
 
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[imageIdx], 0, nullptr);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
     vkCmdDraw(commandBuffer, 3, 1, 0, 0);
 
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &bloomDescriptorSets[imageIdx], 0, nullptr);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &bloomDescriptorSet, 0, nullptr);
     vkCmdDraw(commandBuffer, 3, 1, 0, 0);
 }
 
+void PostPass::beginOverlayPass(VkCommandBuffer commandBuffer, uint32_t imageIdx) const {
+    assert(imageIdx >= 0 && imageIdx < framebuffer.vkFrameBuffers.size());
+    VkRenderPassBeginInfo renderPassInfo {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            .renderPass = framebuffer.overlayRenderPass,
+            .framebuffer = framebuffer.vkFrameBuffers[imageIdx],
+            .renderArea = {
+                .offset = {0,0},
+                .extent = {framebuffer.width, framebuffer.height},
+            },
+    };
+
+    // The overlay sets its own viewport and scissor
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+}
+
 void PostPass::endPass(VkCommandBuffer commandBuffer) const {
     vkCmdEndRenderPass(commandBuffer);
 }
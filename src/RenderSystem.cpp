@@ -1,21 +1,47 @@
 #include "RenderSystem.h"
 
-RenderSystem::RenderSystem(EvDevice &device) : device(device) {
+RenderSystem::RenderSystem(EvDevice &device, uint32_t framesInFlight) : device(device) {
 
-    createSwapchain();
+    createSwapchain(framesInFlight);
 
     allocateCommandBuffers();
+    createTimelines();
+    createFrameRing();
+    textureTable = std::make_unique<EvTextureTable>(device, MAX_TEXTURES);
+    lightBuffer = std::make_unique<EvStorageMirror>(device, sizeof(LightComponent), INITIAL_LIGHT_CAPACITY, swapchain->getFramesInFlight(),
+                                                    VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT);
+    geometryArena = std::make_unique<EvGeometryArena>(device, MAX_ARENA_VERTICES, MAX_ARENA_INDICES, MAX_ARENA_MESHLETS);
+
+    // The passes are built around the attachments of the graph, so it is compiled first
+    renderGraph = std::make_unique<EvRenderGraph>(device);
+    graphSettings = getGraphSettings(UIInfo{});
+    compileGraph();
+    const auto& depth = renderGraph->getImage(graphImages.depth);
+    const auto& color = renderGraph->getImage(graphImages.color);
+    const auto& bloom = renderGraph->getImage(graphImages.bloom);
 
     uint32_t width = swapchain->extent.width;
     uint32_t height = swapchain->extent.height;
     uint32_t nrImages = swapchain->vkImages.size();
-    depthPass = std::make_unique<DepthPass>(device, width, height, nrImages);
-    forwardPass = std::make_unique<ForwardPass>(device, width, height, nrImages, depthPass->getFramebuffer().depths);
-    bloomPass = std::make_unique<BloomPass>(device, width, height, nrImages, forwardPass->getFramebuffer().blooms);
+    depthPass = std::make_unique<DepthPass>(device, width, height, depth, frameRing->getDescriptorSetLayout());
+    hiZPass = std::make_unique<HiZPass>(device, width, height, framesInFlight, depth, frameRing->getDescriptorSetLayout());
+    meshletCullPass = std::make_unique<MeshletCullPass>(device, framesInFlight, frameRing->getDescriptorSetLayout(),
+                                                        geometryArena->getMeshletBuffer(), hiZPass->getIndirectBuffer());
+    lightCullPass = std::make_unique<LightCullPass>(device, frameRing->getDescriptorSetLayout(), lightBuffer->getDescriptorSetLayout());
+    forwardPass = std::make_unique<ForwardPass>(device, width, height, color, bloom, depth,
+                                                frameRing->getDescriptorSetLayout(), textureTable->getDescriptorSetLayout(),
+                                                lightCullPass->getClusterSetLayout(), lightBuffer->getDescriptorSetLayout());
+    bloomPass = std::make_unique<BloomPass>(device, width, height, bloom, getGaussianImages());
+    // Only the final pass renders into the swapchain, so it is the only one with a framebuffer per image.
     postPass = std::make_unique<PostPass>(device, width, height, nrImages,
-                                            swapchain->surfaceFormat.format, swapchain->vkImageViews,
-                                            forwardPass->getFramebuffer().colors, forwardPass->getFramebuffer().blooms);
-    overlay = std::make_unique<EvOverlay>(device, postPass->getRenderPass(), nrImages);
+                                            swapchain->surfaceFormat.format, swapchain->presentLayout, swapchain->vkImageViews,
+                                            PostPass::Inputs { color, bloom });
+    // Its framebuffers only exist while the passes are merged, the pipelines are built up front
+    mergedPass = std::make_unique<MergedPass>(device, swapchain->surfaceFormat.format, depth.format, color.format, bloom.format);
+    depthPass->createMergedPipeline(mergedPass->getRenderPass(), MergedPass::DEPTH_SUBPASS);
+    forwardPass->createMergedPipelines(mergedPass->getRenderPass(), MergedPass::FORWARD_SUBPASS);
+    gpuProfiler = std::make_unique<EvGpuProfiler>(device, framesInFlight);
+    overlay = std::make_unique<EvOverlay>(device, postPass->getRenderPass(), nrImages, *gpuProfiler);
 
     m_whiteTexture = createTextureFromIntColor(0xffffff);
     m_normalTexture = createTextureFromIntColor((makeRGBA(128, 128, 255, 0)));
@@ -26,15 +52,18 @@ RenderSystem::RenderSystem(EvDevice &device) : device(device) {
 }
 
 RenderSystem::~RenderSystem() {
+    vkDestroySemaphore(device.vkDevice, forwardTimeline, nullptr);
+    vkDestroySemaphore(device.vkDevice, bloomTimeline, nullptr);
+    vkDestroySemaphore(device.vkDevice, postTimeline, nullptr);
     vmaDestroyImage(device.vmaAllocator, m_skybox.image, m_skybox.imageMemory);
     vkDestroyImageView(device.vkDevice, m_skybox.imageView, nullptr);
     vkDestroySampler(device.vkDevice, m_skybox.sampler, nullptr);
 }
 
 
-void RenderSystem::createSwapchain() {
+void RenderSystem::createSwapchain(uint32_t framesInFlight) {
     if (swapchain == nullptr) {
-        swapchain = std::make_unique<EvSwapchain>(device);
+        swapchain = std::make_unique<EvSwapchain>(device, framesInFlight);
     } else {
         swapchain = std::make_unique<EvSwapchain>(device, std::move(swapchain));
     }
@@ -56,138 +85,527 @@ void RenderSystem::loadSkybox() {
     auto samplerInfo = vks::initializers::samplerCreateInfo(device.vkPhysicalDeviceProperties.limits.maxSamplerAnisotropy);
     vkCheck(vkCreateSampler(device.vkDevice, &samplerInfo, nullptr, &m_skybox.sampler));
 
-    // Allocate the descriptor sets
-    uint32_t nrImages = swapchain->vkImages.size();
-    m_skybox.descriptorSets.resize(nrImages);
-    std::vector<VkDescriptorSetLayout> descriptorSetLayouts(nrImages, forwardPass->getSkybox().descriptorSetLayout);
+    // Allocate the descriptor set, the cubemap never changes so one is enough
     VkDescriptorSetAllocateInfo allocInfo {
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
             .descriptorPool = device.vkDescriptorPool,
-            .descriptorSetCount = nrImages,
-            .pSetLayouts = descriptorSetLayouts.data(),
+            .descriptorSetCount = 1,
+            .pSetLayouts = &forwardPass->getSkybox().descriptorSetLayout,
     };
 
-    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, m_skybox.descriptorSets.data()));
+    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, &m_skybox.descriptorSet));
 
-    // Write the descriptor sets
-    for(int i=0; i<nrImages; i++) {
-        VkDescriptorImageInfo skyboxDescriptorInfo {
-                .sampler = m_skybox.sampler,
-                .imageView = m_skybox.imageView,
-                .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        };
+    // Write the descriptor set
+    VkDescriptorImageInfo skyboxDescriptorInfo {
+            .sampler = m_skybox.sampler,
+            .imageView = m_skybox.imageView,
+            .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
 
-        VkWriteDescriptorSet writeDescriptorImage{
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .dstSet = m_skybox.descriptorSets[i],
-                .dstBinding = 0,
-                .dstArrayElement = 0,
-                .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                .pImageInfo = &skyboxDescriptorInfo
-        };
+    VkWriteDescriptorSet writeDescriptorImage{
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = m_skybox.descriptorSet,
+            .dstBinding = 0,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = &skyboxDescriptorInfo
+    };
 
-        vkUpdateDescriptorSets(device.vkDevice, 1, &writeDescriptorImage, 0, nullptr);
-    }
+    vkUpdateDescriptorSets(device.vkDevice, 1, &writeDescriptorImage, 0, nullptr);
 }
 
 void RenderSystem::allocateCommandBuffers() {
-    commandBuffers.resize(swapchain->vkImages.size());
+    const uint32_t nrFrames = swapchain->getFramesInFlight();
+    commandBuffers.resize(nrFrames);
 
+    // The graphics family pool also serves the post queue, it is in the same family
+    std::vector<VkCommandBuffer> graphicsBuffers(3 * nrFrames);
     VkCommandBufferAllocateInfo createInfo {
             .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
             .commandPool = device.vkCommandPool,
             .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-            .commandBufferCount = static_cast<uint32_t>(commandBuffers.size()),
+            .commandBufferCount = static_cast<uint32_t>(graphicsBuffers.size()),
     };
+    vkCheck(vkAllocateCommandBuffers(device.vkDevice, &createInfo, graphicsBuffers.data()));
+
+    std::vector<VkCommandBuffer> computeBuffers(nrFrames);
+    createInfo.commandPool = device.vkComputeCommandPool;
+    createInfo.commandBufferCount = static_cast<uint32_t>(computeBuffers.size());
+    vkCheck(vkAllocateCommandBuffers(device.vkDevice, &createInfo, computeBuffers.data()));
+
+    for(uint32_t i=0; i<nrFrames; i++) {
+        commandBuffers[i] = FrameCommandBuffers {
+            .prepass = graphicsBuffers[3 * i],
+            .forward = graphicsBuffers[3 * i + 1],
+            .bloom = computeBuffers[i],
+            .post = graphicsBuffers[3 * i + 2],
+        };
+    }
+}
 
-    vkCheck(vkAllocateCommandBuffers(device.vkDevice, &createInfo, commandBuffers.data()));
+void RenderSystem::createTimelines() {
+    forwardTimeline = device.createTimelineSemaphore();
+    bloomTimeline = device.createTimelineSemaphore();
+    postTimeline = device.createTimelineSemaphore();
 }
 
-void RenderSystem::recordCommandBuffer(uint32_t imageIndex, const EvCamera &camera) {
-    const VkCommandBuffer &commandBuffer = commandBuffers[imageIndex];
-    vkCheck(vkResetCommandBuffer(commandBuffer, 0));
+void RenderSystem::createFrameRing() {
+    // In the order of FrameBinding
+    std::vector<EvFrameRing::Binding> bindings {
+        EvFrameRing::Binding {
+            .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+            .range = sizeof(FrameUniforms),
+        },
+        EvFrameRing::Binding {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+            .range = HiZPass::MAX_INSTANCES * sizeof(InstanceData),
+        },
+    };
 
-    VkCommandBufferBeginInfo beginInfo{
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    frameRing = std::make_unique<EvFrameRing>(device, FRAME_RING_PARTITION_SIZE, swapchain->getFramesInFlight(), std::move(bindings));
+}
+
+RenderSystem::GraphSettings RenderSystem::getGraphSettings(const UIInfo &uiInfo) {
+    // Bloom blurs the whole image in between forward and post, and the culling builds its pyramid
+    // from the prepass before forward. Neither fits in a single render pass.
+    const bool merged = uiInfo.mergedPasses && !uiInfo.bloomEnabled;
+    return GraphSettings {
+        .bloomEnabled = uiInfo.bloomEnabled,
+        .bloomMode = uiInfo.bloomMode,
+        .asyncCompute = uiInfo.asyncCompute,
+        .occlusionCulling = uiInfo.occlusionCulling && !merged,
+        .meshletCulling = uiInfo.meshletCulling,
+        .mergedPasses = merged,
     };
+}
+
+void RenderSystem::compileGraph() {
+    using Usage = EvRenderGraph::Usage;
+    renderGraph->reset();
+
+    const auto& families = device.queueFamilyIndices;
+    graphSubmissions.prepass = renderGraph->addSubmission(device.graphicsQueue, families.graphics.value());
+    graphSubmissions.forward = renderGraph->addSubmission(device.graphicsQueue, families.graphics.value());
+    graphSubmissions.bloom = renderGraph->addSubmission(device.computeQueue, families.compute.value());
+    graphSubmissions.post = renderGraph->addSubmission(device.postQueue, families.graphics.value());
+
+    // Merged, the attachments never leave tile memory and the composition reads color and bloom as input
+    // attachments. Otherwise hiz and bloom keep descriptors on them, whether they run this frame or not.
+    const bool merged = graphSettings.mergedPasses;
+    constexpr VkFormat hdrFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+    // The hiz and pyramid descriptor sets always point at depth and bloom, whether those passes run or not
+    graphImages.depth = renderGraph->createImage({ .name = "depth", .format = device.findDepthFormat(),
+                                                   .usage = merged ? 0u : VK_IMAGE_USAGE_SAMPLED_BIT, .transient = merged });
+    graphImages.color = renderGraph->createImage({ .name = "color", .format = VK_FORMAT_R8G8B8A8_SNORM,
+                                                   .usage = merged ? VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT : 0u, .transient = merged });
+    graphImages.bloom = renderGraph->createImage({ .name = "bloom", .format = hdrFormat,
+                                                   .usage = merged ? VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT : VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                                                   .transient = merged });
+    graphImages.bloomBlurred = renderGraph->createVersion(graphImages.bloom, "bloom blurred");
+    // The blurs in between the blits go through general on their own
+    graphImages.gaussian[0] = renderGraph->createImage({ .name = "gaussian horizontal", .format = hdrFormat, .sizeDivisor = 2,
+                                                         .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT });
+    graphImages.gaussian[1] = renderGraph->createImage({ .name = "gaussian vertical", .format = hdrFormat, .sizeDivisor = 2 });
+
+    if (!merged) {
+        renderGraph->addPass("depth", graphSubmissions.prepass, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, [this](VkCommandBuffer commandBuffer) {
+            gpuProfiler->beginZone(commandBuffer, "depth");
+            depthPass->startPass(commandBuffer, renderExtent);
+            recordDepthDraws(commandBuffer);
+            depthPass->endPass(commandBuffer);
+            gpuProfiler->endZone(commandBuffer);
+        }).write(graphImages.depth, Usage::DepthAttachment);
+    }
 
-    vkCheck(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+    // The draw commands and the clusters are buffers, which the graph does not track. Merged, they are
+    // recorded right before the render pass that reads them, on the same queue.
+    const auto cullSubmission = merged ? graphSubmissions.post : graphSubmissions.prepass;
+    const auto cullQueue = merged ? EvGpuProfiler::Queue::Post : EvGpuProfiler::Queue::Graphics;
+    const bool occlusionCulling = graphSettings.occlusionCulling;
+    auto& cullPass = renderGraph->addPass("hiz", cullSubmission, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, [this, occlusionCulling, cullQueue](VkCommandBuffer commandBuffer) {
+        gpuProfiler->beginZone(commandBuffer, "hiz", cullQueue);
+        hiZPass->run(commandBuffer, frameContext.frameIndex, *frameRing, drawList.size(), occlusionCulling);
+        gpuProfiler->endZone(commandBuffer);
+    });
+    cullPass.sideEffects = true;
+    if (occlusionCulling) cullPass.read(graphImages.depth, Usage::Sampled);
+
+    if (graphSettings.meshletCulling) {
+        renderGraph->addPass("meshlet cull", cullSubmission, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, [this, cullQueue](VkCommandBuffer commandBuffer) {
+            gpuProfiler->beginZone(commandBuffer, "meshlet cull", cullQueue);
+            meshletCullPass->run(commandBuffer, frameContext.frameIndex, *frameRing, drawList.size());
+            gpuProfiler->endZone(commandBuffer);
+        }).sideEffects = true;
+    }
 
+    renderGraph->addPass("light cull", cullSubmission, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, [this, cullQueue](VkCommandBuffer commandBuffer) {
+        gpuProfiler->beginZone(commandBuffer, "light cull", cullQueue);
+        lightCullPass->run(commandBuffer, *frameRing, *lightBuffer);
+        gpuProfiler->endZone(commandBuffer);
+    }).sideEffects = true;
+
+    if (merged) {
+        // The overlay pipeline only knows the render pass of post, it draws in a pass of its own after
+        renderGraph->addPass("merged", graphSubmissions.post, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, [this](VkCommandBuffer commandBuffer) {
+            gpuProfiler->beginZone(commandBuffer, "merged", EvGpuProfiler::Queue::Post);
+            mergedPass->beginPass(commandBuffer, frameContext.imageIndex);
+            depthPass->bindMergedPipeline(commandBuffer);
+            recordDepthDraws(commandBuffer);
+            mergedPass->nextSubpass(commandBuffer);
+            forwardPass->bindMergedPipeline(commandBuffer);
+            recordForwardDraws(commandBuffer, true);
+            mergedPass->nextSubpass(commandBuffer);
+            mergedPass->compose(commandBuffer);
+            mergedPass->endPass(commandBuffer);
+
+            postPass->beginOverlayPass(commandBuffer, frameContext.imageIndex);
+            overlay->Draw(commandBuffer);
+            postPass->endPass(commandBuffer);
+            gpuProfiler->endZone(commandBuffer);
+        })
+            .write(graphImages.depth, Usage::DepthAttachment)
+            .write(graphImages.color, Usage::ColorAttachment)
+            .write(graphImages.bloom, Usage::ColorAttachment)
+            .sideEffects = true;
+
+        renderGraph->compile(swapchain->extent);
+        return;
+    }
 
-    {
-        depthPass->startPass(commandBuffer, imageIndex);
-        PushConstant push{
-                .camera = camera.getVPMatrix(device.window.getAspectRatio()),
+    renderGraph->addPass("forward", graphSubmissions.forward, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, [this](VkCommandBuffer commandBuffer) {
+        gpuProfiler->beginZone(commandBuffer, "forward");
+        forwardPass->startPass(commandBuffer, renderExtent);
+        recordForwardDraws(commandBuffer, false);
+        forwardPass->endPass(commandBuffer);
+        gpuProfiler->endZone(commandBuffer);
+    })
+        .read(graphImages.depth, Usage::DepthTest)
+        .write(graphImages.color, Usage::ColorAttachment)
+        .write(graphImages.bloom, Usage::ColorAttachment);
+
+    // Culled when bloom is disabled, nothing reads the blurred version then
+    const auto bloomMode = static_cast<BloomPass::Mode>(graphSettings.bloomMode);
+    if (bloomMode == BloomPass::Mode::Pyramid) {
+        // Only compute, so it can move to the compute queue while the graphics queue goes on with the next prepass
+        const auto queue = graphSettings.asyncCompute ? EvGpuProfiler::Queue::Compute : EvGpuProfiler::Queue::Graphics;
+        renderGraph->addPass("bloom", graphSettings.asyncCompute ? graphSubmissions.bloom : graphSubmissions.forward, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             [this, queue](VkCommandBuffer commandBuffer) {
+            // Opens a profiler zone per step itself
+            bloomPass->run(commandBuffer, renderExtent, BloomPass::Mode::Pyramid, *gpuProfiler, queue);
+        })
+            .read(graphImages.bloom, Usage::Storage)
+            .write(graphImages.bloomBlurred, Usage::Storage);
+    } else {
+        renderGraph->addPass("bloom", graphSubmissions.forward, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, [this, bloomMode](VkCommandBuffer commandBuffer) {
+            bloomPass->run(commandBuffer, renderExtent, bloomMode, *gpuProfiler);
+        })
+            .read(graphImages.bloom, Usage::TransferSrc)
+            .write(graphImages.bloomBlurred, Usage::TransferDst)
+            .write(graphImages.gaussian[0], Usage::TransferDst, Usage::TransferSrc)
+            .write(graphImages.gaussian[1], Usage::Storage);
+    }
+
+    renderGraph->addPass("post", graphSubmissions.post, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, [this](VkCommandBuffer commandBuffer) {
+        gpuProfiler->beginZone(commandBuffer, "post", EvGpuProfiler::Queue::Post);
+        postPass->beginPass(commandBuffer, frameContext.imageIndex, getRenderScale());
+        overlay->Draw(commandBuffer);
+        postPass->endPass(commandBuffer);
+        gpuProfiler->endZone(commandBuffer);
+    })
+        .read(graphImages.color, Usage::Sampled)
+        .read(graphSettings.bloomEnabled ? graphImages.bloomBlurred : graphImages.bloom, Usage::Sampled)
+        .sideEffects = true;
+
+    renderGraph->compile(swapchain->extent);
+}
+
+void RenderSystem::rebuildGraph() {
+    compileGraph();
+    const auto& depth = renderGraph->getImage(graphImages.depth);
+    const auto& color = renderGraph->getImage(graphImages.color);
+    const auto& bloom = renderGraph->getImage(graphImages.bloom);
+
+    uint32_t width = swapchain->extent.width;
+    uint32_t height = swapchain->extent.height;
+    uint32_t nrImages = swapchain->vkImages.size();
+    if (graphSettings.mergedPasses) {
+        // The separate passes sit out until the setting flips back, which rebuilds them as well.
+        // Post is only left with the overlay.
+        mergedPass->recreateFramebuffer(width, height, swapchain->vkImageViews, depth, color, bloom);
+        postPass->recreateFramebuffer(width, height, nrImages, std::nullopt,
+                                      swapchain->surfaceFormat.format, swapchain->presentLayout, swapchain->vkImageViews);
+        return;
+    }
+
+    depthPass->recreateFramebuffer(width, height, depth);
+    hiZPass->recreateFramebuffer(width, height, swapchain->getFramesInFlight(), depth);
+    forwardPass->recreateFramebuffer(width, height, color, bloom, depth);
+    bloomPass->recreateFramebuffer(width, height, bloom, getGaussianImages());
+    postPass->recreateFramebuffer(width, height, nrImages, PostPass::Inputs { color, bloom },
+                                  swapchain->surfaceFormat.format, swapchain->presentLayout, swapchain->vkImageViews);
+}
+
+std::optional<BloomPass::GaussianImages> RenderSystem::getGaussianImages() const {
+    if (!renderGraph->isLive(graphImages.gaussian[0])) return std::nullopt;
+    return BloomPass::GaussianImages { renderGraph->getImage(graphImages.gaussian[0]), renderGraph->getImage(graphImages.gaussian[1]) };
+}
+
+void RenderSystem::writeInstances() {
+    UIInfo& uiInfo = getUIInfo();
+    uiInfo.totalMeshlets = 0;
+    InstanceData* instances = frameRing->allocate<InstanceData>(FRAME_BINDING_INSTANCES, drawList.size());
+    for (uint32_t instanceIdx = 0; instanceIdx < drawList.size(); instanceIdx++) {
+        const DrawItem& item = drawList[instanceIdx];
+        const MeshLod& meshLod = item.mesh->getLod(item.lod);
+        uiInfo.totalMeshlets += meshLod.meshletCount;
+        instances[instanceIdx] = InstanceData {
+            .model = item.model,
+            .bbMin = glm::vec4(item.mesh->boundingBox.vmin, 1.0f),
+            .bbMax = glm::vec4(item.mesh->boundingBox.vmax, 1.0f),
+            .indexCount = meshLod.indexCount,
+            .firstIndex = item.mesh->getFirstIndex() + meshLod.firstIndex,
+            .vertexOffset = item.mesh->getVertexOffset(),
+            .textureIndices = item.textureSet->diffuseIndex | item.textureSet->normalIndex << 16,
+            .firstMeshlet = item.mesh->getFirstMeshlet() + meshLod.firstMeshlet,
+            .meshletCount = meshLod.meshletCount,
+            .wideIndices = item.mesh->getIndexType() == VK_INDEX_TYPE_UINT32 ? 1u : 0u,
         };
+    }
+}
 
-        for (const auto &entity : m_entities) {
-            auto &modelComp = m_coordinator->GetComponent<ModelComponent>(entity);
-            assert(modelComp.mesh);
-            auto scaleMatrix = glm::scale(glm::mat4(1.0f), modelComp.scale);
-            push.mvp = modelComp.transform * scaleMatrix;
-            vkCmdPushConstants(commandBuffer, depthPass->getPipelineLayout(), VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(push), &push);
-            modelComp.mesh->bind(commandBuffer);
-            modelComp.mesh->draw(commandBuffer);
+void RenderSystem::recordDepthDraws(VkCommandBuffer commandBuffer) {
+    UIInfo& uiInfo = getUIInfo();
+    frameRing->bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPass->getPipelineLayout(), 0);
+    geometryArena->bindPositions(commandBuffer);
+    uiInfo.depthPassBinds = 2;
+
+    // The prepass draws everything, it produces the occluders for the culling.
+    std::optional<VkIndexType> boundIndexType;
+    for (uint32_t instanceIdx = 0; instanceIdx < drawList.size(); instanceIdx++) {
+        const DrawItem& item = drawList[instanceIdx];
+        if (item.mesh->getIndexType() != boundIndexType) {
+            boundIndexType = item.mesh->getIndexType();
+            geometryArena->bindIndices(commandBuffer, *boundIndexType);
+            uiInfo.depthPassBinds++;
         }
-        depthPass->endPass(commandBuffer);
+        // The forward pass tests depth for equality, so it has to draw the exact same level.
+        item.mesh->drawLod(commandBuffer, item.lod, 1, instanceIdx);
     }
-    {
-        forwardPass->startPass(commandBuffer, imageIndex);
-        PushConstant push{
-                .camera = camera.getVPMatrix(device.window.getAspectRatio()),
-                .camPos = camera.position,
-        };
+}
 
-        for (const auto &entity : m_entities) {
-            auto &modelComp = m_coordinator->GetComponent<ModelComponent>(entity);
-            assert(modelComp.mesh);
-            auto scaleMatrix = glm::scale(glm::mat4(1.0f), modelComp.scale);
-            push.mvp = modelComp.transform * scaleMatrix;
-            vkCmdPushConstants(commandBuffer, forwardPass->getPipelineLayout(), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(push), &push);
-            auto textureSet = modelComp.textureSet ? modelComp.textureSet : defaultTextureSet;
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, forwardPass->getPipelineLayout(), 0, 1, &textureSet->descriptorSets[imageIndex], 0, nullptr);
-            modelComp.mesh->bind(commandBuffer);
-            modelComp.mesh->draw(commandBuffer);
+void RenderSystem::recordForwardDraws(VkCommandBuffer commandBuffer, bool merged) {
+    UIInfo& uiInfo = getUIInfo();
+    frameRing->bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, forwardPass->getPipelineLayout(), 0);
+    textureTable->bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, forwardPass->getPipelineLayout(), 1);
+    lightCullPass->bindClusters(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, forwardPass->getPipelineLayout(), 2);
+    lightBuffer->bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, forwardPass->getPipelineLayout(), 3);
+    geometryArena->bind(commandBuffer);
+    uiInfo.forwardPassBinds = 5;
+
+    // Same order as the instances, the culling shader wrote one draw command per item.
+    // Geometry lives in the arena and textures in the table, so each index type is one multi draw.
+    // With meshlet culling that draw takes the visible meshlets of the batch instead, however many there are.
+    uint32_t batchStart = 0;
+    while (batchStart < drawList.size()) {
+        const VkIndexType indexType = drawList[batchStart].mesh->getIndexType();
+        uint32_t batchEnd = batchStart + 1;
+        while (batchEnd < drawList.size() && drawList[batchEnd].mesh->getIndexType() == indexType) batchEnd++;
+
+        geometryArena->bindIndices(commandBuffer, indexType);
+        uiInfo.forwardPassBinds++;
+        if (graphSettings.meshletCulling) {
+            meshletCullPass->draw(commandBuffer, indexType);
+        } else {
+            geometryArena->drawIndirect(commandBuffer, hiZPass->getIndirectBuffer(), batchStart, batchEnd - batchStart);
         }
+        batchStart = batchEnd;
+    }
 
-        forwardPass->bindSkyboxPipeline(commandBuffer, camera);
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, forwardPass->getSkybox().pipelineLayout, 0, 1, &m_skybox.descriptorSets[imageIndex], 0, nullptr);
-        m_cubeMesh->bind(commandBuffer);
-        m_cubeMesh->draw(commandBuffer);
-        forwardPass->endPass(commandBuffer);
+    forwardPass->bindSkyboxPipeline(commandBuffer, *frameContext.camera, m_cubeMesh->boundingBox, merged);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, forwardPass->getSkybox().pipelineLayout, 0, 1, &m_skybox.descriptorSet, 0, nullptr);
+    m_cubeMesh->bind(commandBuffer);
+    m_cubeMesh->draw(commandBuffer);
+}
+
+void RenderSystem::recordCommandBuffers(const FrameCommandBuffers& frameCommandBuffers, uint32_t imageIndex, const EvCamera &camera, bool asyncBloom) {
+    const uint32_t frameIndex = swapchain->getCurrentFrame();
+    frameContext = { .camera = &camera, .frameIndex = frameIndex, .imageIndex = imageIndex };
+    auto beginCommandBuffer = [](VkCommandBuffer commandBuffer) {
+        vkCheck(vkResetCommandBuffer(commandBuffer, 0));
+        VkCommandBufferBeginInfo beginInfo{
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        };
+        vkCheck(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+    };
+
+    // The attachments, the pyramid and the clusters are shared with the previous frame, which
+    // may still be executing. Everything it wrote on this queue has to land before this frame
+    // touches them, the forward submission also waits for its post pass on the other queues.
+    auto recordFrameBarrier = [](VkCommandBuffer commandBuffer) {
+        auto frameBarrier = vks::initializers::memoryBarrier();
+        frameBarrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        frameBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &frameBarrier, 0, nullptr, 0, nullptr);
+    };
+
+    VkCommandBuffer commandBuffer = frameCommandBuffers.prepass;
+    beginCommandBuffer(commandBuffer);
+    recordFrameBarrier(commandBuffer);
+    gpuProfiler->beginFrame(commandBuffer, frameIndex);
+
+    buildDrawList(camera);
+    writeInstances();
+    renderGraph->record(graphSubmissions.prepass, commandBuffer);
+    vkCheck(vkEndCommandBuffer(commandBuffer));
+
+    commandBuffer = frameCommandBuffers.forward;
+    beginCommandBuffer(commandBuffer);
+    renderGraph->record(graphSubmissions.forward, commandBuffer);
+    vkCheck(vkEndCommandBuffer(commandBuffer));
+
+    if (asyncBloom) {
+        beginCommandBuffer(frameCommandBuffers.bloom);
+        renderGraph->record(graphSubmissions.bloom, frameCommandBuffers.bloom);
+        vkCheck(vkEndCommandBuffer(frameCommandBuffers.bloom));
     }
-    {
-        if (getUIInfo().bloomEnabled)
-            bloomPass->run(commandBuffer, imageIndex);
+
+    commandBuffer = frameCommandBuffers.post;
+    beginCommandBuffer(commandBuffer);
+    // Merged, the whole frame runs in the post submission, on a queue the barrier above is not on
+    if (graphSettings.mergedPasses) recordFrameBarrier(commandBuffer);
+    renderGraph->record(graphSubmissions.post, commandBuffer);
+    vkCheck(vkEndCommandBuffer(commandBuffer));
+}
+
+void RenderSystem::submit(VkQueue queue, VkCommandBuffer commandBuffer, std::optional<EvTimelinePoint> wait, VkPipelineStageFlags waitStage, std::optional<EvTimelinePoint> signal) const {
+    VkTimelineSemaphoreSubmitInfo timelineInfo {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = wait ? 1u : 0u,
+            .pWaitSemaphoreValues = wait ? &wait->value : nullptr,
+            .signalSemaphoreValueCount = signal ? 1u : 0u,
+            .pSignalSemaphoreValues = signal ? &signal->value : nullptr,
+    };
+
+    VkSubmitInfo submitInfo {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = &timelineInfo,
+            .waitSemaphoreCount = wait ? 1u : 0u,
+            .pWaitSemaphores = wait ? &wait->semaphore : nullptr,
+            .pWaitDstStageMask = wait ? &waitStage : nullptr,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &commandBuffer,
+            .signalSemaphoreCount = signal ? 1u : 0u,
+            .pSignalSemaphores = signal ? &signal->semaphore : nullptr,
+    };
+
+    vkCheck(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+}
+
+uint32_t RenderSystem::selectLod(const EvMesh &mesh, const glm::mat4 &model, const EvCamera &camera) {
+    const UIInfo& uiInfo = getUIInfo();
+    if (!uiInfo.lodEnabled) return 0;
+
+    // Bounding sphere of the instance in world space
+    const glm::vec3 center = model * glm::vec4(mesh.boundingBox.getCenter(), 1.0f);
+    const float maxScale = std::max({glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))});
+    const float radius = 0.5f * glm::length(mesh.boundingBox.vmax - mesh.boundingBox.vmin) * maxScale;
+    const float distance = glm::length(center - camera.position) - radius;
+    if (distance <= 0.0f) return 0;
+
+    // Pixels per world unit at that distance
+    const float pixelsPerUnit = static_cast<float>(renderExtent.height) / (2.0f * std::tan(glm::radians(camera.fov) * 0.5f) * distance);
+
+    // Coarsest level whose error still projects below the threshold
+    uint32_t lod = 0;
+    for(uint32_t i=1; i<mesh.getLodCount(); i++) {
+        if (mesh.getLod(i).error * maxScale * pixelsPerUnit > uiInfo.lodPixelError) break;
+        lod = i;
     }
-    {
-        postPass->beginPass(commandBuffer, imageIndex);
-        overlay->Draw(commandBuffer);
-        postPass->endPass(commandBuffer);
+    return lod;
+}
+
+void RenderSystem::buildDrawList(const EvCamera &camera) {
+    // Bits from most to least significant: pipeline (7), index type (1), texture set (16), mesh (16), depth (24).
+    // Only the forward pipeline draws entities for now, so the pipeline bits are always zero.
+    // The index type splits the list in two batches, each drawn with its own index buffer.
+    const uint64_t pipelineId = 0;
+    const float depthScale = static_cast<float>((1u << 24) - 1) / MAX_SORT_DISTANCE;
+
+    drawList.clear();
+    for (const auto &entity : m_entities) {
+        auto &modelComp = m_coordinator->GetComponent<ModelComponent>(entity);
+        assert(modelComp.mesh);
+        auto scaleMatrix = glm::scale(glm::mat4(1.0f), modelComp.scale);
+        const glm::mat4 model = modelComp.transform * scaleMatrix;
+        auto textureSet = modelComp.textureSet ? modelComp.textureSet : defaultTextureSet;
+
+        // Front to back within a batch, which helps the early depth test.
+        const glm::vec3 center = model * glm::vec4(modelComp.mesh->boundingBox.getCenter(), 1.0f);
+        const float distance = std::min(glm::length(center - camera.position), MAX_SORT_DISTANCE);
+        const uint64_t depth = static_cast<uint64_t>(distance * depthScale);
+
+        const uint64_t indexType = modelComp.mesh->getIndexType() == VK_INDEX_TYPE_UINT32 ? 1 : 0;
+        const uint64_t key = pipelineId << 57
+                | indexType << 56
+                | static_cast<uint64_t>(textureSet->id & 0xffff) << 40
+                | static_cast<uint64_t>(modelComp.mesh->id & 0xffff) << 24
+                | depth;
+
+        drawList.push_back(DrawItem {
+            .key = key,
+            .mesh = modelComp.mesh,
+            .textureSet = textureSet,
+            .lod = selectLod(*modelComp.mesh, model, camera),
+            .model = model,
+        });
     }
-    vkCheck(vkEndCommandBuffer(commandBuffer));
+
+    std::sort(drawList.begin(), drawList.end(), [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
 }
 
 void RenderSystem::recreateSwapchain() {
     vkCheck(vkDeviceWaitIdle(device.vkDevice));
     device.window.waitForEvent();
     createSwapchain();
-    uint32_t width = swapchain->extent.width;
-    uint32_t height = swapchain->extent.height;
-    uint32_t nrImages = swapchain->vkImages.size();
-    depthPass->recreateFramebuffer(width, height, nrImages);
-    forwardPass->recreateFramebuffer(width, height, nrImages, depthPass->getFramebuffer().depths);
-    bloomPass->recreateFramebuffer(width, height, nrImages, forwardPass->getFramebuffer().blooms);
-    postPass->recreateFramebuffer(width, height, nrImages, forwardPass->getFramebuffer().colors, forwardPass->getFramebuffer().blooms,
-                                  swapchain->surfaceFormat.format, swapchain->vkImageViews);
+    rebuildGraph();
+}
+
+void RenderSystem::updateRenderExtent() {
+    UIInfo& uiInfo = getUIInfo();
+    if (uiInfo.dynamicResolution && gpuProfiler->isSupported()) {
+        const float gpuMs = gpuProfiler->getBusiestQueueMs();
+        if (gpuMs > 0.0f) {
+            // The cost of most passes follows the pixel count, which goes with the square of the scale
+            const float idealScale = uiInfo.renderScale * std::sqrt(uiInfo.targetGpuMs / gpuMs);
+            uiInfo.renderScale += (idealScale - uiInfo.renderScale) * RENDER_SCALE_GAIN;
+        }
+    }
+    uiInfo.renderScale = std::clamp(uiInfo.renderScale, UIInfo::MIN_RENDER_SCALE, 1.0f);
+    // The composition of the merged pass reads its own pixel, there is nothing to upsample from
+    if (graphSettings.mergedPasses) uiInfo.renderScale = 1.0f;
+
+    // The attachments keep the swapchain size, a smaller scale only shrinks the viewport
+    renderExtent = VkExtent2D {
+        .width = std::max(static_cast<uint32_t>(std::round(static_cast<float>(swapchain->extent.width) * uiInfo.renderScale)), 1u),
+        .height = std::max(static_cast<uint32_t>(std::round(static_cast<float>(swapchain->extent.height) * uiInfo.renderScale)), 1u),
+    };
 }
 
 void RenderSystem::Render(const EvCamera &camera) {
-    overlay->NewFrame();
+    {
+        EV_CPU_ZONE("overlay");
+        overlay->NewFrame();
+    }
     uint32_t imageIndex;
-    VkResult acquireImageResult = swapchain->acquireNextSwapchainImage(&imageIndex);
+    VkResult acquireImageResult;
+    {
+        EV_CPU_ZONE("acquire");
+        acquireImageResult = swapchain->acquireNextSwapchainImage(&imageIndex);
+    }
 
     if (acquireImageResult == VK_ERROR_OUT_OF_DATE_KHR) {
         recreateSwapchain();
@@ -196,13 +614,73 @@ void RenderSystem::Render(const EvCamera &camera) {
         throw std::runtime_error("Failed to acquire swapchain image");
     }
 
-    const uint nrLights = lightSubSystem->m_entities.size();
-    const UIInfo& uiInfo = getUIInfo();
-    forwardPass->setLightProperties(imageIndex, 1.0f, uiInfo.linear, uiInfo.quadratic);
-    forwardPass->updateLights(m_coordinator->GetComponentArrayData<LightComponent>(), nrLights, imageIndex);
-    recordCommandBuffer(imageIndex, camera);
+    const uint32_t nrLights = static_cast<uint32_t>(lightSubSystem->m_entities.size());
+    UIInfo& uiInfo = getUIInfo();
+    const uint32_t frameIndex = swapchain->getCurrentFrame();
+    uiInfo.drawnInstances = hiZPass->getVisibleCount(frameIndex);
+    uiInfo.totalInstances = m_entities.size();
+    hiZPass->resetVisibleCount(frameIndex);
+    uiInfo.drawnMeshlets = meshletCullPass->getVisibleCount(frameIndex);
+    meshletCullPass->resetVisibleCount(frameIndex);
+
+    // The passes that run and the images between them follow these settings
+    const GraphSettings settings = getGraphSettings(uiInfo);
+    if (settings != graphSettings) {
+        vkCheck(vkDeviceWaitIdle(device.vkDevice));
+        graphSettings = settings;
+        rebuildGraph();
+    }
+    updateRenderExtent();
+
+    // The fence of this frame was waited on while acquiring, so its partition is free again.
+    frameRing->beginFrame(frameIndex);
+    const float aspectRatio = device.window.getAspectRatio();
+    const float tanHalfFov = std::tan(glm::radians(camera.fov) * 0.5f);
+    *frameRing->allocate<FrameUniforms>(FRAME_BINDING_UNIFORMS) = FrameUniforms {
+        .viewProjection = camera.getVPMatrix(aspectRatio),
+        .camPos = glm::vec4(camera.position, 1.0f),
+        .lightCount = nrLights,
+        .falloffConstant = 1.0f,
+        .falloffLinear = uiInfo.linear,
+        .falloffQuadratic = uiInfo.quadratic,
+        .view = camera.getViewMatrix(),
+        .tanHalfFov = glm::vec2(tanHalfFov * aspectRatio, tanHalfFov),
+        .screenSize = glm::vec2(renderExtent.width, renderExtent.height),
+        .zNear = camera.zNear,
+        .zFar = camera.zFar,
+        .lightCutoff = uiInfo.lightCutoff,
+        .renderScale = getRenderScale(),
+    };
+    {
+        EV_CPU_ZONE("light upload");
+        syncLights();
+    }
+    // Only the pyramid with async compute enabled lands here, otherwise bloom was culled or stays on the graphics queue
+    const bool asyncBloom = renderGraph->hasPasses(graphSubmissions.bloom);
+    const FrameCommandBuffers& frameCommandBuffers = commandBuffers[frameIndex];
+    {
+        EV_CPU_ZONE("record");
+        recordCommandBuffers(frameCommandBuffers, imageIndex, camera, asyncBloom);
+        frameRing->flush();
+    }
 
-    VkResult presentResult = swapchain->presentCommandBuffer(commandBuffers[imageIndex], imageIndex);
+    VkResult presentResult;
+    {
+        EV_CPU_ZONE("present");
+        const uint64_t frame = ++frameNumber;
+        submit(device.graphicsQueue, frameCommandBuffers.prepass, std::nullopt, 0, std::nullopt);
+        // The previous post pass samples the attachments the forward pass clears
+        submit(device.graphicsQueue, frameCommandBuffers.forward, EvTimelinePoint { postTimeline, frame - 1 }, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+               EvTimelinePoint { forwardTimeline, frame });
+        // The submissions on the other queues wait with all of their commands, so that their zones only
+        // start after the queries were reset in the prepass and do not count the time spent waiting.
+        if (asyncBloom) {
+            submit(device.computeQueue, frameCommandBuffers.bloom, EvTimelinePoint { forwardTimeline, frame }, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                   EvTimelinePoint { bloomTimeline, frame });
+        }
+        const EvTimelinePoint inputsReady = asyncBloom ? EvTimelinePoint { bloomTimeline, frame } : EvTimelinePoint { forwardTimeline, frame };
+        presentResult = swapchain->presentCommandBuffer(frameCommandBuffers.post, imageIndex, inputsReady, EvTimelinePoint { postTimeline, frame });
+    }
 
     if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR || device.window.wasResized) {
         device.window.wasResized = false;
@@ -213,6 +691,28 @@ void RenderSystem::Render(const EvCamera &camera) {
     }
 }
 
+void RenderSystem::markLightsMoved(const std::vector<Entity> &entities) {
+    for(const auto& entity : entities) {
+        if (m_coordinator->HasComponent<LightComponent>(entity)) {
+            lightBuffer->markDirty(static_cast<uint32_t>(m_coordinator->GetComponentIndex<LightComponent>(entity)));
+        }
+    }
+}
+
+void RenderSystem::syncLights() {
+    const uint32_t nrLights = static_cast<uint32_t>(lightSubSystem->m_entities.size());
+
+    // Lights that were added since the last frame, and holes that were filled by the last light.
+    const uint32_t firstAdded = std::min(syncedLightCount, lightSubSystem->shrunkTo);
+    if (nrLights > firstAdded) lightBuffer->markDirty(firstAdded, nrLights - firstAdded);
+    for(const auto& index : lightSubSystem->reusedIndices) lightBuffer->markDirty(index);
+    lightSubSystem->reusedIndices.clear();
+    lightSubSystem->shrunkTo = std::numeric_limits<uint32_t>::max();
+    syncedLightCount = nrLights;
+
+    getUIInfo().lightBytesUploaded = lightBuffer->sync(swapchain->getCurrentFrame(), m_coordinator->GetComponentArrayData<LightComponent>(), nrLights);
+}
+
 Signature RenderSystem::GetSignature() const {
     Signature signature{};
     signature.set(m_coordinator->GetComponentType<ModelComponent>());
@@ -220,64 +720,25 @@ Signature RenderSystem::GetSignature() const {
 }
 
 EvMesh * RenderSystem::loadMesh(const std::string &filename, std::string *diffuseTextureFile, std::string *normalTextureFile) {
-    std::vector<Vertex> vertices;
-    std::vector<uint32_t> indices;
-    BoundingBox bb{};
-    EvMesh::loadMesh(filename, &vertices, &indices, &bb, diffuseTextureFile, normalTextureFile);
+    EvMeshData data;
+    EvMesh::loadMesh(filename, &data, diffuseTextureFile, normalTextureFile);
 
-    createdMeshes.push_back(std::make_unique<EvMesh>(device, vertices, indices, bb));
+    assert(createdMeshes.size() <= 0xffff && "mesh ids have to fit in the draw sort key");
+    createdMeshes.push_back(std::make_unique<EvMesh>(*geometryArena, data));
+    createdMeshes.back()->id = static_cast<uint32_t>(createdMeshes.size() - 1);
     return createdMeshes.back().get();
 }
 
 TextureSet *RenderSystem::createTextureSet(EvTexture *diffuseTexture, EvTexture *normalTexture) {
     assert(diffuseTexture);
 
+    assert(createdTextureSets.size() <= 0xffff && "texture set ids have to fit in the draw sort key");
     createdTextureSets.push_back(std::make_unique<TextureSet>());
     auto tset = createdTextureSets.back().get();
+    tset->id = static_cast<uint32_t>(createdTextureSets.size() - 1);
     if (!normalTexture) normalTexture = m_normalTexture;
-    tset->descriptorSets.resize(swapchain->vkImages.size());
-
-    std::vector<VkDescriptorSetLayout> layouts(tset->descriptorSets.size(), forwardPass->getDescriptorSetLayout());
-    VkDescriptorSetAllocateInfo allocInfo {
-            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-            .descriptorPool = device.vkDescriptorPool,
-            .descriptorSetCount = static_cast<uint32_t>(tset->descriptorSets.size()),
-            .pSetLayouts = layouts.data(),
-    };
-
-    vkCheck(vkAllocateDescriptorSets(device.vkDevice, &allocInfo, tset->descriptorSets.data()));
-
-    auto albedoDescriptor = diffuseTexture->getDescriptorInfo();
-    auto normalDescriptor = normalTexture->getDescriptorInfo();
-
-    for(int i=0; i<swapchain->vkImages.size(); i++) {
-        std::array<VkWriteDescriptorSet,2> descriptorWrites {
-                VkWriteDescriptorSet {
-                        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                        .dstSet = tset->descriptorSets[i],
-                        .dstBinding = 0,
-                        .dstArrayElement = 0,
-                        .descriptorCount = 1,
-                        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                        .pImageInfo = &albedoDescriptor,
-                },
-                VkWriteDescriptorSet {
-                        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                        .dstSet = tset->descriptorSets[i],
-                        .dstBinding = 1,
-                        .dstArrayElement = 0,
-                        .descriptorCount = 1,
-                        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                        .pImageInfo = &normalDescriptor,
-                },
-        };
-
-        vkUpdateDescriptorSets(
-                device.vkDevice,
-                static_cast<uint32_t>(descriptorWrites.size()),
-                descriptorWrites.data(),
-                0, nullptr);
-    }
+    tset->diffuseIndex = textureTable->registerTexture(*diffuseTexture);
+    tset->normalIndex = textureTable->registerTexture(*normalTexture);
     return tset;
 }
 